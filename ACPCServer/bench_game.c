@@ -0,0 +1,616 @@
+/*
+Copyright (C) 2011 by the Computer Poker Research Group, University of Alberta
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include "game.h"
+#include "rng.h"
+
+
+/* micro-benchmarks for the game.c primitives used on every action by
+   the dealer and players
+
+   the hands come from the STATE lines of dealer log files, so the
+   benchmarks see the same mix of betting sequences as real matches.
+   if no log file is given, hands are generated by random self-play
+   from a fixed seed
+
+   every benchmark reports nanoseconds and heap allocations per call */
+
+
+#define DEFAULT_MIN_SECS 0.2
+#define DEFAULT_GENERATED_HANDS 1000
+#define DEFAULT_SEED 0
+
+
+/* a state where a player is about to act, and the action they took */
+typedef struct {
+  State state;
+  Action action;
+} Decision;
+
+typedef struct {
+  const Game *game;
+
+  /* finished hands */
+  State *hands;
+  int numHands;
+  int maxHands;
+
+  /* every decision point in the hands */
+  Decision *decisions;
+  int numDecisions;
+
+  /* messages for every decision point, as seen by each player */
+  char **messages;
+  int numMessages;
+
+  /* seed for the dealing benchmark */
+  uint32_t seed;
+} Corpus;
+
+typedef struct {
+  const char *name;
+  uint64_t ops;
+  double nanos;
+  uint64_t allocs;
+} Result;
+
+
+/* count heap allocations made by the code being measured */
+static uint64_t numAllocs;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc( size_t size );
+extern void *__libc_calloc( size_t num, size_t size );
+extern void *__libc_realloc( void *ptr, size_t size );
+
+void *malloc( size_t size )
+{
+  ++numAllocs;
+  return __libc_malloc( size );
+}
+
+void *calloc( size_t num, size_t size )
+{
+  ++numAllocs;
+  return __libc_calloc( num, size );
+}
+
+void *realloc( void *ptr, size_t size )
+{
+  ++numAllocs;
+  return __libc_realloc( ptr, size );
+}
+#endif
+
+/* results of the benchmarked calls are accumulated here so the
+   compiler can't throw the calls away */
+static volatile int64_t sink;
+
+
+static void printUsage( FILE *file )
+{
+  fprintf( file, "usage: bench_game [options] gameDefFile [logFile ...]\n" );
+  fprintf( file, "  -j print results as JSON\n" );
+  fprintf( file, "  -t [seconds] minimum time to run each benchmark [default %g]\n",
+	   DEFAULT_MIN_SECS );
+  fprintf( file, "  -n [hands] hands of random self-play to use when no log file is\n" );
+  fprintf( file, "    given [default %d]\n", DEFAULT_GENERATED_HANDS );
+  fprintf( file, "  -s [seed] seed for dealing and self-play [default %d]\n",
+	   DEFAULT_SEED );
+}
+
+static uint64_t monotonicNanos()
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void addHand( Corpus *corpus, const State *state )
+{
+  if( corpus->numHands == corpus->maxHands ) {
+
+    corpus->maxHands = corpus->maxHands ? corpus->maxHands * 2 : 1024;
+    corpus->hands = realloc( corpus->hands,
+			     corpus->maxHands * sizeof( State ) );
+    if( corpus->hands == NULL ) {
+
+      fprintf( stderr, "ERROR: could not allocate hands\n" );
+      exit( EXIT_FAILURE );
+    }
+  }
+
+  corpus->hands[ corpus->numHands ] = *state;
+  ++corpus->numHands;
+}
+
+/* add all the finished hands in a dealer log file
+   returns >= 0 on success, -1 on failure */
+static int readLogFile( const char *filename, Corpus *corpus )
+{
+  FILE *file;
+  State state;
+  char line[ MAX_LINE_LEN ];
+
+  file = fopen( filename, "r" );
+  if( file == NULL ) {
+
+    fprintf( stderr, "ERROR: could not open log file %s\n", filename );
+    return -1;
+  }
+
+  while( fgets( line, MAX_LINE_LEN, file ) ) {
+
+    if( strncmp( line, "STATE:", 6 ) ) {
+      /* comments and scores */
+
+      continue;
+    }
+
+    if( readState( line, corpus->game, &state ) < 0
+	|| !stateFinished( &state ) ) {
+
+      fprintf( stderr, "ERROR: could not read hand %s", line );
+      fclose( file );
+      return -1;
+    }
+
+    addHand( corpus, &state );
+  }
+
+  fclose( file );
+  return 0;
+}
+
+/* play numHands hands with every player acting like example_player */
+static void generateHands( const int numHands, const uint32_t seed,
+			   Corpus *corpus )
+{
+  int h;
+  int32_t min, max;
+  double p;
+  State state;
+  Action action;
+  rng_state_t rng;
+
+  init_genrand( &rng, seed );
+  for( h = 0; h < numHands; ++h ) {
+
+    initState( corpus->game, h, &state );
+    dealCards( corpus->game, &rng, &state );
+
+    while( !stateFinished( &state ) ) {
+
+      p = genrand_real2( &rng );
+      action.type = a_fold;
+      action.size = 0;
+      if( p < 0.06 && isValidAction( corpus->game, &state, 0, &action ) ) {
+	/* fold */
+      } else if( p >= 0.53
+		 && raiseIsValid( corpus->game, &state, &min, &max ) ) {
+
+	action.type = a_raise;
+	action.size = min + genrand_uniform( &rng, max - min + 1 );
+      } else {
+
+	action.type = a_call;
+      }
+
+      doAction( corpus->game, &action, &state );
+    }
+
+    addHand( corpus, &state );
+  }
+}
+
+/* set up a state at the start of the hand with the same cards */
+static void initHand( const Game *game, const State *hand, State *state )
+{
+  initState( game, hand->handId, state );
+  memcpy( state->holeCards, hand->holeCards, sizeof( state->holeCards ) );
+  memcpy( state->boardCards, hand->boardCards, sizeof( state->boardCards ) );
+}
+
+/* replay the hands to find all the decision points, and print the
+   message each player would see at each of them */
+static void buildDecisions( Corpus *corpus )
+{
+  int h, r, i, d, m, len;
+  uint8_t p;
+  State state;
+  MatchState matchState;
+  char line[ MAX_LINE_LEN ];
+
+  d = 0;
+  for( h = 0; h < corpus->numHands; ++h ) {
+
+    for( r = 0; r <= corpus->hands[ h ].round; ++r ) {
+
+      d += corpus->hands[ h ].numActions[ r ];
+    }
+  }
+  corpus->decisions = malloc( d * sizeof( Decision ) );
+  corpus->messages = malloc( d * corpus->game->numPlayers * sizeof( char * ) );
+  if( corpus->decisions == NULL || corpus->messages == NULL ) {
+
+    fprintf( stderr, "ERROR: could not allocate decisions\n" );
+    exit( EXIT_FAILURE );
+  }
+
+  d = 0;
+  m = 0;
+  for( h = 0; h < corpus->numHands; ++h ) {
+
+    initHand( corpus->game, &corpus->hands[ h ], &state );
+    for( r = 0; r <= corpus->hands[ h ].round; ++r ) {
+
+      for( i = 0; i < corpus->hands[ h ].numActions[ r ]; ++i ) {
+
+	corpus->decisions[ d ].state = state;
+	corpus->decisions[ d ].action = corpus->hands[ h ].action[ r ][ i ];
+
+	matchState.state = state;
+	for( p = 0; p < corpus->game->numPlayers; ++p ) {
+
+	  matchState.viewingPlayer = p;
+	  len = printMatchState( corpus->game, &matchState, MAX_LINE_LEN, line );
+	  if( len < 0 ) {
+
+	    fprintf( stderr, "ERROR: state message too long\n" );
+	    exit( EXIT_FAILURE );
+	  }
+	  corpus->messages[ m ] = strdup( line );
+	  ++m;
+	}
+
+	doAction( corpus->game, &corpus->decisions[ d ].action, &state );
+	++d;
+      }
+    }
+  }
+
+  corpus->numDecisions = d;
+  corpus->numMessages = m;
+}
+
+
+/* each benchmark function makes one pass over the corpus
+   returns the number of operations done */
+
+static uint64_t benchReadMatchState( const Corpus *corpus )
+{
+  int i;
+  MatchState state;
+
+  for( i = 0; i < corpus->numMessages; ++i ) {
+
+    sink += readMatchState( corpus->messages[ i ], corpus->game, &state );
+  }
+
+  return corpus->numMessages;
+}
+
+static uint64_t benchPrintMatchState( const Corpus *corpus )
+{
+  int d;
+  uint8_t p;
+  MatchState state;
+  char line[ MAX_LINE_LEN ];
+
+  for( d = 0; d < corpus->numDecisions; ++d ) {
+
+    state.state = corpus->decisions[ d ].state;
+    for( p = 0; p < corpus->game->numPlayers; ++p ) {
+
+      state.viewingPlayer = p;
+      sink += printMatchState( corpus->game, &state, MAX_LINE_LEN, line );
+    }
+  }
+
+  return (uint64_t)corpus->numDecisions * corpus->game->numPlayers;
+}
+
+static uint64_t benchInitHands( const Corpus *corpus )
+{
+  int h;
+  State state;
+
+  for( h = 0; h < corpus->numHands; ++h ) {
+
+    initHand( corpus->game, &corpus->hands[ h ], &state );
+    sink += state.handId;
+  }
+
+  return corpus->numHands;
+}
+
+/* replays every hand from the start, benchInitHands is subtracted to
+   get the time for doAction alone */
+static uint64_t benchDoAction( const Corpus *corpus )
+{
+  int h, r, i;
+  uint64_t ops;
+  State state;
+
+  ops = 0;
+  for( h = 0; h < corpus->numHands; ++h ) {
+
+    initHand( corpus->game, &corpus->hands[ h ], &state );
+    for( r = 0; r <= corpus->hands[ h ].round; ++r ) {
+
+      for( i = 0; i < corpus->hands[ h ].numActions[ r ]; ++i ) {
+
+	doAction( corpus->game, &corpus->hands[ h ].action[ r ][ i ], &state );
+	++ops;
+      }
+    }
+    sink += state.spent[ 0 ];
+  }
+
+  return ops;
+}
+
+static uint64_t benchIsValidAction( const Corpus *corpus )
+{
+  int d;
+  Action action;
+
+  for( d = 0; d < corpus->numDecisions; ++d ) {
+
+    action = corpus->decisions[ d ].action;
+    sink += isValidAction( corpus->game, &corpus->decisions[ d ].state,
+			   0, &action );
+  }
+
+  return corpus->numDecisions;
+}
+
+static uint64_t benchRaiseIsValid( const Corpus *corpus )
+{
+  int d;
+  int32_t min, max;
+
+  for( d = 0; d < corpus->numDecisions; ++d ) {
+
+    if( raiseIsValid( corpus->game, &corpus->decisions[ d ].state,
+		      &min, &max ) ) {
+
+      sink += max - min;
+    }
+  }
+
+  return corpus->numDecisions;
+}
+
+static uint64_t benchValueOfState( const Corpus *corpus )
+{
+  int h;
+  uint8_t p;
+
+  for( h = 0; h < corpus->numHands; ++h ) {
+
+    for( p = 0; p < corpus->game->numPlayers; ++p ) {
+
+      sink += (int64_t)valueOfState( corpus->game, &corpus->hands[ h ], p );
+    }
+  }
+
+  return (uint64_t)corpus->numHands * corpus->game->numPlayers;
+}
+
+static uint64_t benchDealCards( const Corpus *corpus )
+{
+  int h;
+  State state;
+  static rng_state_t rng;
+  static int rngInitialised = 0;
+
+  if( !rngInitialised ) {
+
+    init_genrand( &rng, corpus->seed );
+    rngInitialised = 1;
+  }
+
+  for( h = 0; h < corpus->numHands; ++h ) {
+
+    dealCards( corpus->game, &rng, &state );
+    sink += state.holeCards[ 0 ][ 0 ];
+  }
+
+  return corpus->numHands;
+}
+
+/* run bench over the corpus until at least minSecs have passed */
+static void runBenchmark( const char *name,
+			  uint64_t ( *bench )( const Corpus *corpus ),
+			  const Corpus *corpus, const double minSecs,
+			  Result *result )
+{
+  uint64_t start, elapsed, allocs;
+
+  /* warm up the caches */
+  bench( corpus );
+
+  result->name = name;
+  result->ops = 0;
+  allocs = numAllocs;
+  start = monotonicNanos();
+  do {
+
+    result->ops += bench( corpus );
+    elapsed = monotonicNanos() - start;
+  } while( elapsed < minSecs * 1e9 || result->ops == 0 );
+
+  result->nanos = (double)elapsed;
+  result->allocs = numAllocs - allocs;
+}
+
+int main( int argc, char **argv )
+{
+  int i, json, numGenerated, numResults;
+  uint32_t seed;
+  double minSecs, initNanosPerHand;
+  FILE *file;
+  Game *game;
+  Corpus corpus;
+  Result results[ 8 ], init;
+
+  json = 0;
+  minSecs = DEFAULT_MIN_SECS;
+  numGenerated = DEFAULT_GENERATED_HANDS;
+  seed = DEFAULT_SEED;
+
+  while( ( i = getopt( argc, argv, "jt:n:s:" ) ) >= 0 ) {
+
+    switch( i ) {
+    case 'j':
+
+      json = 1;
+      break;
+
+    case 't':
+
+      if( sscanf( optarg, "%lf", &minSecs ) < 1 ) {
+
+	fprintf( stderr, "ERROR: invalid time %s\n", optarg );
+	exit( EXIT_FAILURE );
+      }
+      break;
+
+    case 'n':
+
+      if( sscanf( optarg, "%d", &numGenerated ) < 1 || numGenerated <= 0 ) {
+
+	fprintf( stderr, "ERROR: invalid number of hands %s\n", optarg );
+	exit( EXIT_FAILURE );
+      }
+      break;
+
+    case 's':
+
+      if( sscanf( optarg, "%"SCNu32, &seed ) < 1 ) {
+
+	fprintf( stderr, "ERROR: invalid seed %s\n", optarg );
+	exit( EXIT_FAILURE );
+      }
+      break;
+
+    default:
+
+      printUsage( stderr );
+      exit( EXIT_FAILURE );
+    }
+  }
+
+  if( optind >= argc ) {
+
+    printUsage( stderr );
+    exit( EXIT_FAILURE );
+  }
+
+  /* get the game */
+  file = fopen( argv[ optind ], "r" );
+  if( file == NULL ) {
+
+    fprintf( stderr, "ERROR: could not open game %s\n", argv[ optind ] );
+    exit( EXIT_FAILURE );
+  }
+  game = readGame( file );
+  if( game == NULL ) {
+
+    fprintf( stderr, "ERROR: could not read game %s\n", argv[ optind ] );
+    exit( EXIT_FAILURE );
+  }
+  fclose( file );
+
+  /* get the hands */
+  memset( &corpus, 0, sizeof( corpus ) );
+  corpus.game = game;
+  corpus.seed = seed;
+  for( i = optind + 1; i < argc; ++i ) {
+
+    if( readLogFile( argv[ i ], &corpus ) < 0 ) {
+
+      exit( EXIT_FAILURE );
+    }
+  }
+  if( optind + 1 == argc ) {
+
+    generateHands( numGenerated, seed, &corpus );
+  }
+  if( corpus.numHands == 0 ) {
+
+    fprintf( stderr, "ERROR: no hands to benchmark\n" );
+    exit( EXIT_FAILURE );
+  }
+  buildDecisions( &corpus );
+
+  /* run the benchmarks */
+  numResults = 0;
+  runBenchmark( "readMatchState", benchReadMatchState, &corpus, minSecs,
+		&results[ numResults++ ] );
+  runBenchmark( "printMatchState", benchPrintMatchState, &corpus, minSecs,
+		&results[ numResults++ ] );
+  runBenchmark( "initState", benchInitHands, &corpus, minSecs, &init );
+  runBenchmark( "doAction", benchDoAction, &corpus, minSecs,
+		&results[ numResults ] );
+  /* take out the time spent setting up each hand */
+  initNanosPerHand = init.nanos / init.ops;
+  results[ numResults ].nanos -= initNanosPerHand * corpus.numHands
+    * ( results[ numResults ].ops / (double)corpus.numDecisions );
+  ++numResults;
+  runBenchmark( "isValidAction", benchIsValidAction, &corpus, minSecs,
+		&results[ numResults++ ] );
+  runBenchmark( "raiseIsValid", benchRaiseIsValid, &corpus, minSecs,
+		&results[ numResults++ ] );
+  runBenchmark( "valueOfState", benchValueOfState, &corpus, minSecs,
+		&results[ numResults++ ] );
+  runBenchmark( "dealCards", benchDealCards, &corpus, minSecs,
+		&results[ numResults++ ] );
+
+  /* print the results */
+  if( json ) {
+
+    printf( "{\n  \"game\": \"%s\",\n  \"hands\": %d,\n  \"decisions\": %d,\n  \"benchmarks\": [\n",
+	    argv[ optind ], corpus.numHands, corpus.numDecisions );
+    for( i = 0; i < numResults; ++i ) {
+
+      printf( "    { \"name\": \"%s\", \"ops\": %"PRIu64", \"ns_per_op\": %.2f, \"allocs_per_op\": %.4f }%s\n",
+	      results[ i ].name, results[ i ].ops,
+	      results[ i ].nanos / results[ i ].ops,
+	      (double)results[ i ].allocs / results[ i ].ops,
+	      i + 1 < numResults ? "," : "" );
+    }
+    printf( "  ]\n}\n" );
+  } else {
+
+    printf( "game %s, %d hands, %d decisions\n",
+	    argv[ optind ], corpus.numHands, corpus.numDecisions );
+    printf( "%-16s %12s %12s %14s\n", "benchmark", "ops", "ns/op", "allocs/op" );
+    for( i = 0; i < numResults; ++i ) {
+
+      printf( "%-16s %12"PRIu64" %12.2f %14.4f\n",
+	      results[ i ].name, results[ i ].ops,
+	      results[ i ].nanos / results[ i ].ops,
+	      (double)results[ i ].allocs / results[ i ].ops );
+    }
+  }
+
+  for( i = 0; i < corpus.numMessages; ++i ) {
+
+    free( corpus.messages[ i ] );
+  }
+  free( corpus.messages );
+  free( corpus.decisions );
+  free( corpus.hands );
+  free( game );
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,647 @@
+/*
+Copyright (C) 2011 by the Computer Poker Research Group, University of Alberta
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <getopt.h>
+#include "game.h"
+#include "rng.h"
+#include "net.h"
+
+
+/* runs a complete match of dealer against a set of bots over loopback
+   and reports end to end throughput
+
+   each bot is either "random", a random player which runs as a thread
+   inside this process and times every action it makes, or the path of
+   an executable which is started as "bot gameDefFile localhost port",
+   like example_player
+
+   action latency is the time between a random bot sending its action
+   and receiving the next state from the dealer, so it covers the dealer
+   parsing, validating and logging the action and sending the new state
+   to every seat
+
+   cards are dealt from rngSeed and the random bots are seeded from
+   rngSeed and their seat, so a match of random bots plays exactly the
+   same hands every time it is run */
+
+
+#define DEFAULT_DEALER "./dealer"
+#define BENCH_HOST "localhost"
+
+
+typedef struct {
+  const Game *game;
+  int sock;
+  uint8_t seat;
+  uint32_t seed;
+
+  /* latency of each action in nanoseconds */
+  uint64_t *latency;
+  size_t numActions;
+  size_t maxActions;
+
+  int failed;
+} RandomBot;
+
+
+static void printUsage( FILE *file )
+{
+  fprintf( file, "usage: bench_selfplay gameDefFile #Hands rngSeed bot1 bot2 ... [options]\n" );
+  fprintf( file, "  bots are either random for an in-process random player, or an executable\n" );
+  fprintf( file, "    run as \"bot gameDefFile host port\"\n" );
+  fprintf( file, "  -d dealer executable [default is %s]\n", DEFAULT_DEALER );
+  fprintf( file, "  -c pass -c to the dealer to use counter-based deals\n" );
+  fprintf( file, "  -v show dealer and bot output\n" );
+}
+
+static uint64_t monotonicNanos()
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static double timevalSecs( const struct timeval *tv )
+{
+  return tv->tv_sec + tv->tv_usec / 1000000.0;
+}
+
+static int compareUint64( const void *a, const void *b )
+{
+  const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return x < y ? -1 : ( x > y ? 1 : 0 );
+}
+
+/* get the number of read and write style system calls made by pid
+   returns >= 0 on success, -1 if they aren't available */
+static int64_t readSyscalls( const pid_t pid )
+{
+  FILE *file;
+  int64_t r, w;
+  char name[ 64 ];
+  char line[ 256 ];
+
+  snprintf( name, sizeof( name ), "/proc/%d/io", (int)pid );
+  file = fopen( name, "r" );
+  if( file == NULL ) {
+
+    return -1;
+  }
+
+  r = -1;
+  w = -1;
+  while( fgets( line, sizeof( line ), file ) ) {
+
+    sscanf( line, "syscr: %"SCNd64, &r );
+    sscanf( line, "syscw: %"SCNd64, &w );
+  }
+  fclose( file );
+
+  if( r < 0 || w < 0 ) {
+
+    return -1;
+  }
+  return r + w;
+}
+
+/* choose an action like example_player does */
+static void chooseAction( const Game *game, const State *state,
+			  rng_state_t *rng, Action *action )
+{
+  int32_t min, max;
+  double p;
+
+  p = genrand_real2( rng );
+
+  action->size = 0;
+  action->type = a_fold;
+  if( p < 0.06 && isValidAction( game, state, 0, action ) ) {
+
+    return;
+  }
+
+  if( p >= 0.53 && raiseIsValid( game, state, &min, &max ) ) {
+
+    action->type = a_raise;
+    action->size = min + genrand_uniform( rng, max - min + 1 );
+    return;
+  }
+
+  action->type = a_call;
+}
+
+static void *randomBotThread( void *arg )
+{
+  RandomBot *bot = (RandomBot *)arg;
+  int len, r, acted;
+  uint64_t sent;
+  MatchState state;
+  Action action;
+  ReadBuf *readBuf;
+  rng_state_t rng;
+  char line[ MAX_LINE_LEN ];
+
+  init_genrand( &rng, bot->seed ^ ( 0x9e3779b9 * ( bot->seat + 1 ) ) );
+
+  readBuf = createReadBuf( bot->sock );
+  if( readBuf == NULL ) {
+
+    bot->failed = 1;
+    return NULL;
+  }
+
+  len = snprintf( line, MAX_LINE_LEN, "VERSION:%"PRIu32".%"PRIu32".%"PRIu32"\n",
+		  VERSION_MAJOR, VERSION_MINOR, VERSION_REVISION );
+  if( write( bot->sock, line, len ) != len ) {
+
+    fprintf( stderr, "ERROR: random bot in seat %d could not send version\n",
+	     bot->seat + 1 );
+    bot->failed = 1;
+    destroyReadBuf( readBuf );
+    return NULL;
+  }
+
+  acted = 0;
+  sent = 0;
+  while( getLine( readBuf, MAX_LINE_LEN, line, -1 ) > 0 ) {
+
+    if( acted ) {
+      /* first message after our action */
+
+      if( bot->numActions == bot->maxActions ) {
+
+	bot->maxActions = bot->maxActions ? bot->maxActions * 2 : 1024;
+	bot->latency = realloc( bot->latency,
+				bot->maxActions * sizeof( uint64_t ) );
+	if( bot->latency == NULL ) {
+
+	  fprintf( stderr, "ERROR: could not allocate latency samples\n" );
+	  exit( EXIT_FAILURE );
+	}
+      }
+      bot->latency[ bot->numActions ] = monotonicNanos() - sent;
+      ++bot->numActions;
+      acted = 0;
+    }
+
+    /* ignore comments */
+    if( line[ 0 ] == '#' || line[ 0 ] == ';' ) {
+      continue;
+    }
+
+    len = readMatchState( line, bot->game, &state );
+    if( len < 0 ) {
+
+      fprintf( stderr, "ERROR: could not read state %s", line );
+      bot->failed = 1;
+      break;
+    }
+
+    if( stateFinished( &state.state )
+	|| currentPlayer( bot->game, &state.state ) != state.viewingPlayer ) {
+      /* we're not acting */
+
+      continue;
+    }
+
+    chooseAction( bot->game, &state.state, &rng, &action );
+
+    /* add a colon (guaranteed to fit because we read a new-line) */
+    line[ len ] = ':';
+    ++len;
+    r = printAction( bot->game, &action, MAX_LINE_LEN - len - 2, &line[ len ] );
+    if( r < 0 ) {
+
+      fprintf( stderr, "ERROR: line too long after printing action\n" );
+      bot->failed = 1;
+      break;
+    }
+    len += r;
+    line[ len ] = '\r';
+    ++len;
+    line[ len ] = '\n';
+    ++len;
+
+    sent = monotonicNanos();
+    if( write( bot->sock, line, len ) != len ) {
+
+      fprintf( stderr, "ERROR: random bot in seat %d could not send action\n",
+	       bot->seat + 1 );
+      bot->failed = 1;
+      break;
+    }
+    acted = 1;
+  }
+
+  destroyReadBuf( readBuf );
+  return NULL;
+}
+
+/* start the dealer, with its standard out connected to *dealerOut
+   returns the dealer pid, or -1 on failure */
+static pid_t startDealer( const char *dealer, char *gameFile,
+			  char *handsString, char *seedString,
+			  const int numPlayers, const int counterDeals,
+			  const int verbose, FILE **dealerOut )
+{
+  int stdoutPipe[ 2 ], arg, p;
+  pid_t pid;
+  char *argv[ MAX_PLAYERS + 16 ];
+  char seatNames[ MAX_PLAYERS ][ 16 ];
+
+  if( pipe( stdoutPipe ) < 0 ) {
+
+    fprintf( stderr, "ERROR: could not create pipe for dealer\n" );
+    return -1;
+  }
+
+  pid = fork();
+  if( pid < 0 ) {
+
+    fprintf( stderr, "ERROR: fork() failed\n" );
+    return -1;
+  }
+  if( !pid ) {
+    /* child runs the dealer */
+
+    close( stdoutPipe[ 0 ] );
+    dup2( stdoutPipe[ 1 ], 1 );
+    if( !verbose ) {
+
+      p = open( "/dev/null", O_WRONLY );
+      dup2( p, 2 );
+    }
+
+    arg = 0;
+    argv[ arg++ ] = (char *)dealer;
+    argv[ arg++ ] = "bench_selfplay";
+    argv[ arg++ ] = gameFile;
+    argv[ arg++ ] = handsString;
+    argv[ arg++ ] = seedString;
+    for( p = 0; p < numPlayers; ++p ) {
+
+      snprintf( seatNames[ p ], sizeof( seatNames[ p ] ), "seat%d", p + 1 );
+      argv[ arg++ ] = seatNames[ p ];
+    }
+    argv[ arg++ ] = "-l";
+    argv[ arg++ ] = "-q";
+    if( counterDeals ) {
+
+      argv[ arg++ ] = "-c";
+    }
+    argv[ arg ] = NULL;
+
+    execv( dealer, argv );
+
+    fprintf( stderr, "ERROR: could not start dealer %s\n", dealer );
+    exit( EXIT_FAILURE );
+  }
+
+  close( stdoutPipe[ 1 ] );
+  *dealerOut = fdopen( stdoutPipe[ 0 ], "r" );
+  if( *dealerOut == NULL ) {
+
+    fprintf( stderr, "ERROR: could not read from dealer\n" );
+    return -1;
+  }
+
+  return pid;
+}
+
+/* returns pid of the bot, or -1 on failure */
+static pid_t startBot( const char *command, char *gameFile,
+		       const uint16_t port, const int verbose )
+{
+  pid_t pid;
+  int fd;
+  char portString[ 8 ];
+
+  pid = fork();
+  if( pid < 0 ) {
+
+    fprintf( stderr, "ERROR: fork() failed\n" );
+    return -1;
+  }
+  if( !pid ) {
+    /* child runs the bot command */
+
+    snprintf( portString, sizeof( portString ), "%"PRIu16, port );
+
+    if( !verbose ) {
+      /* throw away bot output */
+
+      fd = open( "/dev/null", O_WRONLY );
+      dup2( fd, 1 );
+      dup2( fd, 2 );
+    }
+
+    execl( command, command, gameFile, BENCH_HOST, portString, NULL );
+
+    fprintf( stderr, "ERROR: could not start bot %s\n", command );
+    exit( EXIT_FAILURE );
+  }
+
+  return pid;
+}
+
+int main( int argc, char **argv )
+{
+  int i, p, v, counterDeals, verbose, failed;
+  int64_t dealerSyscalls, selfSyscalls;
+  uint32_t numHands, seed;
+  uint64_t startNanos, endNanos, *latency;
+  size_t numActions;
+  double secs;
+  pid_t dealerPID, botPID[ MAX_PLAYERS ];
+  const char *dealer;
+  FILE *file, *dealerOut;
+  Game *game;
+  siginfo_t info;
+  struct rusage dealerUsage, botUsage, selfStart, selfEnd;
+  RandomBot randomBot[ MAX_PLAYERS ];
+  pthread_t thread[ MAX_PLAYERS ];
+  uint16_t port[ MAX_PLAYERS ];
+  char line[ MAX_LINE_LEN ];
+
+  dealer = DEFAULT_DEALER;
+  counterDeals = 0;
+  verbose = 0;
+
+  while( ( i = getopt( argc, argv, "d:cv" ) ) >= 0 ) {
+
+    switch( i ) {
+    case 'd':
+
+      dealer = optarg;
+      break;
+
+    case 'c':
+
+      counterDeals = 1;
+      break;
+
+    case 'v':
+
+      verbose = 1;
+      break;
+
+    default:
+
+      printUsage( stderr );
+      exit( EXIT_FAILURE );
+    }
+  }
+
+  if( optind + 3 > argc ) {
+
+    printUsage( stderr );
+    exit( EXIT_FAILURE );
+  }
+
+  /* get the game */
+  file = fopen( argv[ optind ], "r" );
+  if( file == NULL ) {
+
+    fprintf( stderr, "ERROR: could not open game %s\n", argv[ optind ] );
+    exit( EXIT_FAILURE );
+  }
+  game = readGame( file );
+  if( game == NULL ) {
+
+    fprintf( stderr, "ERROR: could not read game %s\n", argv[ optind ] );
+    exit( EXIT_FAILURE );
+  }
+  fclose( file );
+
+  if( optind + 3 + game->numPlayers != argc ) {
+
+    printUsage( stderr );
+    exit( EXIT_FAILURE );
+  }
+
+  if( sscanf( argv[ optind + 1 ], "%"SCNu32, &numHands ) < 1
+      || numHands == 0 ) {
+
+    fprintf( stderr, "ERROR: invalid number of hands %s\n",
+	     argv[ optind + 1 ] );
+    exit( EXIT_FAILURE );
+  }
+  if( sscanf( argv[ optind + 2 ], "%"SCNu32, &seed ) < 1 ) {
+
+    fprintf( stderr, "ERROR: invalid random number seed %s\n",
+	     argv[ optind + 2 ] );
+    exit( EXIT_FAILURE );
+  }
+
+  /* start the dealer and get the ports */
+  dealerPID = startDealer( dealer, argv[ optind ], argv[ optind + 1 ],
+			   argv[ optind + 2 ], game->numPlayers,
+			   counterDeals, verbose, &dealerOut );
+  if( dealerPID < 0 ) {
+
+    exit( EXIT_FAILURE );
+  }
+  if( fgets( line, MAX_LINE_LEN, dealerOut ) == NULL ) {
+
+    fprintf( stderr, "ERROR: could not read port string from dealer\n" );
+    exit( EXIT_FAILURE );
+  }
+  v = 0;
+  for( p = 0; p < game->numPlayers; ++p ) {
+
+    if( sscanf( &line[ v ], " %"SCNu16"%n", &port[ p ], &i ) < 1 ) {
+
+      fprintf( stderr, "ERROR: could not get port for player %d from dealer\n",
+	       p + 1 );
+      exit( EXIT_FAILURE );
+    }
+    v += i;
+  }
+
+  getrusage( RUSAGE_SELF, &selfStart );
+  selfSyscalls = readSyscalls( getpid() );
+  startNanos = monotonicNanos();
+
+  /* connect all the bots - the dealer accepts seats in order, but
+     connections are queued on the listening sockets until then */
+  for( p = 0; p < game->numPlayers; ++p ) {
+
+    botPID[ p ] = 0;
+    randomBot[ p ].sock = -1;
+    if( !strcmp( argv[ optind + 3 + p ], "random" ) ) {
+
+      randomBot[ p ].sock = connectTo( BENCH_HOST, port[ p ] );
+      if( randomBot[ p ].sock < 0 ) {
+
+	exit( EXIT_FAILURE );
+      }
+      v = 1;
+      setsockopt( randomBot[ p ].sock, IPPROTO_TCP, TCP_NODELAY,
+		  (char *)&v, sizeof( int ) );
+
+      randomBot[ p ].game = game;
+      randomBot[ p ].seat = p;
+      randomBot[ p ].seed = seed;
+      randomBot[ p ].latency = NULL;
+      randomBot[ p ].numActions = 0;
+      randomBot[ p ].maxActions = 0;
+      randomBot[ p ].failed = 0;
+      if( pthread_create( &thread[ p ], NULL,
+			  randomBotThread, &randomBot[ p ] ) ) {
+
+	fprintf( stderr, "ERROR: could not start random bot thread\n" );
+	exit( EXIT_FAILURE );
+      }
+    } else {
+
+      botPID[ p ] = startBot( argv[ optind + 3 + p ], argv[ optind ],
+			      port[ p ], verbose );
+      if( botPID[ p ] < 0 ) {
+
+	exit( EXIT_FAILURE );
+      }
+    }
+  }
+
+  /* wait for the dealer to finish, without reaping it yet so we can
+     still look at its system call counts */
+  failed = 0;
+  while( fgets( line, MAX_LINE_LEN, dealerOut ) ) {
+
+    if( verbose ) {
+
+      fprintf( stderr, "%s", line );
+    }
+  }
+  fclose( dealerOut );
+  if( waitid( P_PID, dealerPID, &info, WEXITED | WNOWAIT ) < 0 ) {
+
+    fprintf( stderr, "ERROR: could not wait for dealer\n" );
+    exit( EXIT_FAILURE );
+  }
+  endNanos = monotonicNanos();
+  dealerSyscalls = readSyscalls( dealerPID );
+  if( wait4( dealerPID, &v, 0, &dealerUsage ) < 0
+      || !WIFEXITED( v ) || WEXITSTATUS( v ) != EXIT_SUCCESS ) {
+
+    fprintf( stderr, "ERROR: dealer failed\n" );
+    failed = 1;
+  }
+
+  /* collect the bots */
+  memset( &botUsage, 0, sizeof( botUsage ) );
+  latency = NULL;
+  numActions = 0;
+  for( p = 0; p < game->numPlayers; ++p ) {
+
+    if( botPID[ p ] ) {
+      struct rusage usage;
+
+      wait4( botPID[ p ], &v, 0, &usage );
+      timeradd( &botUsage.ru_utime, &usage.ru_utime, &botUsage.ru_utime );
+      timeradd( &botUsage.ru_stime, &usage.ru_stime, &botUsage.ru_stime );
+    } else {
+
+      pthread_join( thread[ p ], NULL );
+      if( randomBot[ p ].failed ) {
+
+	failed = 1;
+      }
+
+      if( randomBot[ p ].numActions ) {
+
+	latency = realloc( latency, ( numActions + randomBot[ p ].numActions )
+			   * sizeof( uint64_t ) );
+	if( latency == NULL ) {
+
+	  fprintf( stderr, "ERROR: could not allocate latency samples\n" );
+	  exit( EXIT_FAILURE );
+	}
+	memcpy( &latency[ numActions ], randomBot[ p ].latency,
+		randomBot[ p ].numActions * sizeof( uint64_t ) );
+	numActions += randomBot[ p ].numActions;
+      }
+      free( randomBot[ p ].latency );
+    }
+  }
+  getrusage( RUSAGE_SELF, &selfEnd );
+  if( selfSyscalls >= 0 ) {
+
+    selfSyscalls = readSyscalls( getpid() ) - selfSyscalls;
+  }
+
+  if( failed ) {
+
+    exit( EXIT_FAILURE );
+  }
+
+  /* report */
+  secs = ( endNanos - startNanos ) / 1e9;
+  printf( "game %s, %"PRIu32" hands, seed %"PRIu32"\n",
+	  argv[ optind ], numHands, seed );
+  printf( "throughput: %.3f seconds, %.1f hands/sec\n",
+	  secs, numHands / secs );
+
+  if( numActions ) {
+
+    qsort( latency, numActions, sizeof( uint64_t ), compareUint64 );
+    printf( "action latency: %zu actions, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+	    numActions,
+	    latency[ numActions / 2 ] / 1e3,
+	    latency[ numActions * 99 / 100 ] / 1e3,
+	    latency[ numActions - 1 ] / 1e3 );
+  }
+  free( latency );
+
+  printf( "dealer: %.2f us user, %.2f us sys CPU per hand",
+	  timevalSecs( &dealerUsage.ru_utime ) * 1e6 / numHands,
+	  timevalSecs( &dealerUsage.ru_stime ) * 1e6 / numHands );
+  if( dealerSyscalls >= 0 ) {
+
+    printf( ", %.2f read/write syscalls per hand",
+	    (double)dealerSyscalls / numHands );
+  }
+  printf( ", %.2f context switches per hand\n",
+	  (double)( dealerUsage.ru_nvcsw + dealerUsage.ru_nivcsw ) / numHands );
+
+  if( numActions ) {
+
+    timersub( &selfEnd.ru_utime, &selfStart.ru_utime, &selfEnd.ru_utime );
+    timersub( &selfEnd.ru_stime, &selfStart.ru_stime, &selfEnd.ru_stime );
+    printf( "random bots: %.2f us user, %.2f us sys CPU per hand",
+	    timevalSecs( &selfEnd.ru_utime ) * 1e6 / numHands,
+	    timevalSecs( &selfEnd.ru_stime ) * 1e6 / numHands );
+    if( selfSyscalls >= 0 ) {
+
+      printf( ", %.2f read/write syscalls per hand",
+	      (double)selfSyscalls / numHands );
+    }
+    printf( "\n" );
+  }
+  if( timerisset( &botUsage.ru_utime ) || timerisset( &botUsage.ru_stime ) ) {
+
+    printf( "external bots: %.2f us user, %.2f us sys CPU per hand\n",
+	    timevalSecs( &botUsage.ru_utime ) * 1e6 / numHands,
+	    timevalSecs( &botUsage.ru_stime ) * 1e6 / numHands );
+  }
+
+  free( game );
+  return EXIT_SUCCESS;
+}
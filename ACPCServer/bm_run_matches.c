@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #define __STDC_FORMAT_MACROS
@@ -5,19 +6,54 @@
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include "game.h"
 #include "net.h"
+#include "rng.h"
 
 #define ARG_SERVERNAME 1
 #define ARG_SERVERPORT 2
 #define ARG_BOT_COMMAND 7
 #define ARG_MIN_ARGS 6
 
+/* arguments for running shards of a match on local dealers */
+#define ARG_LOCAL_GAME 2
+#define ARG_LOCAL_HANDS 3
+#define ARG_LOCAL_SHARDS 4
+#define ARG_LOCAL_WORKERS 5
+#define ARG_LOCAL_TAG 6
+#define ARG_LOCAL_SEED 7
+#define ARG_LOCAL_PLAYERS 8
+
+#define LOCAL_DEALER "./dealer"
+#define LOCAL_HOST "localhost"
+#define LOCAL_START_TIMEOUT_MILLIS "60000"
+
+#define SHARD_PENDING 0
+#define SHARD_RUNNING 1
+#define SHARD_FINISHED 2
+#define SHARD_FAILED 3
+
+typedef struct {
+  int status;
+  uint32_t numHands;
+  uint32_t firstHand; /* number of the shard's first hand in the match */
+  uint32_t seed;
+  int worker; /* worker slot the shard is running in */
+  pid_t dealerPID;
+  pid_t botPID[ MAX_PLAYERS ];
+  int numRunning; /* dealer and bot processes which haven't exited */
+  FILE *dealerOut;
+  double value[ MAX_PLAYERS ]; /* from the dealer's SCORE line */
+} Shard;
+
 static void printUsage( FILE *file )
 {
   fprintf( file, "Sample usages:\n" );
@@ -40,6 +76,9 @@ static void printUsage( FILE *file )
 	   "rerun 2pl <local script> <match index> <tag> <seed> <player1> "
 	   "<player2> (<player3>)\n" );
   fprintf( file, "    Rerun a match that failed\n" );
+  fprintf( file, "  bm_run_matches local <game> <# hands> <# shards> <# workers> "
+	   "<tag> <seed> <player1> <script1> <player2> <script2> ...\n" );
+  fprintf( file, "    Split a match into shards and run them on local dealers\n" );
   fprintf( file, "\n" );
   fprintf( file, "<username> is your benchmark server username assigned to "
 	   "you by the competition chair\n" );
@@ -64,6 +103,482 @@ static void printUsage( FILE *file )
 	   "For example, if you tried to run twenty matches with seed 0 and "
 	   "the last match failed, you could use the \"rerun\" command with "
 	   "seed 0 and match index 19.\n" );
+  fprintf( file, "\n" );
+  fprintf( file, "The \"local\" command does not use a benchmark server.  "
+	   "The <# hands> hands are split into <# shards> matches with "
+	   "their own seeds, which are played by up to <# workers> "
+	   "dealers at a time, each pinned to its own CPU.  Each "
+	   "<script> is run with a hostname and port.  Shard logs are "
+	   "merged into <tag>.log as they finish, and the running totals "
+	   "are printed.  Dealer errors are written to <tag>.stderr\n" );
+}
+
+/* read the ports line from a dealer and start the bots
+   returns 0 on success, -1 on failure */
+static int startShardBots( char **argv, const int numPlayers,
+			   Shard *shard, const cpu_set_t *cpus )
+{
+  int p, pos, t, fd;
+  uint16_t port;
+  char line[ READBUF_LEN ], portString[ 8 ];
+
+  if( fgets( line, READBUF_LEN, shard->dealerOut ) == NULL ) {
+
+    fprintf( stderr, "ERROR: could not read port string from dealer\n" );
+    return -1;
+  }
+
+  pos = 0;
+  for( p = 0; p < numPlayers; ++p ) {
+
+    if( sscanf( &line[ pos ], " %"SCNu16"%n", &port, &t ) < 1 ) {
+
+      fprintf( stderr, "ERROR: could not get port for player %d from dealer\n",
+	       p + 1 );
+      return -1;
+    }
+    pos += t;
+
+    shard->botPID[ p ] = fork();
+    if( shard->botPID[ p ] < 0 ) {
+
+      fprintf( stderr, "ERROR: fork() failed\n" );
+      exit( EXIT_FAILURE );
+    }
+    if( shard->botPID[ p ] == 0 ) {
+      /* child runs `script machine port` on the shard's CPU */
+
+      sched_setaffinity( 0, sizeof( cpu_set_t ), cpus );
+      snprintf( portString, sizeof( portString ), "%"PRIu16, port );
+
+      /* throw away bot output */
+      fd = open( "/dev/null", O_WRONLY );
+      dup2( fd, 1 );
+
+      execl( argv[ ARG_LOCAL_PLAYERS + 2 * p + 1 ],
+	     argv[ ARG_LOCAL_PLAYERS + 2 * p + 1 ],
+	     LOCAL_HOST,
+	     portString,
+	     NULL );
+      fprintf( stderr,
+	       "ERROR: could not run %s\n",
+	       argv[ ARG_LOCAL_PLAYERS + 2 * p + 1 ] );
+      exit( EXIT_FAILURE );
+    }
+    ++shard->numRunning;
+  }
+
+  return 0;
+}
+
+/* start a dealer and bots for a shard, pinned to cpus
+   returns 0 on success, -1 on failure */
+static int startShard( char **argv, const int numPlayers,
+		       const int index, Shard *shard, const cpu_set_t *cpus )
+{
+  int stdoutPipe[ 2 ], arg, p;
+  char matchName[ READBUF_LEN ], handsString[ 16 ], seedString[ 16 ];
+  char *dealerArgv[ MAX_PLAYERS + 16 ];
+
+  shard->numRunning = 0;
+  for( p = 0; p < numPlayers; ++p ) {
+
+    shard->botPID[ p ] = 0;
+  }
+
+  if( pipe( stdoutPipe ) < 0 ) {
+
+    fprintf( stderr, "ERROR: could not create pipe for dealer\n" );
+    return -1;
+  }
+
+  shard->dealerPID = fork();
+  if( shard->dealerPID < 0 ) {
+
+    fprintf( stderr, "ERROR: fork() failed\n" );
+    exit( EXIT_FAILURE );
+  }
+  if( shard->dealerPID == 0 ) {
+    /* child runs the dealer on the shard's CPU */
+
+    sched_setaffinity( 0, sizeof( cpu_set_t ), cpus );
+    close( stdoutPipe[ 0 ] );
+    dup2( stdoutPipe[ 1 ], 1 );
+
+    /* all the dealers share an error log */
+    snprintf( matchName, sizeof( matchName ), "%s.stderr",
+	      argv[ ARG_LOCAL_TAG ] );
+    p = open( matchName, O_WRONLY | O_APPEND | O_CREAT, 0644 );
+    if( p >= 0 ) {
+
+      dup2( p, 2 );
+    }
+
+    snprintf( matchName, sizeof( matchName ), "%s.shard%d",
+	      argv[ ARG_LOCAL_TAG ], index );
+    snprintf( handsString, sizeof( handsString ), "%"PRIu32, shard->numHands );
+    snprintf( seedString, sizeof( seedString ), "%"PRIu32, shard->seed );
+
+    arg = 0;
+    dealerArgv[ arg++ ] = LOCAL_DEALER;
+    dealerArgv[ arg++ ] = matchName;
+    dealerArgv[ arg++ ] = argv[ ARG_LOCAL_GAME ];
+    dealerArgv[ arg++ ] = handsString;
+    dealerArgv[ arg++ ] = seedString;
+    for( p = 0; p < numPlayers; ++p ) {
+
+      dealerArgv[ arg++ ] = argv[ ARG_LOCAL_PLAYERS + 2 * p ];
+    }
+    dealerArgv[ arg++ ] = "--start_timeout";
+    dealerArgv[ arg++ ] = LOCAL_START_TIMEOUT_MILLIS;
+    dealerArgv[ arg++ ] = "-q";
+    dealerArgv[ arg ] = NULL;
+
+    execv( LOCAL_DEALER, dealerArgv );
+    fprintf( stderr, "ERROR: could not start dealer %s\n", LOCAL_DEALER );
+    exit( EXIT_FAILURE );
+  }
+  ++shard->numRunning;
+
+  close( stdoutPipe[ 1 ] );
+  shard->dealerOut = fdopen( stdoutPipe[ 0 ], "r" );
+  if( shard->dealerOut == NULL ) {
+
+    fprintf( stderr, "ERROR: could not read from dealer\n" );
+    return -1;
+  }
+
+  return startShardBots( argv, numPlayers, shard, cpus );
+}
+
+/* read the values from a SCORE:v1|v2...:name1|name2... line
+   returns 0 on success, -1 on failure */
+static int readScore( const char *line, const int numPlayers,
+		      double value[ MAX_PLAYERS ] )
+{
+  int p, pos, t;
+
+  if( strncmp( line, "SCORE", 5 ) ) {
+
+    return -1;
+  }
+
+  pos = 5;
+  for( p = 0; p < numPlayers; ++p ) {
+
+    if( line[ pos ] != ( p ? '|' : ':' ) ) {
+
+      return -1;
+    }
+    ++pos;
+    if( sscanf( &line[ pos ], "%lf%n", &value[ p ], &t ) < 1 ) {
+
+      return -1;
+    }
+    pos += t;
+  }
+
+  return 0;
+}
+
+/* print values as SCORE:v1|v2...:name1|name2... without trailing zeros,
+   in the same way as the dealer */
+static void printScore( FILE *file, char **argv, const int numPlayers,
+			const double value[ MAX_PLAYERS ] )
+{
+  int p, c;
+  char number[ 64 ];
+
+  fprintf( file, "SCORE" );
+  for( p = 0; p < numPlayers; ++p ) {
+
+    c = snprintf( number, sizeof( number ), "%.6f", value[ p ] );
+    while( number[ c - 1 ] == '0' ) { --c; }
+    if( number[ c - 1 ] == '.' ) { --c; }
+    number[ c ] = 0;
+    fprintf( file, p ? "|%s" : ":%s", number );
+  }
+  for( p = 0; p < numPlayers; ++p ) {
+
+    fprintf( file, p ? "|%s" : ":%s", argv[ ARG_LOCAL_PLAYERS + 2 * p ] );
+  }
+  fprintf( file, "\n" );
+}
+
+/* append a shard's log to the merged log and remove it.  Hands are
+   renumbered to follow the hands of the shards before it, and the
+   shard's SCORE line is kept as a comment, so the merged log has a
+   single SCORE line for the whole match at the end */
+static void mergeShardLog( const char *tag, const int index,
+			   const Shard *shard, FILE *merged )
+{
+  FILE *file;
+  char name[ READBUF_LEN ], line[ READBUF_LEN ];
+  char *end;
+  unsigned long handId;
+
+  fprintf( merged, "# shard %d: %"PRIu32" hands, seed %"PRIu32"%s\n",
+	   index, shard->numHands, shard->seed,
+	   shard->status == SHARD_FAILED ? " FAILED" : "" );
+
+  snprintf( name, sizeof( name ), "%s.shard%d.log", tag, index );
+  file = fopen( name, "r" );
+  if( file == NULL ) {
+
+    fprintf( stderr, "ERROR: could not open shard log %s\n", name );
+    return;
+  }
+  while( fgets( line, READBUF_LEN, file ) ) {
+
+    if( !strncmp( line, "STATE:", 6 ) ) {
+
+      handId = strtoul( &line[ 6 ], &end, 10 );
+      if( end != &line[ 6 ] && *end == ':' ) {
+
+	fprintf( merged, "STATE:%lu%s", handId + shard->firstHand, end );
+	continue;
+      }
+    }
+    if( !strncmp( line, "SCORE", 5 ) ) {
+
+      fprintf( merged, "# " );
+    }
+    fputs( line, merged );
+  }
+  fclose( file );
+  fflush( merged );
+
+  if( shard->status == SHARD_FINISHED ) {
+
+    unlink( name );
+  }
+}
+
+/* run the match as shards on local dealers
+   returns EXIT_SUCCESS if every shard finished, EXIT_FAILURE otherwise */
+static int runLocalMatches( int argc, char **argv )
+{
+  int numPlayers, numShards, numWorkers, numCPUs, numFailed;
+  int i, p, w, status, nextStart, nextMerge;
+  uint32_t numHands, seed;
+  uint64_t handsMerged;
+  pid_t pid;
+  Shard *shards, *shard;
+  int *workerShard;
+  cpu_set_t allowed, *workerCPUs;
+  crng_state_t crng;
+  double total[ MAX_PLAYERS ];
+  FILE *merged;
+  char line[ READBUF_LEN ];
+
+  numPlayers = ( argc - ARG_LOCAL_PLAYERS ) / 2;
+  if( argc < ARG_LOCAL_PLAYERS + 4
+      || ( argc - ARG_LOCAL_PLAYERS ) % 2
+      || numPlayers > MAX_PLAYERS ) {
+
+    printUsage( stderr );
+    return EXIT_FAILURE;
+  }
+  if( sscanf( argv[ ARG_LOCAL_HANDS ], "%"SCNu32, &numHands ) < 1
+      || sscanf( argv[ ARG_LOCAL_SHARDS ], "%d", &numShards ) < 1
+      || sscanf( argv[ ARG_LOCAL_WORKERS ], "%d", &numWorkers ) < 1
+      || sscanf( argv[ ARG_LOCAL_SEED ], "%"SCNu32, &seed ) < 1
+      || numShards < 1 || numWorkers < 1
+      || numHands < (uint32_t)numShards ) {
+
+    fprintf( stderr, "ERROR: invalid number of hands, shards, workers, "
+	     "or seed\n" );
+    return EXIT_FAILURE;
+  }
+  if( numWorkers > numShards ) {
+
+    numWorkers = numShards;
+  }
+
+  /* split the hands, and give each shard its own stream of seeds */
+  shards = (Shard *)calloc( numShards, sizeof( Shard ) );
+  assert( shards != 0 );
+  for( i = 0; i < numShards; ++i ) {
+
+    shards[ i ].status = SHARD_PENDING;
+    shards[ i ].numHands = numHands / numShards
+      + ( (uint32_t)i < numHands % numShards ? 1 : 0 );
+    shards[ i ].firstHand
+      = i ? shards[ i - 1 ].firstHand + shards[ i - 1 ].numHands : 0;
+    init_crng( &crng, seed, i );
+    shards[ i ].seed = crng_int32( &crng );
+  }
+
+  /* worker w is pinned to the w'th CPU we are allowed to run on */
+  workerShard = (int *)malloc( sizeof( int ) * numWorkers );
+  workerCPUs = (cpu_set_t *)malloc( sizeof( cpu_set_t ) * numWorkers );
+  assert( workerShard != 0 && workerCPUs != 0 );
+  if( sched_getaffinity( 0, sizeof( allowed ), &allowed ) < 0 ) {
+
+    CPU_ZERO( &allowed );
+    CPU_SET( 0, &allowed );
+  }
+  numCPUs = CPU_COUNT( &allowed );
+  for( w = 0; w < numWorkers; ++w ) {
+
+    workerShard[ w ] = -1;
+    CPU_ZERO( &workerCPUs[ w ] );
+    for( i = 0, p = 0; i < CPU_SETSIZE; ++i ) {
+
+      if( CPU_ISSET( i, &allowed ) && p++ == w % numCPUs ) {
+
+	CPU_SET( i, &workerCPUs[ w ] );
+	break;
+      }
+    }
+  }
+
+  snprintf( line, sizeof( line ), "%s.log", argv[ ARG_LOCAL_TAG ] );
+  merged = fopen( line, "w" );
+  if( merged == NULL ) {
+
+    fprintf( stderr, "ERROR: could not open merged log %s\n", line );
+    return EXIT_FAILURE;
+  }
+
+  for( p = 0; p < numPlayers; ++p ) {
+
+    total[ p ] = 0.0;
+  }
+  handsMerged = 0;
+  numFailed = 0;
+  nextStart = 0;
+  nextMerge = 0;
+  while( 1 ) {
+
+    /* fill any free workers */
+    for( w = 0; w < numWorkers && nextStart < numShards; ++w ) {
+
+      if( workerShard[ w ] >= 0 ) {
+	continue;
+      }
+
+      shard = &shards[ nextStart ];
+      shard->worker = w;
+      shard->status = SHARD_RUNNING;
+      workerShard[ w ] = nextStart;
+      if( startShard( argv, numPlayers, nextStart, shard,
+		      &workerCPUs[ w ] ) < 0 ) {
+
+	fprintf( stderr, "ERROR: could not start shard %d\n", nextStart );
+	shard->status = SHARD_FAILED;
+	if( shard->numRunning == 0 ) {
+
+	  workerShard[ w ] = -1;
+	}
+      }
+      ++nextStart;
+    }
+
+    /* merge finished shards in order, so the merged log is the same
+       however the shards were scheduled */
+    while( nextMerge < nextStart
+	   && ( shards[ nextMerge ].status == SHARD_FINISHED
+		|| ( shards[ nextMerge ].status == SHARD_FAILED
+		     && shards[ nextMerge ].numRunning == 0 ) ) ) {
+      shard = &shards[ nextMerge ];
+
+      mergeShardLog( argv[ ARG_LOCAL_TAG ], nextMerge, shard, merged );
+      if( shard->status == SHARD_FINISHED ) {
+
+	for( p = 0; p < numPlayers; ++p ) {
+
+	  total[ p ] += shard->value[ p ];
+	}
+	handsMerged += shard->numHands;
+      } else {
+
+	++numFailed;
+      }
+      ++nextMerge;
+
+      printf( "%d/%d shards, %"PRIu64" hands: ",
+	      nextMerge, numShards, handsMerged );
+      printScore( stdout, argv, numPlayers, total );
+      fflush( stdout );
+    }
+    if( nextMerge == numShards ) {
+      break;
+    }
+
+    /* wait for a dealer or bot to exit */
+    pid = wait( &status );
+    if( pid < 0 ) {
+
+      if( errno == EINTR ) {
+	continue;
+      }
+      fprintf( stderr, "ERROR: lost track of running shards\n" );
+      return EXIT_FAILURE;
+    }
+    for( i = nextMerge; i < nextStart; ++i ) {
+
+      if( shards[ i ].dealerPID == pid ) {
+	break;
+      }
+      for( p = 0; p < numPlayers; ++p ) {
+
+	if( shards[ i ].botPID[ p ] == pid ) {
+	  break;
+	}
+      }
+      if( p < numPlayers ) {
+	break;
+      }
+    }
+    if( i == nextStart ) {
+      continue;
+    }
+    shard = &shards[ i ];
+    --shard->numRunning;
+
+    if( shard->dealerPID == pid ) {
+      /* the last line of dealer output is the score */
+
+      int haveScore = 0;
+      while( fgets( line, READBUF_LEN, shard->dealerOut ) ) {
+
+	if( readScore( line, numPlayers, shard->value ) == 0 ) {
+
+	  haveScore = 1;
+	}
+      }
+      fclose( shard->dealerOut );
+      if( !haveScore || !WIFEXITED( status )
+	  || WEXITSTATUS( status ) != EXIT_SUCCESS ) {
+
+	shard->status = SHARD_FAILED;
+      }
+    }
+    if( shard->numRunning ) {
+      continue;
+    }
+
+    /* shard is done - free its worker */
+    workerShard[ shard->worker ] = -1;
+    if( shard->status == SHARD_RUNNING ) {
+
+      shard->status = SHARD_FINISHED;
+    }
+    printf( "shard %d %s\n", i,
+	    shard->status == SHARD_FINISHED ? "finished" : "FAILED" );
+  }
+
+  printScore( merged, argv, numPlayers, total );
+  fclose( merged );
+
+  if( numFailed ) {
+
+    fprintf( stderr, "ERROR: %d shards failed, their logs were kept\n",
+	     numFailed );
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
 }
 
 int main( int argc, char **argv )
@@ -75,6 +590,11 @@ int main( int argc, char **argv )
   fd_set readfds;
   char line[ READBUF_LEN ];
 
+  if( argc > 1 && !strcmp( argv[ 1 ], "local" ) ) {
+
+    return runLocalMatches( argc, argv );
+  }
+
   if( argc < ARG_MIN_ARGS ) {
 
     printUsage( stderr );
@@ -221,7 +741,7 @@ int main( int argc, char **argv )
 	} else {
 	  /* just a message, print it out */
 
-	  if( fwrite( line, 1, i, stdout ) < 0 ) {
+	  if( fwrite( line, 1, i, stdout ) < (size_t)i ) {
 
 	    fprintf( stderr, "ERROR: failed while printing server message\n" );
 	    exit( EXIT_FAILURE );
@@ -36,24 +36,85 @@ Copyright (C) 2011 by the Computer Poker Research Group, University of Alberta
 #define BM_DEALER_WAIT_SECS 5
 #define BM_MAX_IOWAIT_SECS 1
 
+/* pooled bots read RUN and QUIT commands from BM_POOL_CMD_FD and write
+   READY replies to BM_POOL_REPLY_FD */
+#define BM_POOL_CMD_FD 3
+#define BM_POOL_REPLY_FD 4
+#define BM_POOL_RESTART_SECS 5
+/* time a pooled bot has to say READY, after starting or after the dealer
+   of its match has exited, when startupTimeoutSecs is not limited */
+#define BM_POOL_READY_SECS 60
 
+#define POOL_DEAD 0
+#define POOL_STARTING 1
+#define POOL_IDLE 2
+#define POOL_BUSY 3
+
+
+/* entries are allocated from chunks of LLPOOL_CHUNK_ENTRIES, and each
+   entry is padded out to a multiple of LLPOOL_ALIGN bytes */
+#define LLPOOL_CHUNK_ENTRIES 64
+#define LLPOOL_ALIGN 64
+
+
+/* entries never move once allocated, so pointers to them stay valid
+   until the entry is removed */
 typedef struct LLPoolEntry_struct {
-  struct LLPoolEntry_struct *next;
-  struct LLPoolEntry_struct *prev;
+  struct LLPool_struct *pool;
+  int slot; /* index of the entry within the pool's chunks */
+  int densePos; /* position in pool->dense, or -1 if the entry is free */
   char data[ 0 ];
 } LLPoolEntry;
 
-typedef struct {
-  LLPoolEntry *head;
-  LLPoolEntry *free;
+typedef struct LLPool_struct {
+  char **chunks;
+  int numChunks;
+  int entrySize;
   int dataSize;
+
+  /* entries in use, packed at the start of the array */
+  LLPoolEntry **dense;
   int numEntries;
+
+  /* stack of free slots */
+  int *freeSlots;
+  int numFree;
 } LLPool;
 
+/* binary heap of pointers which also keeps track of where each item is,
+   so items can be removed or re-positioned in O(log n) */
+typedef struct {
+  void **items;
+  int numItems;
+  int maxItems;
+
+  /* returns non-zero if item a should come out of the heap before b */
+  int (*before)( const void *a, const void *b );
+
+  /* returns a pointer to the position of an item in the heap,
+     which is -1 while the item is not in the heap */
+  int *(*position)( void *item );
+} Heap;
+
+/* a pre-started bot which is handed matches through a control pipe */
+typedef struct {
+  int status;
+  pid_t pid;
+  int cmdFd; /* RUN and QUIT commands are written here */
+  ReadBuf *replyBuf; /* READY replies are read from here */
+  struct timeval startTime; /* last time the bot process was started */
+  time_t readyDeadline; /* bot is killed if not READY by now, 0 if unset */
+  LLPoolEntry *jobEntry; /* job the bot is playing while POOL_BUSY */
+  int seat; /* seat of the bot in that job */
+} PooledBot;
+
 /* structure giving the specification for a local bot */
 typedef struct {
   char *name;
   char *command;
+  int threads; /* number of cores the bot uses while running */
+  int poolSize; /* number of bots kept started and waiting for matches */
+  PooledBot *pool;
 } BotSpec;
 
 /* structure giving the specification for a user */
@@ -61,6 +122,12 @@ typedef struct {
   char *name;
   char *passwd;
   struct timeval waitStart;
+  double shareWeight; /* relative share of the cores the user is entitled to */
+  int maxPriority; /* largest priority the user may give a match */
+
+  int runningCores; /* cores used by the user's running jobs */
+  Heap queue; /* the user's runnable matches, in the order they will run */
+  int heapPos; /* position in the server's user queue, -1 if not queued */
 } UserSpec;
 
 typedef struct {
@@ -79,6 +146,8 @@ typedef struct {
   uint16_t port;
   uint16_t maxRunningBots; /* maximum simultaneous bots at a time
 			      0 disables the check */
+  uint16_t maxCores; /* maximum number of cores used by running bots
+			0 disables the check */
   uint16_t startupTimeoutSecs; /* maximum time to wait for clients to connect
 				  0 disables the timer */
   uint16_t responseTimeoutSecs; /* maximum time to wait for clients to respond 
@@ -111,11 +180,16 @@ typedef struct {
     LLPoolEntry *entry; /* connection if network player, bot otherwise */
   } players[ MAX_PLAYERS ];
   int isRunning;
+  int priority; /* larger priorities are run first */
+  int numBots; /* number of local bots the match starts */
+  int numCores; /* number of cores used by the local bots */
+  int heapPos; /* position in the user's queue, -1 if not queued */
 } Match;
 
 typedef struct {
   pid_t dealerPID;
   pid_t botPID[ MAX_PLAYERS ];
+  PooledBot *pooledBot[ MAX_PLAYERS ]; /* non-NULL until pooled bot is READY */
   LLPoolEntry *matchEntry;
   char *tag; /* based on tag from the match for this job */
   uint16_t ports[ MAX_PLAYERS ];
@@ -127,6 +201,11 @@ typedef struct {
   LLPool *matches;
   LLPool *jobs;
 
+  /* users with runnable matches, in the order they will be served */
+  Heap userQueue;
+  int runningBots;
+  int runningCores;
+
   rng_state_t rng;
 
   char *hostname;
@@ -141,28 +220,69 @@ LLPool *newLLPool( const int dataSize )
 
   pool = (LLPool*)malloc( sizeof( LLPool ) );
   assert( pool != 0 );
-  pool->head = NULL;
-  pool->free = NULL;
+  pool->chunks = NULL;
+  pool->numChunks = 0;
+  pool->entrySize = ( sizeof( LLPoolEntry ) + dataSize + LLPOOL_ALIGN - 1 )
+    / LLPOOL_ALIGN * LLPOOL_ALIGN;
   pool->dataSize = dataSize;
+  pool->dense = NULL;
   pool->numEntries = 0;
+  pool->freeSlots = NULL;
+  pool->numFree = 0;
   return pool;
 }
 
-int entryInList( LLPoolEntry *list, LLPoolEntry *entry )
+/* get the entry in a slot */
+LLPoolEntry *LLPoolSlotEntry( const LLPool *pool, const int slot )
 {
-  while( list ) {
+  return (LLPoolEntry *)( pool->chunks[ slot / LLPOOL_CHUNK_ENTRIES ]
+			  + ( slot % LLPOOL_CHUNK_ENTRIES ) * pool->entrySize );
+}
 
-    if( entry == list ) {
+/* returns non-zero if entry is currently in use in pool */
+int LLPoolHasEntry( const LLPool *pool, const LLPoolEntry *entry )
+{
+  return entry->pool == pool
+    && entry->densePos >= 0
+    && entry->densePos < pool->numEntries
+    && pool->dense[ entry->densePos ] == entry;
+}
 
-      return 1;
-    }
-    if( list->next ) {
+/* add another chunk of free entries to the pool */
+void LLPoolGrow( LLPool *pool )
+{
+  int i, slot, capacity;
+  LLPoolEntry *entry;
 
-      assert( list->next->prev == list );
-    }
-    list = list->next;
+  pool->chunks = (char **)realloc( pool->chunks,
+				   sizeof( char * ) * ( pool->numChunks + 1 ) );
+  assert( pool->chunks != 0 );
+  if( posix_memalign( (void **)&pool->chunks[ pool->numChunks ],
+		      LLPOOL_ALIGN,
+		      (size_t)pool->entrySize * LLPOOL_CHUNK_ENTRIES ) ) {
+
+    fprintf( stderr, "BM_ERROR: could not allocate pool chunk\n" );
+    exit( EXIT_FAILURE );
+  }
+  ++pool->numChunks;
+
+  capacity = pool->numChunks * LLPOOL_CHUNK_ENTRIES;
+  pool->dense = (LLPoolEntry **)realloc( pool->dense,
+					 sizeof( LLPoolEntry * ) * capacity );
+  pool->freeSlots = (int *)realloc( pool->freeSlots, sizeof( int ) * capacity );
+  assert( pool->dense != 0 && pool->freeSlots != 0 );
+
+  /* push the new slots so the lowest slot is used first */
+  for( i = LLPOOL_CHUNK_ENTRIES - 1; i >= 0; --i ) {
+
+    slot = ( pool->numChunks - 1 ) * LLPOOL_CHUNK_ENTRIES + i;
+    entry = LLPoolSlotEntry( pool, slot );
+    entry->pool = pool;
+    entry->slot = slot;
+    entry->densePos = -1;
+    pool->freeSlots[ pool->numFree ] = slot;
+    ++pool->numFree;
   }
-  return 0;
 }
 
 /* add an object to the pool.  data must have a size of pool->dataSize */
@@ -170,83 +290,231 @@ LLPoolEntry *LLPoolAddItem( LLPool *pool, void *item )
 {
   LLPoolEntry *entry;
 
-  if( pool->free ) {
+  if( pool->numFree == 0 ) {
 
-    entry = pool->free;
-    pool->free = entry->next;
-  } else {
-
-    entry = (LLPoolEntry*)malloc( sizeof( LLPoolEntry ) + pool->dataSize );
-    assert( entry != 0 );
+    LLPoolGrow( pool );
   }
+  --pool->numFree;
+  entry = LLPoolSlotEntry( pool, pool->freeSlots[ pool->numFree ] );
 
-assert( !entryInList( pool->head, entry ) );
-  entry->next = pool->head;
-  entry->prev = NULL;
+  assert( !LLPoolHasEntry( pool, entry ) );
   memcpy( entry->data, item, pool->dataSize );
-  if( pool->head ) {
-
-    pool->head->prev = entry;
-  }
-  pool->head = entry;
-
+  entry->densePos = pool->numEntries;
+  pool->dense[ pool->numEntries ] = entry;
   ++pool->numEntries;
 
   return entry;
 }
 
 /* remove an item from the pool, placing it in the free list.
-   entry must have been generated by LLPoolAddItem( pool, ... )
-   (that is, calling LLPoolRemoveEntry on an entry from another pool
-   is potentially a very bad idea...) */
+   entry must have been generated by LLPoolAddItem( pool, ... ) */
 void LLPoolRemoveEntry( LLPool *pool, LLPoolEntry *entry )
 {
-  if( entry->prev ) {
+  LLPoolEntry *last;
 
-assert( entry->prev->next == entry );
-    entry->prev->next = entry->next;
-  } else {
+  assert( LLPoolHasEntry( pool, entry ) );
+
+  /* move the last entry into the hole */
+  --pool->numEntries;
+  last = pool->dense[ pool->numEntries ];
+  pool->dense[ entry->densePos ] = last;
+  last->densePos = entry->densePos;
+
+  entry->densePos = -1;
+  pool->freeSlots[ pool->numFree ] = entry->slot;
+  ++pool->numFree;
+}
+
+/* LLPool iterator start.  Entries are visited from the end of the dense
+   array to the start, so the newest entries come first */
+LLPoolEntry *LLPoolFirstEntry( LLPool *pool )
+{
+  return pool->numEntries ? pool->dense[ pool->numEntries - 1 ] : NULL;
+}
+
+/* cur can be removed once the next entry has been fetched, because
+   removing an entry only moves the last entry, which has already been
+   visited.  Removing any other entry while iterating is not safe */
+LLPoolEntry *LLPoolNextEntry( LLPoolEntry *cur )
+{
+  if( cur && cur->densePos > 0 ) {
+
+    return cur->pool->dense[ cur->densePos - 1 ];
+  }
+  return NULL;
+}
+
+void *LLPoolGetItem( LLPoolEntry *entry )
+{
+  return &entry->data;
+}
+
+
+void initHeap( Heap *heap,
+	       int (*before)( const void *a, const void *b ),
+	       int *(*position)( void *item ) )
+{
+  heap->maxItems = 16;
+  heap->items = (void **)malloc( sizeof( void * ) * heap->maxItems );
+  assert( heap->items != 0 );
+  heap->numItems = 0;
+  heap->before = before;
+  heap->position = position;
+}
+
+/* put item at index i, updating its position */
+void heapSet( Heap *heap, const int i, void *item )
+{
+  heap->items[ i ] = item;
+  *heap->position( item ) = i;
+}
+
+/* move the item at index i towards the top of the heap */
+void heapSiftUp( Heap *heap, int i )
+{
+  int parent;
+  void *item = heap->items[ i ];
 
-assert( pool->head == entry );
-    pool->head = entry->next;
+  while( i > 0 ) {
+
+    parent = ( i - 1 ) / 2;
+    if( !heap->before( item, heap->items[ parent ] ) ) {
+      break;
+    }
+    heapSet( heap, i, heap->items[ parent ] );
+    i = parent;
   }
-  if( entry->next ) {
+  heapSet( heap, i, item );
+}
 
-assert( entry->next->prev == entry );
-    entry->next->prev = entry->prev;
+/* move the item at index i towards the bottom of the heap */
+void heapSiftDown( Heap *heap, int i )
+{
+  int child;
+  void *item = heap->items[ i ];
+
+  while( ( child = 2 * i + 1 ) < heap->numItems ) {
+
+    if( child + 1 < heap->numItems
+	&& heap->before( heap->items[ child + 1 ], heap->items[ child ] ) ) {
+      ++child;
+    }
+    if( !heap->before( heap->items[ child ], item ) ) {
+      break;
+    }
+    heapSet( heap, i, heap->items[ child ] );
+    i = child;
   }
+  heapSet( heap, i, item );
+}
 
-assert( !entryInList( pool->free, entry ) );
-  if( pool->free ) {
+void heapPush( Heap *heap, void *item )
+{
+  if( heap->numItems == heap->maxItems ) {
 
-    pool->free->prev = entry;
+    heap->maxItems *= 2;
+    heap->items
+      = (void **)realloc( heap->items, sizeof( void * ) * heap->maxItems );
+    assert( heap->items != 0 );
   }
-  entry->next = pool->free;
-  pool->free = entry;
 
-  --pool->numEntries;
+  heap->items[ heap->numItems ] = item;
+  ++heap->numItems;
+  heapSiftUp( heap, heap->numItems - 1 );
 }
 
-/* LLPool iterator start */
-LLPoolEntry *LLPoolFirstEntry( LLPool *pool )
+/* returns the first item in the heap, or NULL if the heap is empty */
+void *heapTop( const Heap *heap )
 {
-  return pool->head;
+  return heap->numItems ? heap->items[ 0 ] : NULL;
 }
 
-/* removing entries while iterating through the list is fine, as
-   long as cur is not the entry being removed. */
-LLPoolEntry *LLPoolNextEntry( LLPoolEntry *cur )
+/* remove an item which is currently in the heap */
+void heapRemove( Heap *heap, void *item )
 {
-  if( cur ) {
+  int i = *heap->position( item );
 
-    return cur->next;
+  assert( i >= 0 && i < heap->numItems && heap->items[ i ] == item );
+  *heap->position( item ) = -1;
+
+  --heap->numItems;
+  if( i == heap->numItems ) {
+
+    return;
   }
-  return NULL;
+  /* fill the hole with the last item */
+  item = heap->items[ heap->numItems ];
+  heapSet( heap, i, item );
+  heapSiftUp( heap, i );
+  heapSiftDown( heap, *heap->position( item ) );
 }
 
-void *LLPoolGetItem( LLPoolEntry *entry )
+/* restore the heap order after the ordering key of item has changed */
+void heapUpdate( Heap *heap, void *item )
 {
-  return &entry->data;
+  heapSiftUp( heap, *heap->position( item ) );
+  heapSiftDown( heap, *heap->position( item ) );
+}
+
+
+int timeIsEarlier( const struct timeval *a, const struct timeval *b )
+{
+  if( a->tv_sec < b->tv_sec ) {
+    return 1;
+  } else if( a->tv_sec == b->tv_sec
+	     && a->tv_usec < b->tv_usec ) {
+    return 1;
+  }
+  return 0;
+}
+
+/* user match queues hold match entries */
+int *matchPosition( void *item )
+{
+  return &( (Match *)LLPoolGetItem( (LLPoolEntry *)item ) )->heapPos;
+}
+
+/* higher priority matches first, then the match which has waited longest */
+int matchBefore( const void *a, const void *b )
+{
+  const Match *matchA = (Match *)LLPoolGetItem( (LLPoolEntry *)a );
+  const Match *matchB = (Match *)LLPoolGetItem( (LLPoolEntry *)b );
+
+  if( matchA->priority != matchB->priority ) {
+    return matchA->priority > matchB->priority;
+  }
+  return timeIsEarlier( &matchA->queueTime, &matchB->queueTime );
+}
+
+int *userPosition( void *item )
+{
+  return &( (UserSpec *)item )->heapPos;
+}
+
+/* users are ordered by the priority of their best match, then by how
+   many cores they are using relative to their share weight, then by
+   how long they have been waiting.  Only users with queued matches are
+   in the user queue, so heapTop() is never NULL here */
+int userBefore( const void *a, const void *b )
+{
+  const UserSpec *userA = (const UserSpec *)a;
+  const UserSpec *userB = (const UserSpec *)b;
+  const Match *topA = (Match *)LLPoolGetItem( heapTop( &userA->queue ) );
+  const Match *topB = (Match *)LLPoolGetItem( heapTop( &userB->queue ) );
+  double usageA, usageB;
+
+  if( topA->priority != topB->priority ) {
+    return topA->priority > topB->priority;
+  }
+
+  /* compare runningCores / shareWeight without dividing */
+  usageA = userA->runningCores * userB->shareWeight;
+  usageB = userB->runningCores * userA->shareWeight;
+  if( usageA != usageB ) {
+    return usageA < usageB;
+  }
+
+  return timeIsEarlier( &userA->waitStart, &userB->waitStart );
 }
 
 
@@ -271,6 +539,7 @@ void setDefaults( Config *conf )
 {
   conf->port = 54000;
   conf->maxRunningBots = 0;
+  conf->maxCores = 0;
   conf->startupTimeoutSecs = 60;
   conf->responseTimeoutSecs = 600; /* Value from 2011 ACPC */
   conf->handTimeoutSecs = 3000 * 7; /* Not enforced for 2011 ACPC */
@@ -302,13 +571,27 @@ void addBot( GameConfig *gameConf, const char *spec )
   char name[ READBUF_LEN ];
   char command[ READBUF_LEN ];
 
-  /* split the line into name and command */
-  if( sscanf( spec, " %s %s", name, command ) < 2 ) {
+  /* split the line into name, command, and optional thread count
+     and pool size */
+  bot.threads = 1;
+  bot.poolSize = 0;
+  if( sscanf( spec, " %s %s %d %d",
+	      name, command, &bot.threads, &bot.poolSize ) < 2 ) {
 
     fprintf( stderr, "BM_ERROR: could not get bot name and command from: %s",
 	     spec );
     exit( EXIT_FAILURE );
   }
+  if( bot.threads < 0 ) {
+
+    fprintf( stderr, "BM_ERROR: bad number of threads for bot %s\n", name );
+    exit( EXIT_FAILURE );
+  }
+  if( bot.poolSize < 0 ) {
+
+    fprintf( stderr, "BM_ERROR: bad pool size for bot %s\n", name );
+    exit( EXIT_FAILURE );
+  }
 
   /* make sure there are no duplicates */
   if( !strcmp( name, "LOCAL" ) ) {
@@ -325,6 +608,13 @@ void addBot( GameConfig *gameConf, const char *spec )
   /* add the bot */
   bot.name = strdup( name );
   bot.command = strdup( command );
+  bot.pool = NULL;
+  if( bot.poolSize ) {
+
+    bot.pool = (PooledBot *)calloc( bot.poolSize, sizeof( PooledBot ) );
+    assert( bot.pool != 0 );
+    /* calloc leaves every pooled bot as POOL_DEAD, ready to be started */
+  }
   LLPoolAddItem( gameConf->bots, &bot );
 }
 
@@ -351,13 +641,23 @@ void addUser( Config *conf, const char *spec )
   char name[ READBUF_LEN ];
   char passwd[ READBUF_LEN ];
 
-  /* split the line into name and password */
-  if( sscanf( spec, " %s %s", name, passwd ) < 2 ) {
+  /* split the line into name, password, and optional share weight and
+     maximum priority */
+  user.shareWeight = 1.0;
+  user.maxPriority = 0;
+  if( sscanf( spec, " %s %s %lf %d",
+	      name, passwd, &user.shareWeight, &user.maxPriority ) < 2 ) {
 
     fprintf( stderr, "BM_ERROR: could not get user name and password from: %s",
 	     spec );
     exit( EXIT_FAILURE );
   }
+  if( !( user.shareWeight > 0.0 ) ) {
+
+    fprintf( stderr, "BM_ERROR: share weight for user %s must be positive\n",
+	     name );
+    exit( EXIT_FAILURE );
+  }
 
   /* make sure there are no duplicates */
   if( findUser( conf, name ) ) {
@@ -370,6 +670,9 @@ void addUser( Config *conf, const char *spec )
   user.name = strdup( name );
   user.passwd = strdup( passwd );
   gettimeofday( &user.waitStart, NULL );
+  user.runningCores = 0;
+  initHeap( &user.queue, matchBefore, matchPosition );
+  user.heapPos = -1;
   LLPoolAddItem( conf->users, &user );
 }
 
@@ -516,6 +819,18 @@ void readConfig( const char *filename, Config *conf )
 	fprintf( stderr, "BM_ERROR: could not get maximum number of bots running from: %s", line );
 	exit( EXIT_FAILURE );
       }
+    } else if( strncasecmp( line, "maxCores", 8 ) == 0 ) {
+
+      if( gameConf != NULL ) {
+
+	fprintf( stderr, "BM_ERROR: maxCores must be defined outside of game blocks\n" );
+	exit( EXIT_FAILURE );
+      }
+      if( sscanf( &line[ 8 ], "%"SCNu16, &conf->maxCores ) < 1 ) {
+
+	fprintf( stderr, "BM_ERROR: could not get maximum number of cores from: %s", line );
+	exit( EXIT_FAILURE );
+      }
     } else if( strncasecmp( line, "startupTimeoutSecs", 18 ) == 0 ) {
 
       if( gameConf != NULL ) {
@@ -627,6 +942,131 @@ void readConfig( const char *filename, Config *conf )
   fclose( file );
 }
 
+/* make a match with runs left available to be started */
+void queueMatch( ServerState *serv, LLPoolEntry *matchEntry )
+{
+  UserSpec *user = ( (Match *)LLPoolGetItem( matchEntry ) )->user;
+
+  heapPush( &user->queue, matchEntry );
+  if( user->heapPos < 0 ) {
+
+    heapPush( &serv->userQueue, user );
+  } else {
+
+    heapUpdate( &serv->userQueue, user );
+  }
+}
+
+/* take a queued match out of its user's queue */
+void dequeueMatch( ServerState *serv, LLPoolEntry *matchEntry )
+{
+  UserSpec *user = ( (Match *)LLPoolGetItem( matchEntry ) )->user;
+
+  heapRemove( &user->queue, matchEntry );
+  if( user->queue.numItems == 0 ) {
+
+    heapRemove( &serv->userQueue, user );
+  } else {
+
+    heapUpdate( &serv->userQueue, user );
+  }
+}
+
+/* get rid of a match which is neither queued nor running */
+void retireMatch( ServerState *serv, LLPoolEntry *matchEntry )
+{
+  Match *match = (Match *)LLPoolGetItem( matchEntry );
+
+  assert( match->heapPos < 0 && !match->isRunning );
+  free( match->tag );
+  LLPoolRemoveEntry( serv->matches, matchEntry );
+}
+
+/* returns non-zero if the match can be started with the resources
+   that are currently free */
+int matchFits( const Config *conf,
+	       const ServerState *serv,
+	       const Match *match )
+{
+  if( match->gameConf->maxRunningJobs
+      && match->gameConf->curRunningJobs
+      >= match->gameConf->maxRunningJobs ) {
+    /* match is in a game which is currently too busy */
+
+    return 0;
+  }
+
+  if( conf->maxRunningBots
+      && serv->runningBots + match->numBots > conf->maxRunningBots ) {
+
+    return 0;
+  }
+
+  if( conf->maxCores
+      && serv->runningCores + match->numCores > conf->maxCores ) {
+
+    return 0;
+  }
+
+  return 1;
+}
+
+/* remove and return the first match in scheduling order which fits
+   in the free resources, or NULL if there is no such match.  Matches
+   which don't fit are passed over so smaller jobs can be packed into
+   the remaining cores, and are put back in their queues afterwards */
+LLPoolEntry *pickMatch( const Config *conf, ServerState *serv )
+{
+  int numUsers, numMatches, u, m;
+  LLPoolEntry *best;
+  UserSpec *user;
+
+  if( serv->userQueue.numItems == 0 ) {
+
+    return NULL;
+  }
+
+  UserSpec *skippedUsers[ serv->userQueue.numItems ];
+  numUsers = 0;
+  best = NULL;
+  while( best == NULL
+	 && ( user = (UserSpec *)heapTop( &serv->userQueue ) ) != NULL ) {
+    LLPoolEntry *skippedMatches[ user->queue.numItems ];
+
+    /* look through the user's matches in order */
+    heapRemove( &serv->userQueue, user );
+    numMatches = 0;
+    while( ( best = (LLPoolEntry *)heapTop( &user->queue ) ) != NULL ) {
+
+      heapRemove( &user->queue, best );
+      if( matchFits( conf, serv, (Match *)LLPoolGetItem( best ) ) ) {
+	break;
+      }
+      skippedMatches[ numMatches ] = best;
+      ++numMatches;
+    }
+
+    /* put back the matches we passed over */
+    for( m = 0; m < numMatches; ++m ) {
+
+      heapPush( &user->queue, skippedMatches[ m ] );
+    }
+    if( user->queue.numItems ) {
+
+      skippedUsers[ numUsers ] = user;
+      ++numUsers;
+    }
+  }
+
+  /* put back the users, including the user who owns the picked match */
+  for( u = 0; u < numUsers; ++u ) {
+
+    heapPush( &serv->userQueue, skippedUsers[ u ] );
+  }
+
+  return best;
+}
+
 void addConnection( ServerState *serv, const int sock )
 {
   Connection conn;
@@ -675,6 +1115,12 @@ void closeConnection( ServerState *serv, LLPoolEntry *connEntry )
     if( matchUsesConnection( match, connEntry ) ) {
 
       match->numRuns = 0;
+      if( match->heapPos >= 0 ) {
+	/* running matches are cleaned up when their job finishes */
+
+	dequeueMatch( serv, cur );
+	retireMatch( serv, cur );
+      }
     }
   }
 }
@@ -723,6 +1169,8 @@ int parseMatchSpec( const Config *conf,
     return -1;
   }
   match->gameConf = (GameConfig *)LLPoolGetItem( entry );
+  match->numBots = 0;
+  match->numCores = 0;
 
   if( sscanf( &spec[ pos ],
 	      " %d %s %"SCNu32" %n",
@@ -768,9 +1216,22 @@ int parseMatchSpec( const Config *conf,
 
 	return -1;
       }
+      ++match->numBots;
+      match->numCores += ( (BotSpec *)LLPoolGetItem( match->players[ p ].entry ) )->threads;
     }
   }
 
+  /* optional priority after the players */
+  match->priority = 0;
+  sscanf( &spec[ pos ], " %d", &match->priority );
+
+  /* don't accept matches which could never be started */
+  if( ( conf->maxRunningBots && match->numBots > conf->maxRunningBots )
+      || ( conf->maxCores && match->numCores > conf->maxCores ) ) {
+
+    return -1;
+  }
+
   match->tag = strdup( tag );
   match->rngSeed = rngSeed;
   if( rngSeed ) {
@@ -798,8 +1259,9 @@ void writeHelpMessage( int fd )
   r = write( fd, "HELP - this message\n", 20 );
   r = write( fd, "GAMES - list available games and players\n", 41 );
   r = write( fd, "QSTAT - show the current queue\n", 31 );
-  r = write( fd, "RUNMATCHES game #runs tag rngSeed player ... - submit match request\n", 68 );
+  r = write( fd, "RUNMATCHES game #runs tag rngSeed player ... [priority] - submit match request\n", 79 );
   r = write( fd, "  - Player order decides match seating\n", 39 );
+  r = write( fd, "  - Higher priority matches run first, up to the user's maximum priority\n", 73 );
   r = write( fd, "  - \"LOCAL\" player runs the bm_widget agent (bot_command)\n", 60 );
 }
 
@@ -844,12 +1306,13 @@ void writeQueueStatus( const Config *conf, const ServerState *serv, int fd )
 
     r = snprintf( line,
 		  sizeof( line ),
-		  "%s %s %s * %d %s\n",
+		  "%s %s %s * %d %s %d\n",
 		  match->user->name,
 		  match->tag,
 		  match->gameConf->gameFile,
 		  match->numRuns,
-		  match->isRunning ? "R" : "Q" );
+		  match->isRunning ? "R" : "Q",
+		  match->priority );
     assert( r > 0 );
     r = write( fd, line, r );
   }
@@ -911,9 +1374,20 @@ void handleConnection( Config *conf, ServerState *serv,
 	return;
       }
       match.user = ( (Connection *)LLPoolGetItem( connEntry ) )->user;
+      if( match.priority > match.user->maxPriority ) {
+
+	match.priority = match.user->maxPriority;
+      }
       match.isRunning = 0;
+      match.heapPos = -1;
       gettimeofday( &match.queueTime, NULL );
-      LLPoolAddItem( serv->matches, &match );
+      if( match.numRuns > 0 ) {
+
+	queueMatch( serv, LLPoolAddItem( serv->matches, &match ) );
+      } else {
+
+	free( match.tag );
+      }
       return;
     } else {
 
@@ -923,34 +1397,6 @@ void handleConnection( Config *conf, ServerState *serv,
   }
 }
 
-int timeIsEarlier( struct timeval *a, struct timeval *b )
-{
-  if( a->tv_sec < b->tv_sec ) {
-    return 1;
-  } else if( a->tv_sec == b->tv_sec
-	     && a->tv_usec < b->tv_usec ) {
-    return 1;
-  }
-  return 0;
-}
-
-/* how many bots will match start? */
-int botsInMatch( const Match *match )
-{
-  int p, num;
-
-  num = 0;
-  for( p = 0; p < match->gameConf->game->numPlayers; ++p ) {
-
-    if( !match->players[ p ].isNetworkPlayer ) {
-
-      ++num;
-    }
-  }
-
-  return num;
-}
-
 void startDealer( const Config *conf,
 		  const Match *match,
 		  MatchJob *job,
@@ -1178,6 +1624,230 @@ pid_t startBot( const ServerState *serv,
   return pid;
 }
 
+/* how long a pooled bot may take to say READY */
+time_t poolReadySecs( const Config *conf )
+{
+  return conf->startupTimeoutSecs
+    ? conf->startupTimeoutSecs : BM_POOL_READY_SECS;
+}
+
+/* start a pooled bot, which is run as "command hostname pool index" with
+   its control pipes on BM_POOL_CMD_FD and BM_POOL_REPLY_FD.  The bot
+   writes READY once it has finished starting up and after every match,
+   plays a match when it reads "RUN host port position", and exits on
+   QUIT or end of file */
+void startPooledBot( const Config *conf,
+		     const ServerState *serv,
+		     const BotSpec *bot,
+		     PooledBot *pooled,
+		     const int index )
+{
+  int cmdPipe[ 2 ], replyPipe[ 2 ];
+
+  gettimeofday( &pooled->startTime, NULL );
+
+  if( pipe( cmdPipe ) < 0 ) {
+
+    fprintf( stderr, "BM_ERROR: could not create pipe for pooled bot\n" );
+    return;
+  }
+  if( pipe( replyPipe ) < 0 ) {
+
+    fprintf( stderr, "BM_ERROR: could not create pipe for pooled bot\n" );
+    close( cmdPipe[ 0 ] );
+    close( cmdPipe[ 1 ] );
+    return;
+  }
+
+  pooled->pid = fork();
+  if( pooled->pid < 0 ) {
+
+    fprintf( stderr, "BM_ERROR: fork() failed\n" );
+    exit( EXIT_FAILURE );
+  }
+  if( !pooled->pid ) {
+    /* child runs the bot command */
+    int fd, cmdFd, replyFd;
+    char posString[ 16 ];
+
+    snprintf( posString, sizeof( posString ), "%d", index );
+
+    /* throw away bot output */
+    dup2( serv->devnullfd, 1 );
+    dup2( serv->devnullfd, 2 );
+
+    /* move the pipes out of the way before putting them in place */
+    cmdFd = fcntl( cmdPipe[ 0 ], F_DUPFD, BM_POOL_REPLY_FD + 1 );
+    replyFd = fcntl( replyPipe[ 1 ], F_DUPFD, BM_POOL_REPLY_FD + 1 );
+    dup2( cmdFd, BM_POOL_CMD_FD );
+    dup2( replyFd, BM_POOL_REPLY_FD );
+
+    /* the bot outlives many matches, so don't let it hold on to the
+       server's sockets and pipes */
+    for( fd = BM_POOL_REPLY_FD + 1; fd < getdtablesize(); ++fd ) {
+
+      close( fd );
+    }
+
+    execl( bot->command,
+	   bot->command,
+	   serv->hostname,
+	   "pool",
+	   posString,
+	   NULL );
+
+    fprintf( stderr, "BM_ERROR: could not start bot %s\n", bot->command );
+    exit( EXIT_FAILURE );
+  }
+
+  close( cmdPipe[ 0 ] );
+  close( replyPipe[ 1 ] );
+  fcntl( cmdPipe[ 1 ], F_SETFD, FD_CLOEXEC );
+  fcntl( replyPipe[ 0 ], F_SETFD, FD_CLOEXEC );
+  pooled->cmdFd = cmdPipe[ 1 ];
+  pooled->replyBuf = createReadBuf( replyPipe[ 0 ] );
+  if( pooled->replyBuf == 0 ) {
+
+    fprintf( stderr, "BM_ERROR: could not create read buffer for pooled bot\n" );
+    exit( EXIT_FAILURE );
+  }
+  pooled->jobEntry = NULL;
+  pooled->status = POOL_STARTING;
+  pooled->readyDeadline = pooled->startTime.tv_sec + poolReadySecs( conf );
+}
+
+/* the bot is no longer usable, so get rid of it.  If it was playing a
+   match, the job no longer waits for it */
+void killPooledBot( PooledBot *pooled )
+{
+  if( pooled->status == POOL_BUSY && pooled->jobEntry ) {
+    MatchJob *job = (MatchJob *)LLPoolGetItem( pooled->jobEntry );
+
+    job->pooledBot[ pooled->seat ] = NULL;
+  }
+
+  kill( pooled->pid, SIGKILL );
+  waitpid( pooled->pid, NULL, 0 );
+  close( pooled->cmdFd );
+  destroyReadBuf( pooled->replyBuf );
+  pooled->status = POOL_DEAD;
+}
+
+/* read replies from a pooled bot */
+void handlePooledBot( PooledBot *pooled )
+{
+  ssize_t r;
+  char line[ READBUF_LEN ];
+
+  while( ( r = getLine( pooled->replyBuf, READBUF_LEN, line, 0 ) ) >= 0 ) {
+
+    if( r == 0 ) {
+      /* bot has gone away */
+
+      fprintf( stderr, "BM_ERROR: pooled bot exited\n" );
+      killPooledBot( pooled );
+      return;
+    }
+
+    if( strncasecmp( line, "READY", 5 ) ) {
+
+      fprintf( stderr, "BM_ERROR: unexpected message from pooled bot: %s",
+	       line );
+      continue;
+    }
+
+    if( pooled->status == POOL_BUSY && pooled->jobEntry ) {
+      /* finished the match */
+      MatchJob *job = (MatchJob *)LLPoolGetItem( pooled->jobEntry );
+
+      job->pooledBot[ pooled->seat ] = NULL;
+    }
+    pooled->jobEntry = NULL;
+    pooled->status = POOL_IDLE;
+    pooled->readyDeadline = 0;
+  }
+}
+
+/* hand a match to an idle pooled bot of the given type
+   returns the bot on success, NULL if there was no usable idle bot */
+PooledBot *runPooledBot( const ServerState *serv,
+			 const BotSpec *bot,
+			 const uint16_t port,
+			 const int botPosition )
+{
+  int i, len;
+  char msg[ strlen( serv->hostname ) + 64 ];
+
+  len = snprintf( msg,
+		  sizeof( msg ),
+		  "RUN %s %"PRIu16" %d\n",
+		  serv->hostname, port, botPosition );
+  assert( len > 0 );
+
+  for( i = 0; i < bot->poolSize; ++i ) {
+
+    if( bot->pool[ i ].status != POOL_IDLE ) {
+      continue;
+    }
+
+    if( write( bot->pool[ i ].cmdFd, msg, len ) < len ) {
+
+      fprintf( stderr, "BM_ERROR: could not send match to pooled bot\n" );
+      killPooledBot( &bot->pool[ i ] );
+      continue;
+    }
+
+    bot->pool[ i ].status = POOL_BUSY;
+    bot->pool[ i ].readyDeadline = 0;
+    return &bot->pool[ i ];
+  }
+
+  return NULL;
+}
+
+/* kill any pooled bots which are past their READY deadline, and start
+   any pooled bots which aren't running.  Bots which died are not
+   restarted more often than every BM_POOL_RESTART_SECS */
+void replenishBotPools( const Config *conf, const ServerState *serv )
+{
+  int i;
+  LLPoolEntry *cur, *botCur;
+  struct timeval now;
+
+  gettimeofday( &now, NULL );
+  for( cur = LLPoolFirstEntry( conf->games );
+       cur != NULL; cur = LLPoolNextEntry( cur ) ) {
+    GameConfig *game = (GameConfig *)LLPoolGetItem( cur );
+
+    for( botCur = LLPoolFirstEntry( game->bots );
+	 botCur != NULL; botCur = LLPoolNextEntry( botCur ) ) {
+      BotSpec *bot = (BotSpec *)LLPoolGetItem( botCur );
+
+      for( i = 0; i < bot->poolSize; ++i ) {
+
+	if( bot->pool[ i ].status != POOL_DEAD
+	    && bot->pool[ i ].readyDeadline
+	    && now.tv_sec >= bot->pool[ i ].readyDeadline ) {
+	  /* a hung bot would hold its job and pool slot forever */
+
+	  fprintf( stderr, "BM_ERROR: pooled bot %s did not say READY in time\n",
+		   bot->name );
+	  killPooledBot( &bot->pool[ i ] );
+	  continue;
+	}
+
+	if( bot->pool[ i ].status == POOL_DEAD
+	    && ( bot->pool[ i ].startTime.tv_sec == 0
+		 || now.tv_sec - bot->pool[ i ].startTime.tv_sec
+		 >= BM_POOL_RESTART_SECS ) ) {
+
+	  startPooledBot( conf, serv, bot, &bot->pool[ i ], i );
+	}
+      }
+    }
+  }
+}
+
 int sendStartMessage( const ServerState *serv,
 		      const MatchJob *job,
 		      const Connection *conn,
@@ -1229,6 +1899,7 @@ MatchJob runMatchJob( const Config *conf,
   for( p = 0; p < match->gameConf->game->numPlayers; ++p ) {
 
     job.botPID[ p ] = 0;
+    job.pooledBot[ p ] = NULL;
   }
 
   /* start the dealer */
@@ -1260,13 +1931,14 @@ MatchJob runMatchJob( const Config *conf,
 	return job;
       }
     } else {
-      /* start up bot */
+      /* use an idle pooled bot if there is one, otherwise start up bot */
+      BotSpec *bot = (BotSpec *)LLPoolGetItem( match->players[ p ].entry );
 
-      job.botPID[ p ]
-	= startBot( serv,
-		    (BotSpec *)LLPoolGetItem( match->players[ p ].entry ),
-		    job.ports[ p ],
-		    botPosition );
+      job.pooledBot[ p ] = runPooledBot( serv, bot, job.ports[ p ], botPosition );
+      if( job.pooledBot[ p ] == NULL ) {
+
+	job.botPID[ p ] = startBot( serv, bot, job.ports[ p ], botPosition );
+      }
       ++botPosition;
     }
   }
@@ -1276,79 +1948,18 @@ MatchJob runMatchJob( const Config *conf,
 
 int startMatchJob( const Config *conf, ServerState *serv )
 {
-  int running;
-  LLPoolEntry *cur, *next, *best;
-  Match *curMatch, *bestMatch;
+  int p;
+  LLPoolEntry *best, *jobEntry;
+  Match *bestMatch;
   MatchJob job;
 
-  /* automatically done adding things if we've got no more matches */
-  if( serv->matches->numEntries == 0 ) {
-
-    return 0;
-  }
-
-  /* how many bots are currently running */
-  running = 0;
-  for( cur = LLPoolFirstEntry( serv->jobs );
-       cur != NULL; cur = LLPoolNextEntry( cur ) ) {
-    MatchJob *job = (MatchJob *)LLPoolGetItem( cur );
-
-    running += botsInMatch( (Match*)LLPoolGetItem( job->matchEntry ) );
-  }
-
   /* pick the best match to start */
-  best = 0;
-  bestMatch = 0;
-  for( cur = LLPoolFirstEntry( serv->matches ); cur != NULL; cur = next ) {
-    next = LLPoolNextEntry( cur );
-    curMatch = (Match *)LLPoolGetItem( cur );
-
-    if( curMatch->isRunning ) {
-
-      continue;
-    }
-
-    if( curMatch->numRuns <= 0 ) {
-      /* match is finished - clean it up */
-
-      free( curMatch->tag );
-      LLPoolRemoveEntry( serv->matches, cur );
-      continue;
-    }
-
-    if( curMatch->gameConf->maxRunningJobs
-	&& curMatch->gameConf->curRunningJobs
-	>= curMatch->gameConf->maxRunningJobs ) {
-      /* cur refers to a match in a game which is currently too busy */
-
-      continue;
-    }
-
-    if( best == 0
-	|| timeIsEarlier( &curMatch->user->waitStart,
-			  &bestMatch->user->waitStart )
-	|| ( !timeIsEarlier( &bestMatch->user->waitStart,
-			     &curMatch->user->waitStart )
-	     && timeIsEarlier( &curMatch->queueTime,
-			       &bestMatch->queueTime ) ) ) {
-
-      best = cur;
-      bestMatch = curMatch;
-    }
-  }
-
-  /* return failure if we couldn't find a runnable job */
+  best = pickMatch( conf, serv );
   if( best == NULL ) {
 
     return 0;
   }
-
-  /* check if we have the space to run the bots */
-  if( conf->maxRunningBots
-      && botsInMatch( bestMatch ) + running > conf->maxRunningBots ) {
-
-    return 0;
-  }
+  bestMatch = (Match *)LLPoolGetItem( best );
 
   /* create the job */
   job = runMatchJob( conf,
@@ -1358,14 +1969,31 @@ int startMatchJob( const Config *conf, ServerState *serv )
 		     ? genrand_int32( &bestMatch->rng )
 		     : bestMatch->rngSeed );
   assert( job.dealerPID );
-  LLPoolAddItem( serv->jobs, &job );
+  jobEntry = LLPoolAddItem( serv->jobs, &job );
+
+  /* pooled bots report back to the job when they finish the match */
+  for( p = 0; p < bestMatch->gameConf->game->numPlayers; ++p ) {
+
+    if( job.pooledBot[ p ] ) {
+
+      job.pooledBot[ p ]->jobEntry = jobEntry;
+      job.pooledBot[ p ]->seat = p;
+    }
+  }
 
   /* update status about running jobs */
   ++( bestMatch->gameConf->curRunningJobs );
+  serv->runningBots += bestMatch->numBots;
+  serv->runningCores += bestMatch->numCores;
   bestMatch->isRunning = 1;
 
   /* update the user */
+  bestMatch->user->runningCores += bestMatch->numCores;
   gettimeofday( &bestMatch->user->waitStart, NULL );
+  if( bestMatch->user->heapPos >= 0 ) {
+
+    heapUpdate( &serv->userQueue, bestMatch->user );
+  }
 
   /* update the match */
   --bestMatch->numRuns;
@@ -1385,6 +2013,9 @@ void initServerState( const Config *conf, ServerState *serv )
   serv->conns = newLLPool( sizeof( Connection ) );
   serv->matches = newLLPool( sizeof( Match ) );
   serv->jobs = newLLPool( sizeof( MatchJob ) );
+  initHeap( &serv->userQueue, userBefore, userPosition );
+  serv->runningBots = 0;
+  serv->runningCores = 0;
 
   /* create the socket clients will connect to */
   port = conf->port;
@@ -1448,7 +2079,7 @@ void initServerState( const Config *conf, ServerState *serv )
   }
 }
 
-int checkIfJobFinished( MatchJob *job )
+int checkIfJobFinished( const Config *conf, MatchJob *job )
 {
   int status, r, p, allDone;
   Match *match = (Match *)LLPoolGetItem( job->matchEntry );
@@ -1473,6 +2104,18 @@ int checkIfJobFinished( MatchJob *job )
   }
 
   for( p = 0; p < match->gameConf->game->numPlayers; ++p ) {
+    if( job->pooledBot[ p ] ) {
+      /* pooled bot hasn't said it's READY yet.  Once the dealer is gone
+	 the match is over, so the bot only gets a bounded time to reply
+	 before replenishBotPools kills it and the job ends */
+
+      if( job->dealerPID == 0 && job->pooledBot[ p ]->readyDeadline == 0 ) {
+
+	job->pooledBot[ p ]->readyDeadline = time( NULL ) + poolReadySecs( conf );
+      }
+      allDone = 0;
+      continue;
+    }
     if( job->botPID[ p ] == 0 ) {
       continue;
     }
@@ -1502,7 +2145,23 @@ void finishedJob( ServerState *serv, LLPoolEntry *jobEntry )
 
   free( job->tag );
   --( match->gameConf->curRunningJobs );
+  serv->runningBots -= match->numBots;
+  serv->runningCores -= match->numCores;
+  match->user->runningCores -= match->numCores;
+  if( match->user->heapPos >= 0 ) {
+
+    heapUpdate( &serv->userQueue, match->user );
+  }
   match->isRunning = 0;
+
+  /* requeue the match if it has more runs, otherwise it's finished */
+  if( match->numRuns > 0 ) {
+
+    queueMatch( serv, job->matchEntry );
+  } else {
+
+    retireMatch( serv, job->matchEntry );
+  }
   LLPoolRemoveEntry( serv->jobs, jobEntry );
 }
 
@@ -1510,9 +2169,9 @@ int main( int argc, char **argv )
 {
   Config conf;
   ServerState serv;
-  int maxfd;
+  int maxfd, i;
   fd_set readfds;
-  LLPoolEntry *cur, *next;
+  LLPoolEntry *cur, *next, *gameCur, *botCur;
   struct timeval tv;
 
   if( argc < 2 ) {
@@ -1542,7 +2201,7 @@ int main( int argc, char **argv )
       next = LLPoolNextEntry( cur );
       MatchJob *job = (MatchJob *)LLPoolGetItem( cur );
 
-      if( checkIfJobFinished( job ) ) {
+      if( checkIfJobFinished( &conf, job ) ) {
 
 	finishedJob( &serv, cur );
       }
@@ -1558,6 +2217,9 @@ int main( int argc, char **argv )
       }
     }
 
+    /* make sure the bot pools are full */
+    replenishBotPools( &conf, &serv );
+
     /* start jobs, up to the maximum */
     while( startMatchJob( &conf, &serv ) );
 
@@ -1577,6 +2239,27 @@ int main( int argc, char **argv )
 	maxfd = conn->connBuf->fd;
       }
     }
+    for( gameCur = LLPoolFirstEntry( conf.games );
+	 gameCur != NULL; gameCur = LLPoolNextEntry( gameCur ) ) {
+      GameConfig *game = (GameConfig *)LLPoolGetItem( gameCur );
+
+      for( botCur = LLPoolFirstEntry( game->bots );
+	   botCur != NULL; botCur = LLPoolNextEntry( botCur ) ) {
+	BotSpec *bot = (BotSpec *)LLPoolGetItem( botCur );
+
+	for( i = 0; i < bot->poolSize; ++i ) {
+
+	  if( bot->pool[ i ].status == POOL_DEAD ) {
+	    continue;
+	  }
+	  FD_SET( bot->pool[ i ].replyBuf->fd, &readfds );
+	  if( bot->pool[ i ].replyBuf->fd > maxfd ) {
+
+	    maxfd = bot->pool[ i ].replyBuf->fd;
+	  }
+	}
+      }
+    }
     if( select( maxfd + 1, &readfds, NULL, NULL, &tv ) < 0 ) {
 
       fprintf( stderr, "BM_ERROR: select failed\n" );
@@ -1597,6 +2280,24 @@ int main( int argc, char **argv )
 	handleConnection( &conf, &serv, cur );
       }
     }
+    for( gameCur = LLPoolFirstEntry( conf.games );
+	 gameCur != NULL; gameCur = LLPoolNextEntry( gameCur ) ) {
+      GameConfig *game = (GameConfig *)LLPoolGetItem( gameCur );
+
+      for( botCur = LLPoolFirstEntry( game->bots );
+	   botCur != NULL; botCur = LLPoolNextEntry( botCur ) ) {
+	BotSpec *bot = (BotSpec *)LLPoolGetItem( botCur );
+
+	for( i = 0; i < bot->poolSize; ++i ) {
+
+	  if( bot->pool[ i ].status != POOL_DEAD
+	      && FD_ISSET( bot->pool[ i ].replyBuf->fd, &readfds ) ) {
+
+	    handlePooledBot( &bot->pool[ i ] );
+	  }
+	}
+      }
+    }
   }
 
   close( serv.listenSocket );
@@ -4,6 +4,7 @@ Copyright (C) 2011 by the Computer Poker Research Group, University of Alberta
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #define __STDC_LIMIT_MACROS
 #include <stdint.h>
 #include <unistd.h>
@@ -33,6 +34,17 @@ Copyright (C) 2011 by the Computer Poker Research Group, University of Alberta
    the final total values for each player will be printed to both
    standard out and standard error
 
+   if checkpoints are enabled along with the transaction file,
+   matchName.ckpt is rewritten every few hands with the dealer state at
+   the end of a hand and the length of the transaction file at that
+   point, so an interrupted match only needs to replay the transactions
+   after the checkpoint
+
+   if a stats file is given, it is periodically rewritten with a JSON
+   summary of the match so far: hands per second, bytes sent to and
+   received from each seat, and response time histograms for each
+   seat, round and action type
+
    exit value is EXIT_SUCCESS if the match was a success,
    or EXIT_FAILURE on any failure */
 
@@ -41,6 +53,15 @@ Copyright (C) 2011 by the Computer Poker Research Group, University of Alberta
 #define DEFAULT_MAX_RESPONSE_MICROS 600000000
 #define DEFAULT_MAX_USED_HAND_MICROS 600000000
 #define DEFAULT_MAX_USED_PER_HAND_MICROS 7000000
+#define DEFAULT_STATS_INTERVAL_MICROS 1000000
+
+/* response time histograms use log-linear buckets, like HdrHistogram:
+   each power of two range of microseconds is split into
+   HIST_SUB_BUCKETS linear buckets, so every recorded time is kept to
+   within 1/HIST_SUB_BUCKETS of its value */
+#define HIST_SUB_BITS 4
+#define HIST_SUB_BUCKETS ( 1 << HIST_SUB_BITS )
+#define HIST_BUCKETS ( ( 33 - HIST_SUB_BITS ) * HIST_SUB_BUCKETS )
 
 
 typedef struct {
@@ -54,6 +75,45 @@ typedef struct {
   uint64_t usedMatchMicros[ MAX_PLAYERS ];
 } ErrorInfo;
 
+typedef struct {
+  uint64_t count;
+  uint64_t sumMicros;
+  uint32_t maxMicros;
+  uint32_t bucket[ HIST_BUCKETS ];
+} LatencyHistogram;
+
+typedef struct {
+  const char *fileName;
+  char *tempFileName;
+  const char *matchName;
+  uint64_t intervalMicros;
+
+  struct timeval startTime;
+  struct timeval lastWriteTime;
+  uint32_t handsPlayed;
+  uint32_t lastWriteHands;
+
+  uint64_t bytesSent[ MAX_PLAYERS ];
+  uint64_t bytesReceived[ MAX_PLAYERS ];
+
+  /* latency[ seat ][ round ][ action type ] */
+  LatencyHistogram latency[ MAX_PLAYERS ][ MAX_ROUNDS ][ NUM_ACTION_TYPES ];
+} MatchStats;
+
+typedef struct {
+  /* if non-zero, hand h is dealt directly from ( seed, h ) with the
+     counter-based generator, otherwise cards come off the rng stream */
+  int counterDeals;
+  uint32_t seed;
+  rng_state_t rng;
+} DealerRng;
+
+typedef struct {
+  char *fileName;
+  char *tempFileName;
+  uint32_t intervalHands;
+} Checkpoint;
+
 
 static void printUsage( FILE *file, int verbose )
 {
@@ -64,11 +124,17 @@ static void printUsage( FILE *file, int verbose )
   fprintf( file, "  -q only print errors, warnings, and final value to stderr\n" );
   fprintf( file, "  -t/T disable/enable transaction file - disabled by default\n" );
   fprintf( file, "  -a append to log/transaction files - disabled by default\n" );
+  fprintf( file, "  -c deal each hand from (rngSeed, hand number) with the counter-based\n" );
+  fprintf( file, "    generator instead of the Mersenne Twister stream\n" );
   fprintf( file, "  --t_response [milliseconds] maximum time per response\n" );
   fprintf( file, "  --t_hand [milliseconds] maximum player time per hand\n" );
   fprintf( file, "  --t_per_hand [milliseconds] maximum average player time for match\n" );
   fprintf( file, "  --start_timeout [milliseconds] maximum time to wait for players to connect\n" );
   fprintf( file, "    <0 [default] is no timeout\n" );
+  fprintf( file, "  --stats_file [file] periodically write match statistics to file\n" );
+  fprintf( file, "  --stats_interval [milliseconds] time between stats file updates [default %d]\n", DEFAULT_STATS_INTERVAL_MICROS / 1000 );
+  fprintf( file, "  --checkpoint [hands] with -T, save the match state every [hands] hands\n" );
+  fprintf( file, "    so a match restarted with -T -a only replays transactions since then\n" );
 }
 
 /* returns >= 0 on success, -1 on error */
@@ -198,6 +264,243 @@ static int checkErrorNewHand( const Game *game, ErrorInfo *info )
 }
 
 
+static uint64_t microsBetween( const struct timeval *start,
+			       const struct timeval *end )
+{
+  /* calls to gettimeofday can return earlier times on later calls :/ */
+  if( end->tv_sec < start->tv_sec
+      || ( end->tv_sec == start->tv_sec && end->tv_usec < start->tv_usec ) ) {
+    return 0;
+  }
+
+  return (uint64_t)( end->tv_sec - start->tv_sec ) * 1000000
+    + end->tv_usec - start->tv_usec;
+}
+
+static int histogramBucket( const uint32_t micros )
+{
+  int shift;
+
+  if( micros < 2 * HIST_SUB_BUCKETS ) {
+
+    return micros;
+  }
+
+  /* shift micros down to HIST_SUB_BITS+1 significant bits */
+  shift = 31 - __builtin_clz( micros ) - HIST_SUB_BITS;
+  return ( shift + 1 ) * HIST_SUB_BUCKETS
+    + ( micros >> shift ) - HIST_SUB_BUCKETS;
+}
+
+/* returns the largest time which is recorded in bucket */
+static uint64_t histogramBucketMax( const int bucket )
+{
+  int shift;
+
+  if( bucket < 2 * HIST_SUB_BUCKETS ) {
+
+    return bucket;
+  }
+
+  shift = bucket / HIST_SUB_BUCKETS - 1;
+  return ( ( (uint64_t)( bucket % HIST_SUB_BUCKETS + HIST_SUB_BUCKETS + 1 )
+	     << shift ) - 1 );
+}
+
+static void histogramAdd( LatencyHistogram *hist, const uint64_t micros )
+{
+  uint32_t m;
+
+  m = micros > UINT32_MAX ? UINT32_MAX : micros;
+
+  ++hist->count;
+  hist->sumMicros += m;
+  if( m > hist->maxMicros ) {
+    hist->maxMicros = m;
+  }
+  ++hist->bucket[ histogramBucket( m ) ];
+}
+
+/* returns the time that at least fraction q of the responses were within */
+static uint64_t histogramPercentile( const LatencyHistogram *hist,
+				     const double q )
+{
+  int b;
+  uint64_t target, seen, v;
+
+  target = (uint64_t)( q * hist->count + 0.5 );
+  if( target < 1 ) {
+    target = 1;
+  }
+
+  seen = 0;
+  for( b = 0; b < HIST_BUCKETS; ++b ) {
+
+    seen += hist->bucket[ b ];
+    if( seen >= target ) {
+
+      v = histogramBucketMax( b );
+      return v < hist->maxMicros ? v : hist->maxMicros;
+    }
+  }
+
+  return hist->maxMicros;
+}
+
+/* returns >= 0 on success, -1 on failure */
+static int initMatchStats( const char *fileName, const char *matchName,
+			   const uint64_t intervalMicros, MatchStats *stats )
+{
+  size_t len;
+
+  memset( stats, 0, sizeof( *stats ) );
+  stats->fileName = fileName;
+  stats->matchName = matchName;
+  stats->intervalMicros = intervalMicros;
+
+  /* the file is written under a temporary name and then renamed, so
+     readers never see a partly written file */
+  len = strlen( fileName ) + 5;
+  stats->tempFileName = (char *)malloc( len );
+  if( stats->tempFileName == NULL ) {
+
+    fprintf( stderr, "ERROR: could not allocate stats file name\n" );
+    return -1;
+  }
+  snprintf( stats->tempFileName, len, "%s.tmp", fileName );
+
+  gettimeofday( &stats->startTime, NULL );
+  stats->lastWriteTime = stats->startTime;
+
+  return 0;
+}
+
+static void recordResponse( const uint8_t seat, const uint8_t round,
+			    const Action *action,
+			    const struct timeval *sendTime,
+			    const struct timeval *recvTime,
+			    MatchStats *stats )
+{
+  histogramAdd( &stats->latency[ seat ][ round ][ action->type ],
+		microsBetween( sendTime, recvTime ) );
+}
+
+/* write str as a quoted JSON string, escaping quotes, backslashes and
+   control characters */
+static void printJsonString( FILE *file, const char *str )
+{
+  const unsigned char *c;
+
+  fputc( '"', file );
+  for( c = (const unsigned char *)str; *c; ++c ) {
+
+    if( *c == '"' || *c == '\\' ) {
+
+      fputc( '\\', file );
+      fputc( *c, file );
+    } else if( *c < 0x20 ) {
+
+      fprintf( file, "\\u%04x", *c );
+    } else {
+
+      fputc( *c, file );
+    }
+  }
+  fputc( '"', file );
+}
+
+/* returns >= 0 if match should continue, -1 on failure */
+static int writeStatsFile( const Game *game, char *seatName[ MAX_PLAYERS ],
+			   const uint32_t handId, const ErrorInfo *errorInfo,
+			   MatchStats *stats )
+{
+  static const char *actionName[ NUM_ACTION_TYPES ]
+    = { "fold", "call", "raise" };
+  int seat, r, a, first;
+  double elapsed, recent;
+  FILE *file;
+  struct timeval now;
+  const LatencyHistogram *hist;
+
+  gettimeofday( &now, NULL );
+  elapsed = microsBetween( &stats->startTime, &now ) / 1000000.0;
+  recent = microsBetween( &stats->lastWriteTime, &now ) / 1000000.0;
+
+  file = fopen( stats->tempFileName, "w" );
+  if( file == NULL ) {
+
+    fprintf( stderr, "ERROR: could not open stats file %s\n",
+	     stats->tempFileName );
+    return -1;
+  }
+
+  fprintf( file, "{\n  \"match\": " );
+  printJsonString( file, stats->matchName );
+  fprintf( file, ",\n" );
+  fprintf( file, "  \"handId\": %"PRIu32",\n", handId );
+  fprintf( file, "  \"handsPlayed\": %"PRIu32",\n", stats->handsPlayed );
+  fprintf( file, "  \"elapsedSecs\": %.3f,\n", elapsed );
+  fprintf( file, "  \"handsPerSec\": %.2f,\n",
+	   elapsed > 0 ? stats->handsPlayed / elapsed : 0.0 );
+  fprintf( file, "  \"recentHandsPerSec\": %.2f,\n",
+	   recent > 0 ? ( stats->handsPlayed - stats->lastWriteHands ) / recent
+	   : 0.0 );
+  fprintf( file, "  \"seats\": [\n" );
+  for( seat = 0; seat < game->numPlayers; ++seat ) {
+
+    fprintf( file, "    {\n      \"seat\": %d,\n      \"name\": ",
+	     seat + 1 );
+    printJsonString( file, seatName[ seat ] );
+    fprintf( file, ",\n" );
+    fprintf( file, "      \"bytesSent\": %"PRIu64",\n",
+	     stats->bytesSent[ seat ] );
+    fprintf( file, "      \"bytesReceived\": %"PRIu64",\n",
+	     stats->bytesReceived[ seat ] );
+    fprintf( file, "      \"usedMatchMicros\": %"PRIu64",\n",
+	     errorInfo->usedMatchMicros[ seat ] );
+    fprintf( file, "      \"invalidActions\": %"PRIu32",\n",
+	     errorInfo->numInvalidActions[ seat ] );
+    fprintf( file, "      \"latency\": [" );
+    first = 1;
+    for( r = 0; r < game->numRounds; ++r ) {
+
+      for( a = 0; a < NUM_ACTION_TYPES; ++a ) {
+
+	hist = &stats->latency[ seat ][ r ][ a ];
+	if( hist->count == 0 ) {
+	  continue;
+	}
+
+	fprintf( file, "%s\n        { \"round\": %d, \"action\": \"%s\", \"count\": %"PRIu64", \"meanMicros\": %.1f, \"p50Micros\": %"PRIu64", \"p90Micros\": %"PRIu64", \"p99Micros\": %"PRIu64", \"p999Micros\": %"PRIu64", \"maxMicros\": %"PRIu32" }",
+		 first ? "" : ",", r, actionName[ a ], hist->count,
+		 (double)hist->sumMicros / hist->count,
+		 histogramPercentile( hist, 0.5 ),
+		 histogramPercentile( hist, 0.9 ),
+		 histogramPercentile( hist, 0.99 ),
+		 histogramPercentile( hist, 0.999 ),
+		 hist->maxMicros );
+	first = 0;
+      }
+    }
+    fprintf( file, "%s]\n    }%s\n", first ? "" : "\n      ",
+	     seat + 1 < game->numPlayers ? "," : "" );
+  }
+  fprintf( file, "  ]\n}\n" );
+
+  if( fclose( file ) != 0 || rename( stats->tempFileName, stats->fileName ) ) {
+
+    fprintf( stderr, "ERROR: could not write stats file %s\n",
+	     stats->fileName );
+    return -1;
+  }
+
+  stats->lastWriteTime = now;
+  stats->lastWriteHands = stats->handsPlayed;
+
+  return 0;
+}
+
+
 static uint8_t seatToPlayer( const Game *game, const uint8_t player0Seat,
 			     const uint8_t seat )
 {
@@ -210,7 +513,7 @@ static uint8_t playerToSeat( const Game *game, const uint8_t player0Seat,
   return ( player + player0Seat ) % game->numPlayers;
 }
 
-/* returns >= 0 if match should continue, -1 for failure */
+/* returns number of bytes sent if match should continue, -1 for failure */
 static int sendPlayerMessage( const Game *game, const MatchState *state,
 			      const int quiet, const uint8_t seat,
 			      const int seatFD, struct timeval *sendTime )
@@ -249,7 +552,7 @@ static int sendPlayerMessage( const Game *game, const MatchState *state,
 	     sendTime->tv_sec, sendTime->tv_usec, line );
   }
 
-  return 0;
+  return c;
 }
 
 /* returns >= 0 if action/size has been set to a valid action
@@ -261,10 +564,12 @@ static int readPlayerResponse( const Game *game,
 			       const struct timeval *sendTime,
 			       ErrorInfo *errorInfo,
 			       ReadBuf *readBuf,
+			       MatchStats *stats,
 			       Action *action,
 			       struct timeval *recvTime )
 {
   int c, r;
+  ssize_t len;
   MatchState tempState;
   char line[ MAX_LINE_LEN ];
 
@@ -273,8 +578,8 @@ static int readPlayerResponse( const Game *game,
     /* read a line of input from player */
     struct timeval start;
     gettimeofday( &start, NULL );
-    if( getLine( readBuf, MAX_LINE_LEN, line,
-		 errorInfo->maxResponseMicros ) <= 0 ) {
+    len = getLine( readBuf, MAX_LINE_LEN, line, errorInfo->maxResponseMicros );
+    if( len <= 0 ) {
       /* couldn't get any input from player */
 
       struct timeval after;
@@ -295,6 +600,10 @@ static int readPlayerResponse( const Game *game,
 
     /* note when the message arrived */
     gettimeofday( recvTime, NULL );
+    if( stats != NULL ) {
+
+      stats->bytesReceived[ seat ] += len;
+    }
 
     /* log the response */
     if( !quiet ) {
@@ -368,10 +677,21 @@ static int readPlayerResponse( const Game *game,
   return 0;
 }
 
+static void dealHand( const Game *game, DealerRng *rng, State *state )
+{
+  if( rng->counterDeals ) {
+
+    dealCardsForHand( game, rng->seed, state );
+  } else {
+
+    dealCards( game, &rng->rng, state );
+  }
+}
+
 /* returns >= 0 if match should continue, -1 for failure */
 static int setUpNewHand( const Game *game, const uint8_t fixedSeats,
 			 uint32_t *handId, uint8_t *player0Seat,
-			 rng_state_t *rng, ErrorInfo *errorInfo, State *state )
+			 DealerRng *rng, ErrorInfo *errorInfo, State *state )
 {
   ++( *handId );
 
@@ -387,7 +707,7 @@ static int setUpNewHand( const Game *game, const uint8_t fixedSeats,
     return -1;
   }
   initState( game, *handId, state );
-  dealCards( game, rng, state );
+  dealHand( game, rng, state );
 
   return 0;
 }
@@ -395,7 +715,7 @@ static int setUpNewHand( const Game *game, const uint8_t fixedSeats,
 /* returns >= 0 if match should continue, -1 for failure */
 static int processTransactionFile( const Game *game, const int fixedSeats,
 				   uint32_t *handId, uint8_t *player0Seat,
-				   rng_state_t *rng, ErrorInfo *errorInfo,
+				   DealerRng *rng, ErrorInfo *errorInfo,
 				   double totalValue[ MAX_PLAYERS ],
 				   MatchState *state, FILE *file )
 {
@@ -478,6 +798,182 @@ static int processTransactionFile( const Game *game, const int fixedSeats,
   return 0;
 }
 
+/* returns >= 0 on success, -1 on failure */
+static int initCheckpoint( const char *matchName, const uint32_t intervalHands,
+			   Checkpoint *ckpt )
+{
+  size_t len;
+
+  len = strlen( matchName ) + 16;
+  ckpt->fileName = (char *)malloc( len );
+  ckpt->tempFileName = (char *)malloc( len );
+  if( ckpt->fileName == NULL || ckpt->tempFileName == NULL ) {
+
+    return -1;
+  }
+  snprintf( ckpt->fileName, len, "%s.ckpt", matchName );
+  snprintf( ckpt->tempFileName, len, "%s.ckpt.tmp", matchName );
+  ckpt->intervalHands = intervalHands;
+
+  return 0;
+}
+
+/* save the state at the end of hand handId, along with the current
+   length of the transaction file.  The file is written under a temporary
+   name and renamed, so there is always a complete checkpoint on disk
+   returns >= 0 if match should continue, -1 on failure */
+static int writeCheckpoint( const Game *game, const Checkpoint *ckpt,
+			    const uint32_t handId, const uint8_t player0Seat,
+			    const DealerRng *rng, const ErrorInfo *errorInfo,
+			    const double totalValue[ MAX_PLAYERS ],
+			    FILE *transactionFile )
+{
+  int i;
+  uint8_t s;
+  long offset;
+  FILE *file;
+
+  offset = ftell( transactionFile );
+  if( offset < 0 ) {
+
+    fprintf( stderr, "ERROR: could not get transaction file position\n" );
+    return -1;
+  }
+
+  file = fopen( ckpt->tempFileName, "w" );
+  if( file == NULL ) {
+
+    fprintf( stderr, "ERROR: could not open checkpoint file %s\n",
+	     ckpt->tempFileName );
+    return -1;
+  }
+
+  fprintf( file, "CHECKPOINT 1\n" );
+  fprintf( file, "seed %"PRIu32" %d\n", rng->seed, rng->counterDeals );
+  fprintf( file, "hand %"PRIu32" %"PRIu8" %ld\n", handId, player0Seat, offset );
+  for( s = 0; s < game->numPlayers; ++s ) {
+
+    /* %a keeps every bit of the value */
+    fprintf( file, "seat %a %"PRIu32" %"PRIu64"\n", totalValue[ s ],
+	     errorInfo->numInvalidActions[ s ],
+	     errorInfo->usedMatchMicros[ s ] );
+  }
+  fprintf( file, "rng %d", rng->rng.mti );
+  for( i = 0; i < RNG_N; ++i ) {
+
+    fprintf( file, i % 8 ? " %08"PRIx32 : "\n%08"PRIx32, rng->rng.mt[ i ] );
+  }
+  fprintf( file, "\n" );
+
+  if( fclose( file ) != 0 ) {
+
+    fprintf( stderr, "ERROR: could not write checkpoint file %s\n",
+	     ckpt->tempFileName );
+    return -1;
+  }
+  if( rename( ckpt->tempFileName, ckpt->fileName ) < 0 ) {
+
+    fprintf( stderr, "ERROR: could not replace checkpoint file %s\n",
+	     ckpt->fileName );
+    return -1;
+  }
+
+  return 0;
+}
+
+/* load the state at the end of the checkpointed hand, and move the
+   transaction file to the first transaction after it
+   returns 1 if the checkpoint was loaded, 0 if there is no checkpoint,
+   or -1 on failure */
+static int readCheckpoint( const Game *game, const Checkpoint *ckpt,
+			   uint32_t *handId, uint8_t *player0Seat,
+			   DealerRng *rng, ErrorInfo *errorInfo,
+			   double totalValue[ MAX_PLAYERS ],
+			   FILE *transactionFile )
+{
+  int i, version, counterDeals;
+  uint8_t s;
+  uint32_t seed;
+  long offset;
+  FILE *file;
+
+  file = fopen( ckpt->fileName, "r" );
+  if( file == NULL ) {
+
+    return 0;
+  }
+
+  if( fscanf( file, " CHECKPOINT %d", &version ) < 1 || version != 1
+      || fscanf( file, " seed %"SCNu32" %d", &seed, &counterDeals ) < 2
+      || fscanf( file, " hand %"SCNu32" %"SCNu8" %ld",
+		 handId, player0Seat, &offset ) < 3 ) {
+
+    fprintf( stderr, "ERROR: could not read checkpoint file %s\n",
+	     ckpt->fileName );
+    fclose( file );
+    return -1;
+  }
+  if( seed != rng->seed || counterDeals != rng->counterDeals ) {
+
+    fprintf( stderr, "ERROR: checkpoint file %s is for a different seed\n",
+	     ckpt->fileName );
+    fclose( file );
+    return -1;
+  }
+  for( s = 0; s < game->numPlayers; ++s ) {
+
+    if( fscanf( file, " seat %la %"SCNu32" %"SCNu64, &totalValue[ s ],
+		&errorInfo->numInvalidActions[ s ],
+		&errorInfo->usedMatchMicros[ s ] ) < 3 ) {
+
+      fprintf( stderr, "ERROR: could not read seat %"PRIu8" from checkpoint\n",
+	       s + 1 );
+      fclose( file );
+      return -1;
+    }
+  }
+  if( fscanf( file, " rng %d", &rng->rng.mti ) < 1 ) {
+
+    fprintf( stderr, "ERROR: could not read rng from checkpoint\n" );
+    fclose( file );
+    return -1;
+  }
+  for( i = 0; i < RNG_N; ++i ) {
+
+    if( fscanf( file, " %"SCNx32, &rng->rng.mt[ i ] ) < 1 ) {
+
+      fprintf( stderr, "ERROR: could not read rng from checkpoint\n" );
+      fclose( file );
+      return -1;
+    }
+  }
+  fclose( file );
+
+  /* fseek happily moves past the end of the file, so check the file
+     still holds everything up to the end of the checkpointed hand, which
+     ends with a complete transaction line */
+  if( offset < 0 || fseek( transactionFile, 0, SEEK_END ) < 0 ) {
+
+    fprintf( stderr, "ERROR: could not check transaction file length\n" );
+    return -1;
+  }
+  if( ftell( transactionFile ) < offset
+      || ( offset > 0
+	   && ( fseek( transactionFile, offset - 1, SEEK_SET ) < 0
+		|| fgetc( transactionFile ) != '\n' ) ) ) {
+
+    fprintf( stderr, "ERROR: transaction file is shorter than checkpoint\n" );
+    return -1;
+  }
+  if( fseek( transactionFile, offset, SEEK_SET ) < 0 ) {
+
+    fprintf( stderr, "ERROR: could not seek in transaction file\n" );
+    return -1;
+  }
+
+  return 1;
+}
+
 /* returns >= 0 if match should continue, -1 on failure */
 static int logTransaction( const Game *game, const State *state,
 			   const Action *action,
@@ -506,7 +1002,7 @@ static int logTransaction( const Game *game, const State *state,
   }
   c += r;
 
-  if( fwrite( line, 1, c, file ) != c ) {
+  if( fwrite( line, 1, c, file ) != (size_t)c ) {
 
     fprintf( stderr, "ERROR: could not write to transaction file\n" );
     return -1;
@@ -715,14 +1211,20 @@ static int printFinalMessage( const Game *game, char *seatName[ MAX_PLAYERS ],
    the stream when gameLoop is called, it will be processed to
    initialise the state
 
+   if stats is not NULL, response times and traffic are recorded in it
+   and the stats file is rewritten whenever stats->intervalMicros have
+   passed since it was last written
+
    returns >=0 if the match finished correctly, -1 on error */
 static int gameLoop( const Game *game, char *seatName[ MAX_PLAYERS ],
 		     const uint32_t numHands, const int quiet,
-		     const int fixedSeats, rng_state_t *rng,
+		     const int fixedSeats, DealerRng *rng,
 		     ErrorInfo *errorInfo, const int seatFD[ MAX_PLAYERS ],
 		     ReadBuf *readBuf[ MAX_PLAYERS ],
-		     FILE *logFile, FILE *transactionFile )
+		     FILE *logFile, FILE *transactionFile,
+		     const Checkpoint *ckpt, MatchStats *stats )
 {
+  int c;
   uint32_t handId;
   uint8_t seat, p, player0Seat, currentP, currentSeat;
   struct timeval t, sendTime, recvTime;
@@ -754,7 +1256,7 @@ static int gameLoop( const Game *game, char *seatName[ MAX_PLAYERS ],
     return -1;
   }
   initState( game, handId, &state.state );
-  dealCards( game, rng, &state.state );
+  dealHand( game, rng, &state.state );
   for( seat = 0; seat < game->numPlayers; ++seat ) {
     totalValue[ seat ] = 0.0;
   }
@@ -762,9 +1264,26 @@ static int gameLoop( const Game *game, char *seatName[ MAX_PLAYERS ],
   /* seat 0 is player 0 in first game */
   player0Seat = 0;
 
-  /* process the transaction file */
+  /* process the transaction file, starting after the last checkpoint */
   if( transactionFile != NULL ) {
 
+    if( ckpt != NULL ) {
+
+      c = readCheckpoint( game, ckpt, &handId, &player0Seat, rng,
+			  errorInfo, totalValue, transactionFile );
+      if( c < 0 ) {
+	/* error messages already handled in function */
+
+	return -1;
+      }
+      if( c > 0 && setUpNewHand( game, fixedSeats, &handId, &player0Seat,
+				 rng, errorInfo, &state.state ) < 0 ) {
+	/* error messages already handled in function */
+
+	return -1;
+      }
+    }
+
     if( processTransactionFile( game, fixedSeats, &handId, &player0Seat,
 				rng, errorInfo, totalValue,
 				&state, transactionFile ) < 0 ) {
@@ -791,12 +1310,16 @@ static int gameLoop( const Game *game, char *seatName[ MAX_PLAYERS ],
       for( seat = 0; seat < game->numPlayers; ++seat ) {
 
 	state.viewingPlayer = seatToPlayer( game, player0Seat, seat );
-	if( sendPlayerMessage( game, &state, quiet, seat,
-			       seatFD[ seat ], &t ) < 0 ) {
+	c = sendPlayerMessage( game, &state, quiet, seat, seatFD[ seat ], &t );
+	if( c < 0 ) {
 	  /* error messages already handled in function */
 
 	  return -1;
 	}
+	if( stats != NULL ) {
+
+	  stats->bytesSent[ seat ] += c;
+	}
 
 	/* remember the seat and send time if player is acting */
 	if( state.viewingPlayer == currentP ) {
@@ -809,12 +1332,17 @@ static int gameLoop( const Game *game, char *seatName[ MAX_PLAYERS ],
       state.viewingPlayer = currentP;
       currentSeat = playerToSeat( game, player0Seat, currentP );
       if( readPlayerResponse( game, &state, quiet, currentSeat, &sendTime,
-			      errorInfo, readBuf[ currentSeat ],
+			      errorInfo, readBuf[ currentSeat ], stats,
 			      &action, &recvTime ) < 0 ) {
 	/* error messages already handled in function */
 
 	return -1;
       }
+      if( stats != NULL ) {
+
+	recordResponse( currentSeat, state.state.round, &action,
+			&sendTime, &recvTime, stats );
+      }
 
       /* log the transaction */
       if( transactionFile != NULL ) {
@@ -853,8 +1381,36 @@ static int gameLoop( const Game *game, char *seatName[ MAX_PLAYERS ],
     for( seat = 0; seat < game->numPlayers; ++seat ) {
 
       state.viewingPlayer = seatToPlayer( game, player0Seat, seat );
-      if( sendPlayerMessage( game, &state, quiet, seat,
-			     seatFD[ seat ], &t ) < 0 ) {
+      c = sendPlayerMessage( game, &state, quiet, seat, seatFD[ seat ], &t );
+      if( c < 0 ) {
+	/* error messages already handled in function */
+
+	return -1;
+      }
+      if( stats != NULL ) {
+
+	stats->bytesSent[ seat ] += c;
+      }
+    }
+
+    /* update the stats file */
+    if( stats != NULL ) {
+
+      ++stats->handsPlayed;
+      gettimeofday( &t, NULL );
+      if( microsBetween( &stats->lastWriteTime, &t ) >= stats->intervalMicros
+	  && writeStatsFile( game, seatName, handId, errorInfo, stats ) < 0 ) {
+	/* error messages already handled in function */
+
+	return -1;
+      }
+    }
+
+    /* save a checkpoint */
+    if( ckpt != NULL && ( handId + 1 ) % ckpt->intervalHands == 0 ) {
+
+      if( writeCheckpoint( game, ckpt, handId, player0Seat, rng, errorInfo,
+			   totalValue, transactionFile ) < 0 ) {
 	/* error messages already handled in function */
 
 	return -1;
@@ -884,6 +1440,15 @@ static int gameLoop( const Game *game, char *seatName[ MAX_PLAYERS ],
   }
 
  finishedGameLoop:
+  if( stats != NULL ) {
+
+    if( writeStatsFile( game, seatName, handId, errorInfo, stats ) < 0 ) {
+      /* error messages already handled in function */
+
+      return -1;
+    }
+  }
+
   /* print out the final values */
   if( !quiet ) {
     gettimeofday( &t, NULL );
@@ -907,8 +1472,13 @@ int main( int argc, char **argv )
   FILE *file, *logFile, *transactionFile;
   ReadBuf *readBuf[ MAX_PLAYERS ];
   Game *game;
-  rng_state_t rng;
+  DealerRng rng;
   ErrorInfo errorInfo;
+  MatchStats *stats;
+  Checkpoint ckpt;
+  uint32_t checkpointHands;
+  const char *statsFileName;
+  uint64_t statsIntervalMicros;
   struct sockaddr_in addr;
   socklen_t addrLen;
   char *seatName[ MAX_PLAYERS ];
@@ -927,6 +1497,9 @@ int main( int argc, char **argv )
     { "t_hand", 1, 0, 0 },
     { "t_per_hand", 1, 0, 0 },
     { "start_timeout", 1, 0, 0 },
+    { "stats_file", 1, 0, 0 },
+    { "stats_interval", 1, 0, 0 },
+    { "checkpoint", 1, 0, 0 },
     { 0, 0, 0, 0 }
   };
 
@@ -960,10 +1533,20 @@ int main( int argc, char **argv )
   /* no timeout on startup */
   startTimeoutMicros = -1;
 
+  /* deal from the rng stream */
+  rng.counterDeals = 0;
+
+  /* no stats file */
+  statsFileName = NULL;
+  statsIntervalMicros = DEFAULT_STATS_INTERVAL_MICROS;
+
+  /* no checkpoints */
+  checkpointHands = 0;
+
   /* parse options */
   while( 1 ) {
 
-    i = getopt_long( argc, argv, "flLp:qtTa", longOptions, &longOpt );
+    i = getopt_long( argc, argv, "flLp:qtTac", longOptions, &longOpt );
     if( i < 0 ) {
 
       break;
@@ -1032,6 +1615,37 @@ int main( int argc, char **argv )
 	}
 	break;
 
+      case 4:
+	/* stats_file */
+
+	statsFileName = optarg;
+	break;
+
+      case 5:
+	/* stats_interval */
+
+	if( sscanf( optarg, "%"SCNu64, &statsIntervalMicros ) < 1 ) {
+
+	  fprintf( stderr, "ERROR: could not get stats interval from %s\n",
+		   optarg );
+	  exit( EXIT_FAILURE );
+	}
+
+	/* convert from milliseconds to microseconds */
+	statsIntervalMicros *= 1000;
+	break;
+
+      case 6:
+	/* checkpoint */
+
+	if( sscanf( optarg, "%"SCNu32, &checkpointHands ) < 1
+	    || checkpointHands == 0 ) {
+
+	  fprintf( stderr, "ERROR: could not get checkpoint interval from %s\n",
+		   optarg );
+	  exit( EXIT_FAILURE );
+	}
+	break;
       }
       break;
 
@@ -1086,6 +1700,12 @@ int main( int argc, char **argv )
       append = 1;
       break;
 
+    case 'c':
+      /* deal hands from the counter-based generator */
+
+      rng.counterDeals = 1;
+      break;
+
     default:
 
       fprintf( stderr, "ERROR: unknown option %c\n", i );
@@ -1142,7 +1762,8 @@ int main( int argc, char **argv )
 	     argv[ optind + 3 ] );
     exit( EXIT_FAILURE );
   }
-  init_genrand( &rng, seed );
+  rng.seed = seed;
+  init_genrand( &rng.rng, seed );
   srandom( seed ); /* used for random port selection */
 
   if( useLogFile ) {
@@ -1192,10 +1813,48 @@ int main( int argc, char **argv )
     transactionFile = NULL;
   }
 
+  /* set up checkpoints, which are only useful with a transaction file */
+  if( checkpointHands ) {
+
+    if( transactionFile == NULL ) {
+
+      fprintf( stderr, "ERROR: --checkpoint needs the transaction file (-T)\n" );
+      exit( EXIT_FAILURE );
+    }
+    if( initCheckpoint( argv[ optind ], checkpointHands, &ckpt ) < 0 ) {
+
+      fprintf( stderr, "ERROR: could not set up checkpoint file\n" );
+      exit( EXIT_FAILURE );
+    }
+    if( !append ) {
+      /* the transaction file was just emptied, so an old checkpoint
+	 no longer matches it */
+
+      unlink( ckpt.fileName );
+    }
+  }
+
   /* set up the error info */
   initErrorInfo( maxInvalidActions, maxResponseMicros, maxUsedHandMicros,
 		 maxUsedPerHandMicros * numHands, &errorInfo );
 
+  /* set up the match statistics */
+  if( statsFileName != NULL ) {
+
+    stats = (MatchStats *)malloc( sizeof( MatchStats ) );
+    if( stats == NULL
+	|| initMatchStats( statsFileName, argv[ optind ],
+			   statsIntervalMicros, stats ) < 0 ) {
+
+      fprintf( stderr, "ERROR: could not set up stats file %s\n",
+	       statsFileName );
+      exit( EXIT_FAILURE );
+    }
+  } else {
+
+    stats = NULL;
+  }
+
   /* open sockets for players to connect to */
   for( i = 0; i < game->numPlayers; ++i ) {
 
@@ -1225,12 +1884,12 @@ int main( int argc, char **argv )
   for( i = 0; i < game->numPlayers; ++i ) {
 
     if( startTimeoutMicros >= 0 ) {
-      uint64_t startTimeLeft;
+      int64_t startTimeLeft;
       fd_set fds;
 
       gettimeofday( &tv, NULL );
       startTimeLeft = startTimeoutMicros
-	- (uint64_t)( tv.tv_sec - startTime.tv_sec ) * 1000000
+	- (int64_t)( tv.tv_sec - startTime.tv_sec ) * 1000000
 	- ( tv.tv_usec - startTime.tv_usec );
       if( startTimeLeft < 0 ) {
 
@@ -1269,7 +1928,8 @@ int main( int argc, char **argv )
 
   /* play the match */
   if( gameLoop( game, seatName, numHands, quiet, fixedSeats, &rng, &errorInfo,
-		seatFD, readBuf, logFile, transactionFile ) < 0 ) {
+		seatFD, readBuf, logFile, transactionFile,
+		checkpointHands ? &ckpt : NULL, stats ) < 0 ) {
     /* should have already printed an error message */
 
     exit( EXIT_FAILURE );
@@ -1283,6 +1943,14 @@ int main( int argc, char **argv )
   if( logFile != NULL ) {
     fclose( logFile );
   }
+  if( stats != NULL ) {
+    free( stats->tempFileName );
+    free( stats );
+  }
+  if( checkpointHands ) {
+    free( ckpt.fileName );
+    free( ckpt.tempFileName );
+  }
   free( game );
 
   return EXIT_SUCCESS;
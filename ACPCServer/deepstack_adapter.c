@@ -0,0 +1,165 @@
+/*
+Copyright (C) 2011 by the Computer Poker Research Group, University of Alberta
+*/
+
+/* connects a seat at the dealer to a running DeepStack solver daemon
+   (Source/Player/solver_daemon.lua) so the seat does not have to start
+   its own copy of DeepStack
+
+   every line from the dealer is sent to the daemon over its Unix-domain
+   socket, and the daemon answers each one with a single line: either the
+   action to send back to the dealer, or an empty line if there is nothing
+   to send */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "game.h"
+#include "net.h"
+
+#define DEFAULT_SOCKET_PATH "/tmp/deepstack_solver.sock"
+
+
+/* open a connection to the solver daemon
+   returns file descriptor on success, -1 on failure */
+static int connectToSolver( const char *path )
+{
+  int sock;
+  struct sockaddr_un addr;
+
+  if( strlen( path ) >= sizeof( addr.sun_path ) ) {
+
+    fprintf( stderr, "ERROR: solver socket path too long %s\n", path );
+    return -1;
+  }
+
+  sock = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if( sock < 0 ) {
+
+    fprintf( stderr, "ERROR: could not open socket\n" );
+    return -1;
+  }
+
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sun_family = AF_UNIX;
+  strcpy( addr.sun_path, path );
+  if( connect( sock, (struct sockaddr *)&addr, sizeof( addr ) ) < 0 ) {
+
+    fprintf( stderr, "ERROR: could not connect to solver at %s\n", path );
+    close( sock );
+    return -1;
+  }
+
+  return sock;
+}
+
+/* remove any trailing carriage return and newline from a line */
+static void chompLine( char *line )
+{
+  size_t len;
+
+  len = strlen( line );
+  while( len > 0 && ( line[ len - 1 ] == '\n' || line[ len - 1 ] == '\r' ) ) {
+
+    --len;
+  }
+  line[ len ] = 0;
+}
+
+int main( int argc, char **argv )
+{
+  int sock, solverSock;
+  FILE *toServer, *fromServer, *toSolver, *fromSolver;
+  const char *socketPath;
+  char line[ MAX_LINE_LEN ];
+  char reply[ MAX_LINE_LEN ];
+
+  if( argc < 3 || argc > 4 ) {
+
+    fprintf( stderr, "usage: deepstack_adapter server port [solver_socket]\n" );
+    exit( EXIT_FAILURE );
+  }
+  socketPath = argc > 3 ? argv[ 3 ] : DEFAULT_SOCKET_PATH;
+
+  /* connect to the solver first, so a missing daemon is noticed
+     before taking a seat at the dealer */
+  solverSock = connectToSolver( socketPath );
+  if( solverSock < 0 ) {
+
+    exit( EXIT_FAILURE );
+  }
+  toSolver = fdopen( solverSock, "w" );
+  fromSolver = fdopen( dup( solverSock ), "r" );
+  if( toSolver == NULL || fromSolver == NULL ) {
+
+    fprintf( stderr, "ERROR: could not get solver streams\n" );
+    exit( EXIT_FAILURE );
+  }
+
+  /* connect to the dealer */
+  sock = connectTo( argv[ 1 ], atoi( argv[ 2 ] ) );
+  if( sock < 0 ) {
+
+    exit( EXIT_FAILURE );
+  }
+  toServer = fdopen( sock, "w" );
+  fromServer = fdopen( dup( sock ), "r" );
+  if( toServer == NULL || fromServer == NULL ) {
+
+    fprintf( stderr, "ERROR: could not get socket streams\n" );
+    exit( EXIT_FAILURE );
+  }
+
+  /* send version string to dealer */
+  if( fprintf( toServer, "VERSION:%"PRIu32".%"PRIu32".%"PRIu32"\n",
+	       VERSION_MAJOR, VERSION_MINOR, VERSION_REVISION ) != 14 ) {
+
+    fprintf( stderr, "ERROR: could not get send version to server\n" );
+    exit( EXIT_FAILURE );
+  }
+  fflush( toServer );
+
+  /* pass messages through until the dealer closes the connection */
+  while( fgets( line, MAX_LINE_LEN, fromServer ) ) {
+
+    /* ignore comments */
+    if( line[ 0 ] == '#' || line[ 0 ] == ';' ) {
+      continue;
+    }
+
+    chompLine( line );
+    if( fprintf( toSolver, "%s\n", line ) < 0 || fflush( toSolver ) != 0 ) {
+
+      fprintf( stderr, "ERROR: could not send state to solver\n" );
+      exit( EXIT_FAILURE );
+    }
+
+    if( fgets( reply, MAX_LINE_LEN, fromSolver ) == NULL ) {
+
+      fprintf( stderr, "ERROR: solver closed the connection\n" );
+      exit( EXIT_FAILURE );
+    }
+    chompLine( reply );
+    if( reply[ 0 ] == 0 ) {
+      /* we're not acting */
+
+      continue;
+    }
+
+    if( fprintf( toServer, "%s\r\n", reply ) < 0 || fflush( toServer ) != 0 ) {
+
+      fprintf( stderr, "ERROR: could not send response to server\n" );
+      exit( EXIT_FAILURE );
+    }
+  }
+
+  fclose( toSolver );
+  fclose( fromSolver );
+  fclose( toServer );
+  fclose( fromServer );
+
+  return EXIT_SUCCESS;
+}
@@ -17,68 +17,33 @@ Copyright (C) 2011 by the Computer Poker Research Group, University of Alberta
 #include "rng.h"
 #include "net.h"
 
-int main( int argc, char **argv )
+/* control pipes when running as a bm_server pooled bot */
+#define POOL_CMD_FD 3
+#define POOL_REPLY_FD 4
+
+
+/* connect to a dealer and play out the match
+   returns 0 on success, -1 on failure */
+int playMatch( const Game *game, rng_state_t *rng, const double *probs,
+	       char *server, const uint16_t port )
 {
   int sock, len, r, a;
   int32_t min, max;
-  uint16_t port;
   double p;
-  Game *game;
   MatchState state;
   Action action;
-  FILE *file, *toServer, *fromServer;
-  struct timeval tv;
-  double probs[ NUM_ACTION_TYPES ];
+  FILE *toServer, *fromServer;
   double actionProbs[ NUM_ACTION_TYPES ];
-  rng_state_t rng;
   char line[ MAX_LINE_LEN ];
 
-  /* we make some assumptions about the actions - check them here */
-  assert( NUM_ACTION_TYPES == 3 );
-
-  if( argc < 4 ) {
-
-    fprintf( stderr, "usage: player game server port\n" );
-    exit( EXIT_FAILURE );
-  }
-
-  /* Define the probabilities of actions for the player */
-  probs[ a_fold ] = 0.06;
-  probs[ a_call ] = ( 1.0 - probs[ a_fold ] ) * 0.5;
-  probs[ a_raise ] = ( 1.0 - probs[ a_fold ] ) * 0.5;
-
-  /* Initialize the player's random number state using time */
-  gettimeofday( &tv, NULL );
-  init_genrand( &rng, tv.tv_usec );
-
-  /* get the game */
-  file = fopen( argv[ 1 ], "r" );
-  if( file == NULL ) {
-
-    fprintf( stderr, "ERROR: could not open game %s\n", argv[ 1 ] );
-    exit( EXIT_FAILURE );
-  }
-  game = readGame( file );
-  if( game == NULL ) {
-
-    fprintf( stderr, "ERROR: could not read game %s\n", argv[ 1 ] );
-    exit( EXIT_FAILURE );
-  }
-  fclose( file );
-
   /* connect to the dealer */
-  if( sscanf( argv[ 3 ], "%"SCNu16, &port ) < 1 ) {
-
-    fprintf( stderr, "ERROR: invalid port %s\n", argv[ 3 ] );
-    exit( EXIT_FAILURE );
-  }
-  sock = connectTo( argv[ 2 ], port );
+  sock = connectTo( server, port );
   if( sock < 0 ) {
 
-    exit( EXIT_FAILURE );
+    return -1;
   }
   toServer = fdopen( sock, "w" );
-  fromServer = fdopen( sock, "r" );
+  fromServer = fdopen( dup( sock ), "r" );
   if( toServer == NULL || fromServer == NULL ) {
 
     fprintf( stderr, "ERROR: could not get socket streams\n" );
@@ -90,7 +55,9 @@ int main( int argc, char **argv )
 	       VERSION_MAJOR, VERSION_MINOR, VERSION_REVISION ) != 14 ) {
 
     fprintf( stderr, "ERROR: could not get send version to server\n" );
-    exit( EXIT_FAILURE );
+    fclose( toServer );
+    fclose( fromServer );
+    return -1;
   }
   fflush( toServer );
 
@@ -106,7 +73,7 @@ int main( int argc, char **argv )
     if( len < 0 ) {
 
       fprintf( stderr, "ERROR: could not read state %s", line );
-      exit( EXIT_FAILURE );
+      break;
     }
 
     if( stateFinished( &state.state ) ) {
@@ -162,7 +129,7 @@ int main( int argc, char **argv )
     }
 
     /* choose one of the valid actions at random */
-    p = genrand_real2( &rng );
+    p = genrand_real2( rng );
     for( a = 0; a < NUM_ACTION_TYPES - 1; ++a ) {
 
       if( p <= actionProbs[ a ] ) {
@@ -174,7 +141,7 @@ int main( int argc, char **argv )
     action.type = (enum ActionType)a;
     if( a == a_raise ) {
 
-      action.size = min + genrand_int32( &rng ) % ( max - min + 1 );
+      action.size = min + genrand_uniform( rng, max - min + 1 );
     }
 
     /* do the action! */
@@ -219,10 +186,104 @@ int main( int argc, char **argv )
     if( fwrite( line, 1, len, toServer ) != len ) {
 
       fprintf( stderr, "ERROR: could not get send response to server\n" );
-      exit( EXIT_FAILURE );
+      break;
     }
     fflush( toServer );
   }
 
+
+  fclose( toServer );
+  fclose( fromServer );
+  return 0;
+}
+
+int main( int argc, char **argv )
+{
+  uint16_t port;
+  Game *game;
+  FILE *file;
+  struct timeval tv;
+  double probs[ NUM_ACTION_TYPES ];
+  rng_state_t rng;
+
+  /* we make some assumptions about the actions - check them here */
+  assert( NUM_ACTION_TYPES == 3 );
+
+  if( argc < 4 ) {
+
+    fprintf( stderr, "usage: player game server port\n" );
+    fprintf( stderr, "       player game server pool [position]\n" );
+    exit( EXIT_FAILURE );
+  }
+
+  /* Define the probabilities of actions for the player */
+  probs[ a_fold ] = 0.06;
+  probs[ a_call ] = ( 1.0 - probs[ a_fold ] ) * 0.5;
+  probs[ a_raise ] = ( 1.0 - probs[ a_fold ] ) * 0.5;
+
+  /* Initialize the player's random number state using time */
+  gettimeofday( &tv, NULL );
+  init_genrand( &rng, tv.tv_usec );
+
+  /* get the game */
+  file = fopen( argv[ 1 ], "r" );
+  if( file == NULL ) {
+
+    fprintf( stderr, "ERROR: could not open game %s\n", argv[ 1 ] );
+    exit( EXIT_FAILURE );
+  }
+  game = readGame( file );
+  if( game == NULL ) {
+
+    fprintf( stderr, "ERROR: could not read game %s\n", argv[ 1 ] );
+    exit( EXIT_FAILURE );
+  }
+  fclose( file );
+
+  if( !strcmp( argv[ 3 ], "pool" ) ) {
+    /* pooled bot for bm_server: wait for matches on the control pipe */
+    FILE *commands, *replies;
+    char line[ MAX_LINE_LEN ], server[ MAX_LINE_LEN ];
+
+    commands = fdopen( POOL_CMD_FD, "r" );
+    replies = fdopen( POOL_REPLY_FD, "w" );
+    if( commands == NULL || replies == NULL ) {
+
+      fprintf( stderr, "ERROR: could not open pool control pipes\n" );
+      exit( EXIT_FAILURE );
+    }
+
+    do {
+
+      fprintf( replies, "READY\n" );
+      fflush( replies );
+
+      if( fgets( line, MAX_LINE_LEN, commands ) == NULL
+	  || !strncmp( line, "QUIT", 4 ) ) {
+	break;
+      }
+      if( sscanf( line, "RUN %s %"SCNu16, server, &port ) < 2 ) {
+
+	fprintf( stderr, "ERROR: bad pool command %s", line );
+	continue;
+      }
+
+      playMatch( game, &rng, probs, server, port );
+    } while( 1 );
+
+    return EXIT_SUCCESS;
+  }
+
+  /* connect to the dealer */
+  if( sscanf( argv[ 3 ], "%"SCNu16, &port ) < 1 ) {
+
+    fprintf( stderr, "ERROR: invalid port %s\n", argv[ 3 ] );
+    exit( EXIT_FAILURE );
+  }
+  if( playMatch( game, &rng, probs, argv[ 2 ], port ) < 0 ) {
+
+    exit( EXIT_FAILURE );
+  }
+
   return EXIT_SUCCESS;
 }
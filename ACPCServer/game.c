@@ -641,22 +641,26 @@ void initState( const Game *game, const uint32_t handId, State *state )
   state->finished = 0;
 }
 
-static uint8_t dealCard( rng_state_t *rng, uint8_t *deck, const int numCards )
+/* take a card out of the deck using the random number r
+   keeps the modulo so that seeds give the same cards as always */
+static uint8_t dealCard( const uint32_t r, uint8_t *deck, const int numCards )
 {
   int i;
   uint8_t ret;
 
-  i = genrand_int32( rng ) % numCards;
+  i = r % numCards;
   ret = deck[ i ];
   deck[ i ] = deck[ numCards - 1 ];
 
   return ret;
 }
 
-void dealCards( const Game *game, rng_state_t *rng, State *state )
+/* fill deck with the cards used in game
+   returns the number of cards in the deck */
+static int initDeck( const Game *game, uint8_t *deck )
 {
-  int r, s, numCards, i, p;
-  uint8_t deck[ MAX_RANKS * MAX_SUITS ];
+  int r, s;
+  uint8_t numCards;
 
   numCards = 0;
   for( s = MAX_SUITS - game->numSuits; s < MAX_SUITS; ++s ) {
@@ -668,11 +672,70 @@ void dealCards( const Game *game, rng_state_t *rng, State *state )
     }
   }
 
+  return numCards;
+}
+
+void dealCards( const Game *game, rng_state_t *rng, State *state )
+{
+  int r, s, numCards, i, p, d;
+  uint8_t deck[ MAX_RANKS * MAX_SUITS ];
+  uint32_t draws[ MAX_PLAYERS * MAX_HOLE_CARDS + MAX_BOARD_CARDS ];
+
+  numCards = initDeck( game, deck );
+
+  /* get all the random numbers for the hand at once */
+  genrand_fill( rng, draws, game->numPlayers * game->numHoleCards
+		+ sumBoardCards( game, game->numRounds - 1 ) );
+  d = 0;
+
+  for( p = 0; p < game->numPlayers; ++p ) {
+
+    for( i = 0; i < game->numHoleCards; ++i ) {
+
+      state->holeCards[ p ][ i ] = dealCard( draws[ d++ ], deck, numCards );
+      --numCards;
+    }
+  }
+
+  s = 0;
+  for( r = 0; r < game->numRounds; ++r ) {
+
+    for( i = 0; i < game->numBoardCards[ r ]; ++i ) {
+
+      state->boardCards[ s ] = dealCard( draws[ d++ ], deck, numCards );
+      --numCards;
+      ++s;
+    }
+  }
+}
+
+static uint8_t dealCardCounter( crng_state_t *rng, uint8_t *deck,
+				const int numCards )
+{
+  int i;
+  uint8_t ret;
+
+  i = crng_uniform( rng, numCards );
+  ret = deck[ i ];
+  deck[ i ] = deck[ numCards - 1 ];
+
+  return ret;
+}
+
+void dealCardsForHand( const Game *game, const uint32_t seed, State *state )
+{
+  int r, s, numCards, i, p;
+  uint8_t deck[ MAX_RANKS * MAX_SUITS ];
+  crng_state_t rng;
+
+  init_crng( &rng, seed, state->handId );
+  numCards = initDeck( game, deck );
+
   for( p = 0; p < game->numPlayers; ++p ) {
 
     for( i = 0; i < game->numHoleCards; ++i ) {
 
-      state->holeCards[ p ][ i ] = dealCard( rng, deck, numCards );
+      state->holeCards[ p ][ i ] = dealCardCounter( &rng, deck, numCards );
       --numCards;
     }
   }
@@ -682,7 +745,7 @@ void dealCards( const Game *game, rng_state_t *rng, State *state )
 
     for( i = 0; i < game->numBoardCards[ r ]; ++i ) {
 
-      state->boardCards[ s ] = dealCard( rng, deck, numCards );
+      state->boardCards[ s ] = dealCardCounter( &rng, deck, numCards );
       --numCards;
       ++s;
     }
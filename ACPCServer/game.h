@@ -133,6 +133,11 @@ void initState( const Game *game, const uint32_t handId, State *state );
 /* shuffle a deck of cards and deal them out, writing the results to state */
 void dealCards( const Game *game, rng_state_t *rng, State *state );
 
+/* deal the cards for hand state->handId directly from ( seed, handId )
+   using the counter-based generator, so no earlier hands need to be
+   dealt first.  Cards are written to state */
+void dealCardsForHand( const Game *game, const uint32_t seed, State *state );
+
 int statesEqual( const Game *game, const State *a, const State *b );
 
 int matchStatesEqual( const Game *game, const MatchState *a,
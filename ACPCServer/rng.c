@@ -102,38 +102,272 @@ void init_by_array( rng_state_t *state, uint32_t init_key[], int key_length )
   state->mt[0]|= 0x80000000UL; /* MSB is 1; assuring non-zero initial array */ 
 }
 
+#if defined( __AVX2__ )
+#include <immintrin.h>
+#define RNG_SIMD_WIDTH 8
+#define simd_t __m256i
+#define simd_load( p ) _mm256_loadu_si256( (const __m256i *)( p ) )
+#define simd_store( p, v ) _mm256_storeu_si256( (__m256i *)( p ), v )
+#define simd_set1( x ) _mm256_set1_epi32( x )
+#define simd_and( a, b ) _mm256_and_si256( a, b )
+#define simd_or( a, b ) _mm256_or_si256( a, b )
+#define simd_xor( a, b ) _mm256_xor_si256( a, b )
+#define simd_srli( a, n ) _mm256_srli_epi32( a, n )
+#define simd_slli( a, n ) _mm256_slli_epi32( a, n )
+#define simd_cmpeq( a, b ) _mm256_cmpeq_epi32( a, b )
+#elif defined( __SSE2__ )
+#include <emmintrin.h>
+#define RNG_SIMD_WIDTH 4
+#define simd_t __m128i
+#define simd_load( p ) _mm_loadu_si128( (const __m128i *)( p ) )
+#define simd_store( p, v ) _mm_storeu_si128( (__m128i *)( p ), v )
+#define simd_set1( x ) _mm_set1_epi32( x )
+#define simd_and( a, b ) _mm_and_si128( a, b )
+#define simd_or( a, b ) _mm_or_si128( a, b )
+#define simd_xor( a, b ) _mm_xor_si128( a, b )
+#define simd_srli( a, n ) _mm_srli_epi32( a, n )
+#define simd_slli( a, n ) _mm_slli_epi32( a, n )
+#define simd_cmpeq( a, b ) _mm_cmpeq_epi32( a, b )
+#endif
+
+#define TEMPERING_MASK_B 0x9d2c5680UL
+#define TEMPERING_MASK_C 0xefc60000UL
+
+#ifdef RNG_SIMD_WIDTH
+/* compute mt[kk] for kk in [start,end) in RNG_SIMD_WIDTH words at a time
+   from mt[kk], mt[kk+1] and mt[kk+offset], returns the first kk not done
+   mt[kk+offset] must either be untouched or already computed for every
+   word in a vector, which holds for both halves of the block because
+   RNG_N-RNG_M and RNG_M are both much larger than RNG_SIMD_WIDTH */
+static int nextStateSIMD( uint32_t *mt, int start, const int end,
+			  const int offset )
+{
+  const simd_t upper = simd_set1( (int32_t)UPPER_MASK );
+  const simd_t lower = simd_set1( (int32_t)LOWER_MASK );
+  const simd_t one = simd_set1( 1 );
+  const simd_t matrixA = simd_set1( (int32_t)MATRIX_A );
+  simd_t y, mag;
+
+  for( ; start + RNG_SIMD_WIDTH <= end; start += RNG_SIMD_WIDTH ) {
+
+    y = simd_or( simd_and( simd_load( &mt[ start ] ), upper ),
+		 simd_and( simd_load( &mt[ start + 1 ] ), lower ) );
+    mag = simd_and( simd_cmpeq( simd_and( y, one ), one ), matrixA );
+    simd_store( &mt[ start ],
+		simd_xor( simd_xor( simd_load( &mt[ start + offset ] ),
+				    simd_srli( y, 1 ) ), mag ) );
+  }
+
+  return start;
+}
+#endif
+
+/* generate the next RNG_N words of the state at one time */
+static void nextState( rng_state_t *state )
+{
+  int kk;
+  uint32_t y;
+  static uint32_t mag01[2]={0x0UL, MATRIX_A};
+  /* mag01[x] = x * MATRIX_A  for x=0,1 */
+
+  kk = 0;
+#ifdef RNG_SIMD_WIDTH
+  kk = nextStateSIMD( state->mt, kk, RNG_N - RNG_M, RNG_M );
+#endif
+  for (;kk<RNG_N-RNG_M;kk++) {
+    y = (state->mt[kk]&UPPER_MASK)|(state->mt[kk+1]&LOWER_MASK);
+    state->mt[kk] = state->mt[kk+RNG_M] ^ (y >> 1) ^ mag01[y & 0x1UL];
+  }
+#ifdef RNG_SIMD_WIDTH
+  kk = nextStateSIMD( state->mt, kk, RNG_N - 1, RNG_M - RNG_N );
+#endif
+  for (;kk<RNG_N-1;kk++) {
+    y = (state->mt[kk]&UPPER_MASK)|(state->mt[kk+1]&LOWER_MASK);
+    state->mt[kk] =
+      state->mt[kk+(RNG_M-RNG_N)] ^ (y >> 1) ^ mag01[y & 0x1UL];
+  }
+  y = (state->mt[RNG_N-1]&UPPER_MASK)|(state->mt[0]&LOWER_MASK);
+  state->mt[RNG_N-1] = state->mt[RNG_M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
+
+  state->mti = 0;
+}
+
 /* generates a random number on [0,0xffffffff]-interval */
 uint32_t genrand_int32( rng_state_t *state )
 {
     uint32_t y;
-    static uint32_t mag01[2]={0x0UL, MATRIX_A};
-    /* mag01[x] = x * MATRIX_A  for x=0,1 */
 
     if (state->mti == RNG_N) { /* generate RNG_N words at one time */
-        int kk;
-
-        for (kk=0;kk<RNG_N-RNG_M;kk++) {
-            y = (state->mt[kk]&UPPER_MASK)|(state->mt[kk+1]&LOWER_MASK);
-            state->mt[kk] = state->mt[kk+RNG_M] ^ (y >> 1) ^ mag01[y & 0x1UL];
-        }
-        for (;kk<RNG_N-1;kk++) {
-            y = (state->mt[kk]&UPPER_MASK)|(state->mt[kk+1]&LOWER_MASK);
-            state->mt[kk] =
-	      state->mt[kk+(RNG_M-RNG_N)] ^ (y >> 1) ^ mag01[y & 0x1UL];
-        }
-        y = (state->mt[RNG_N-1]&UPPER_MASK)|(state->mt[0]&LOWER_MASK);
-        state->mt[RNG_N-1] = state->mt[RNG_M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
-
-        state->mti = 0;
+
+      nextState( state );
     }
   
     y = state->mt[state->mti++];
 
     /* Tempering */
     y ^= (y >> 11);
-    y ^= (y << 7) & 0x9d2c5680UL;
-    y ^= (y << 15) & 0xefc60000UL;
+    y ^= (y << 7) & TEMPERING_MASK_B;
+    y ^= (y << 15) & TEMPERING_MASK_C;
     y ^= (y >> 18);
 
     return y;
 }
+
+/* temper n words of the state into out */
+static void temperWords( const uint32_t *mt, uint32_t *out, const int n )
+{
+  int i;
+  uint32_t y;
+
+  i = 0;
+#ifdef RNG_SIMD_WIDTH
+  {
+    const simd_t maskB = simd_set1( (int32_t)TEMPERING_MASK_B );
+    const simd_t maskC = simd_set1( (int32_t)TEMPERING_MASK_C );
+    simd_t v;
+
+    for( ; i + RNG_SIMD_WIDTH <= n; i += RNG_SIMD_WIDTH ) {
+
+      v = simd_load( &mt[ i ] );
+      v = simd_xor( v, simd_srli( v, 11 ) );
+      v = simd_xor( v, simd_and( simd_slli( v, 7 ), maskB ) );
+      v = simd_xor( v, simd_and( simd_slli( v, 15 ), maskC ) );
+      v = simd_xor( v, simd_srli( v, 18 ) );
+      simd_store( &out[ i ], v );
+    }
+  }
+#endif
+  for( ; i < n; ++i ) {
+
+    y = mt[ i ];
+    y ^= (y >> 11);
+    y ^= (y << 7) & TEMPERING_MASK_B;
+    y ^= (y << 15) & TEMPERING_MASK_C;
+    y ^= (y >> 18);
+    out[ i ] = y;
+  }
+}
+
+void genrand_fill( rng_state_t *state, uint32_t *out, int n )
+{
+  int c;
+
+  while( n > 0 ) {
+
+    if( state->mti == RNG_N ) {
+
+      nextState( state );
+    }
+
+    /* temper as much of the current block as we need */
+    c = RNG_N - state->mti;
+    if( c > n ) {
+      c = n;
+    }
+    temperWords( &state->mt[ state->mti ], out, c );
+
+    state->mti += c;
+    out += c;
+    n -= c;
+  }
+}
+
+/* map a 32 bit random number r onto [0,bound) without bias, using the
+   multiply-and-shift method of Lemire (2019).  Returns 0 and leaves the
+   result in *x when r had to be rejected, in which case the caller must
+   try again with a new random number */
+static int boundedFromRandom( const uint32_t r, const uint32_t bound,
+			      uint32_t *x )
+{
+  uint64_t m;
+  uint32_t l;
+
+  m = (uint64_t)r * bound;
+  l = (uint32_t)m;
+  if( l < bound && l < ( -bound ) % bound ) {
+    /* in the short biased part of the range */
+
+    return 0;
+  }
+
+  *x = (uint32_t)( m >> 32 );
+  return 1;
+}
+
+uint32_t genrand_uniform( rng_state_t *state, const uint32_t bound )
+{
+  uint32_t x;
+
+  while( !boundedFromRandom( genrand_int32( state ), bound, &x ) );
+
+  return x;
+}
+
+/* Philox4x32 constants */
+#define PHILOX_M0 0xD2511F53UL
+#define PHILOX_M1 0xCD9E8D57UL
+#define PHILOX_W0 0x9E3779B9UL /* golden ratio */
+#define PHILOX_W1 0xBB67AE85UL /* sqrt(3)-1 */
+
+/* compute the Philox4x32 block for ctr and key, writing it to out */
+static void philox4x32( const uint32_t ctr[ 4 ], const uint32_t key[ 2 ],
+			uint32_t out[ 4 ] )
+{
+  int r;
+  uint64_t p0, p1;
+  uint32_t c0, c1, c2, c3, k0, k1;
+
+  c0 = ctr[ 0 ]; c1 = ctr[ 1 ]; c2 = ctr[ 2 ]; c3 = ctr[ 3 ];
+  k0 = key[ 0 ]; k1 = key[ 1 ];
+  for( r = 0; r < CRNG_ROUNDS; ++r ) {
+
+    p0 = (uint64_t)PHILOX_M0 * c0;
+    p1 = (uint64_t)PHILOX_M1 * c2;
+    c0 = (uint32_t)( p1 >> 32 ) ^ c1 ^ k0;
+    c2 = (uint32_t)( p0 >> 32 ) ^ c3 ^ k1;
+    c1 = (uint32_t)p1;
+    c3 = (uint32_t)p0;
+
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+
+  out[ 0 ] = c0; out[ 1 ] = c1; out[ 2 ] = c2; out[ 3 ] = c3;
+}
+
+void init_crng( crng_state_t *state, uint32_t s, uint64_t stream )
+{
+  state->key[ 0 ] = s;
+  state->key[ 1 ] = 0;
+  state->ctr[ 0 ] = 0;
+  state->ctr[ 1 ] = 0;
+  state->ctr[ 2 ] = (uint32_t)stream;
+  state->ctr[ 3 ] = (uint32_t)( stream >> 32 );
+
+  /* no block generated yet */
+  state->outi = 4;
+}
+
+uint32_t crng_int32( crng_state_t *state )
+{
+  if( state->outi == 4 ) { /* generate the next block of 4 words */
+
+    philox4x32( state->ctr, state->key, state->out );
+    if( ++state->ctr[ 0 ] == 0 ) {
+      ++state->ctr[ 1 ];
+    }
+
+    state->outi = 0;
+  }
+
+  return state->out[ state->outi++ ];
+}
+
+uint32_t crng_uniform( crng_state_t *state, const uint32_t bound )
+{
+  uint32_t x;
+
+  while( !boundedFromRandom( crng_int32( state ), bound, &x ) );
+
+  return x;
+}
@@ -44,6 +44,15 @@ void init_by_array( rng_state_t *state, uint32_t init_key[], int key_length );
 /* generates a random number on [0,0xffffffff]-interval */
 uint32_t genrand_int32( rng_state_t *state );
 
+/* fills out with the next n random numbers on [0,0xffffffff]-interval
+   gives exactly the same numbers as n calls to genrand_int32, but
+   tempers the state a vector at a time */
+void genrand_fill( rng_state_t *state, uint32_t *out, int n );
+
+/* generates a random number on [0,bound-1]-interval without the bias
+   of genrand_int32(state)%bound.  bound must be non-zero */
+uint32_t genrand_uniform( rng_state_t *state, const uint32_t bound );
+
 /* generates a random number on [0,0xffffffff]-interval */
 #define genrand_int31(state) ((int32_t)(genrand_int32(state)>>1))
 
@@ -60,4 +69,39 @@ uint32_t genrand_int32( rng_state_t *state );
 /* generates a random number on [0,1) with 53-bit resolution*/
 #define genrand_res53(state) (((genrand_int32(state)>>5)*67108864.0+(genrand_int32(state)>>6))*(1.0/9007199254740992.0))
 
+
+/* counter-based generator (Philox4x32-10, Salmon et al. 2011)
+
+   each block of 4 outputs is a pure function of a 64 bit key and a
+   128 bit counter, so any position of any stream can be generated
+   directly without stepping through everything that came before it.
+   the key holds the seed, the high half of the counter holds a stream
+   number (eg a hand number), and the low half counts blocks within the
+   stream */
+
+#define CRNG_ROUNDS 10
+
+typedef struct {
+uint32_t key[ 2 ];
+uint32_t ctr[ 4 ];
+uint32_t out[ 4 ];
+int outi;
+} crng_state_t;
+
+/* initializes crng state to the start of stream number stream for seed s */
+void init_crng( crng_state_t *state, uint32_t s, uint64_t stream );
+
+/* generates a random number on [0,0xffffffff]-interval */
+uint32_t crng_int32( crng_state_t *state );
+
+/* generates a random number on [0,bound-1]-interval without bias
+   bound must be non-zero */
+uint32_t crng_uniform( crng_state_t *state, const uint32_t bound );
+
+/* generates a random number on [0,0xffffffff]-interval */
+#define crng_int31(state) ((int32_t)(crng_int32(state)>>1))
+
+/* generates a random number on [0,1)-real-interval */
+#define crng_real2(state) (crng_int32(state)*(1.0/4294967296.0))
+
 #endif
@@ -36,7 +36,7 @@ end
 -- 
 -- Blocks until the server sends a situation where DeepStack acts.
 -- @return the parsed state representation of the poker situation (see
--- @{protocol_to_node.parse_state})
+-- @{protocol_to_node.parse_state}), or `nil` once the match is over
 -- @return a public tree node for the state (see
 -- @{protocol_to_node.parsed_state_to_node})
 function ACPCGame:get_next_situation()
@@ -50,33 +50,65 @@ function ACPCGame:get_next_situation()
       msg = table.remove(debug_msg, 1)
     end
 
-    print("Received acpc dealer message:")
-    print(msg)
-
-    --2.0 parse the string to our state representation
-    local parsed_state = self.protocol_to_node:parse_state(msg)
-    
-    --3.0 figure out if we should act
-    
-    --current player to act is us
-    if parsed_state.acting_player == parsed_state.position then
-      --we should not act since this is an allin situations
-      if parsed_state.bet1 == parsed_state.bet2 and parsed_state.bet1 == arguments.stack then
-        print("Not our turn - alling")
-      --we should act
-      else
-        print("Our turn")
-
-        self.last_msg = msg
-        --create a tree node from the current state
-        local node = self.protocol_to_node:parsed_state_to_node(parsed_state)
-
-        return parsed_state, node
-      end
-    --current player to act is the opponent
+    --the dealer closes the connection when the match is over
+    if not msg then
+      return nil
+    end
+
+    local parsed_state, node = self:parse_message(msg)
+    if parsed_state then
+      return parsed_state, node
+    end
+  end
+end
+
+--- Parses a message from the dealer and decides whether DeepStack acts.
+--
+-- Used by @{get_next_situation}, and by callers which get dealer messages
+-- some other way, such as the solver daemon.
+-- @param msg a `MATCHSTATE` message from the dealer
+-- @return the parsed state representation of the poker situation (see
+-- @{protocol_to_node.parse_state}), or `nil` if DeepStack does not act
+-- @return a public tree node for the state (see
+-- @{protocol_to_node.parsed_state_to_node})
+function ACPCGame:parse_message(msg)
+  self.protocol_to_node = self.protocol_to_node or ACPCProtocolToNode()
+
+  print("Received acpc dealer message:")
+  print(msg)
+
+  --2.0 parse the string to our state representation
+  local parsed_state = self.protocol_to_node:parse_state(msg)
+  
+  --3.0 figure out if we should act
+  
+  --current player to act is us
+  if parsed_state.acting_player == parsed_state.position then
+    --we should not act since this is an allin situations
+    if parsed_state.bet1 == parsed_state.bet2 and parsed_state.bet1 == arguments.stack then
+      print("Not our turn - alling")
+    --we should act
     else
-      print("Not our turn")
+      print("Our turn")
+
+      self.last_msg = msg
+      --create a tree node from the current state
+      local node = self.protocol_to_node:parsed_state_to_node(parsed_state)
+
+      return parsed_state, node
     end
+  --current player to act is the opponent
+  else
+    print("Not our turn")
+  end
+
+  return nil
+end
+
+--- Closes the connection to the server.
+function ACPCGame:close()
+  if not debug_msg then
+    self.network_communication:close()
   end
 end
 
@@ -88,11 +120,22 @@ end
 -- 
 -- * `raise_amount`: the number of chips raised (if `action` is raise)
 function ACPCGame:play_action(adviced_action)
-  local message = self.protocol_to_node:action_to_message(self.last_msg, adviced_action)
-  print("Sending a message to the acpc dealer:")
-  print(message)
+  local message = self:action_to_message(adviced_action)
 
   if not debug_msg then
     self.network_communication:send_line(message)
   end
+end
+
+--- Builds the message that tells the server DeepStack is playing an action
+-- in the last situation returned by @{parse_message}.
+-- @param adviced_action a table specifying the action chosen by Deepstack
+-- (see @{play_action})
+-- @return the message to send to the server
+function ACPCGame:action_to_message(adviced_action)
+  local message = self.protocol_to_node:action_to_message(self.last_msg, adviced_action)
+  print("Sending a message to the acpc dealer:")
+  print(message)
+
+  return message
 end
\ No newline at end of file
@@ -40,11 +40,14 @@ end
 
 --- Waits for a text message from the server. Blocks until a message is
 -- received.
--- @return the message received
+-- @return the message received, or `nil` if the server closed the connection
 function ACPCNetworkCommunication:get_line()  
   local out, status = self.connection:receive('*l')  
   
-  assert(status ~= "closed")  
+  if status == "closed" then
+    return nil
+  end
+  assert(out, status)
   return out
 end
 
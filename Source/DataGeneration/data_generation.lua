@@ -39,6 +39,124 @@ function M:generate_data(train_data_count, valid_data_count)
   print('Done')
 end
 
+--- Generates training and validation data in shards, using several
+-- worker processes.
+--
+-- Starts @{arguments.gen_workers} copies of the `main_data_generation` script,
+-- each of which runs @{generate_data_shards} for both data sets, and writes
+-- the manifests once they have all finished. Shards which are already
+-- complete are not generated again, so an interrupted run can be restarted.
+--
+-- @param train_data_count the number of training examples to generate
+-- @param valid_data_count the number of validation examples to generate
+-- @param script the path of the `main_data_generation` script
+function M:generate_data_parallel(train_data_count, valid_data_count, script)
+  local timer = torch.Timer()
+  timer:reset()
+  print('Generating data with ' .. arguments.gen_workers .. ' workers ...')
+
+  local workers = {}
+  for worker = 1, arguments.gen_workers do
+    workers[worker] = assert(io.popen('th ' .. script .. ' worker ' .. worker))
+  end
+  --the workers run at the same time, so reading them in turn only orders the output
+  for worker = 1, arguments.gen_workers do
+    for line in workers[worker]:lines() do
+      print('worker ' .. worker .. ': ' .. line)
+    end
+    workers[worker]:close()
+  end
+
+  self:write_manifest(valid_data_count, arguments.data_path .. 'valid')
+  self:write_manifest(train_data_count, arguments.data_path .. 'train')
+  print('Generation time: ' .. timer:time().real)
+  print('Done')
+end
+
+--- Generates one worker's share of the training and validation shards.
+-- @param train_data_count the number of training examples to generate
+-- @param valid_data_count the number of validation examples to generate
+-- @param worker the index of the worker, from 1 to @{arguments.gen_workers}
+function M:generate_worker_data(train_data_count, valid_data_count, worker)
+  self:generate_data_shards(valid_data_count, arguments.data_path .. 'valid', 0, worker, arguments.gen_workers)
+  self:generate_data_shards(train_data_count, arguments.data_path .. 'train', 1, worker, arguments.gen_workers)
+end
+
+--- Gives the file prefix of one shard of a data set.
+-- @param file_name the prefix of the data set
+-- @param shard the index of the shard
+-- @return the prefix of the shard's files
+function M:get_shard_name(file_name, shard)
+  return string.format('%s.%05d', file_name, shard)
+end
+
+--- Checks whether a shard has been completely written.
+-- @param shard_name the prefix of the shard's files
+-- @return `true` if the shard is complete
+-- @local
+function M:_is_shard_complete(shard_name)
+  --the mask is the last file moved into place
+  local f = io.open(shard_name .. '.mask', 'r')
+  if f then
+    f:close()
+    return true
+  end
+  return false
+end
+
+--- Generates the shards of a data set which belong to one worker.
+--
+-- Shard `i` goes to worker `(i - 1) % worker_count + 1`, and is generated
+-- from its own random seed, so the data does not depend on the number of
+-- workers. Each shard holds @{arguments.gen_shard_size} examples and is
+-- written to temporary files which are renamed once complete.
+--
+-- @param data_count the number of examples in the data set
+-- @param file_name the prefix of the data set
+-- @param set_index distinguishes the seeds of the data sets
+-- @param worker the index of this worker
+-- @param worker_count the number of workers
+function M:generate_data_shards(data_count, file_name, set_index, worker, worker_count)
+  local shard_size = arguments.gen_shard_size
+  assert(data_count % shard_size == 0, 'data count has to be divisible by the shard size')
+  local shard_count = data_count / shard_size
+
+  for shard = worker, shard_count, worker_count do
+    local shard_name = self:get_shard_name(file_name, shard)
+    if not self:_is_shard_complete(shard_name) then
+      local timer = torch.Timer()
+      torch.manualSeed(arguments.gen_seed + 2 * shard + set_index)
+      self:generate_data_file(shard_size, shard_name .. '.partial')
+      for _, suffix in ipairs({'.inputs', '.targets', '.mask'}) do
+        assert(os.rename(shard_name .. '.partial' .. suffix, shard_name .. suffix))
+      end
+      print(shard_name .. ' time: ' .. timer:time().real)
+      io.stdout:flush()
+    end
+  end
+end
+
+--- Writes the manifest of a sharded data set, which lists its shards.
+--
+-- The manifest is a text file with one line per shard, giving the prefix of
+-- the shard's files (relative to the manifest) and its number of examples.
+-- @param data_count the number of examples in the data set
+-- @param file_name the prefix of the data set. The manifest is saved to
+-- `file_name .. '.manifest'`
+function M:write_manifest(data_count, file_name)
+  local shard_size = arguments.gen_shard_size
+  local shard_count = data_count / shard_size
+  local directory = file_name:match('^(.*/)') or ''
+
+  local f = assert(io.open(file_name .. '.manifest', 'w'))
+  for shard = 1, shard_count do
+    local shard_name = self:get_shard_name(file_name, shard)
+    assert(self:_is_shard_complete(shard_name), 'missing shard ' .. shard_name)
+    f:write(shard_name:sub(#directory + 1) .. ' ' .. shard_size .. '\n')
+  end
+  f:close()
+end
+
 --- Generates data files containing examples of random poker situations with
 -- counterfactual values from an associated solution.
 -- 
@@ -95,8 +213,9 @@ function M:generate_data_file(data_count, file_name)
 	
     --computaton of values using re-solving
     local values = arguments.Tensor(constants.players_count, batch_size, game_settings.card_count)
+    local nodes = {}
+    local pot_sizes = {}
     for i=1,batch_size do 
-      local resolving = Resolving()
       local current_node = {}
 
       current_node.board = board
@@ -104,12 +223,26 @@ function M:generate_data_file(data_count, file_name)
       current_node.current_player = constants.players.P1
       local pot_size = pot_size_features[i][1] * arguments.stack
       current_node.bets = arguments.Tensor{pot_size, pot_size}
-      local p1_range = ranges[1][i]
-      local p2_range = ranges[2][i]
-      resolving:resolve_first_node(current_node, p1_range, p2_range)
-      local root_values = resolving:get_root_cfv_both_players()
-      root_values:mul(1/pot_size)
-      values[{{}, i, {}}]:copy(root_values)
+      nodes[i] = current_node
+      pot_sizes[i] = pot_size
+    end
+
+    if arguments.native_lookahead then
+      --the whole batch shares the board, so it is re-solved at once
+      local resolving = Resolving()
+      local root_values = resolving:resolve_first_node_batch(nodes, ranges[1], ranges[2])
+      root_values:cdiv(arguments.Tensor(pot_sizes):view(batch_size, 1, 1):expandAs(root_values))
+      values:copy(root_values:transpose(1, 2))
+    else
+      for i=1,batch_size do 
+        local resolving = Resolving()
+        local p1_range = ranges[1][i]
+        local p2_range = ranges[2][i]
+        resolving:resolve_first_node(nodes[i], p1_range, p2_range)
+        local root_values = resolving:get_root_cfv_both_players()
+        root_values:mul(1/pot_sizes[i])
+        values[{{}, i, {}}]:copy(root_values)
+      end
     end
 
     
@@ -1,7 +1,17 @@
 --- Script that generates training and validation files.
+--
+-- With @{arguments.gen_workers} set, runs as `th DataGeneration/main_data_generation.lua`
+-- to start the workers, each of which runs this script as
+-- `th DataGeneration/main_data_generation.lua worker <index>`.
 -- @see data_generation
 -- @script main_data_generation
 local arguments = require 'Settings.arguments'
 local data_generation = require 'DataGeneration.data_generation'
 
-data_generation:generate_data(arguments.train_data_count, arguments.valid_data_count)
\ No newline at end of file
+if arg[1] == 'worker' then
+  data_generation:generate_worker_data(arguments.train_data_count, arguments.valid_data_count, tonumber(arg[2]))
+elseif arguments.gen_workers > 0 then
+  data_generation:generate_data_parallel(arguments.train_data_count, arguments.valid_data_count, arg[0])
+else
+  data_generation:generate_data(arguments.train_data_count, arguments.valid_data_count)
+end
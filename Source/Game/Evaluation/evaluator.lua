@@ -80,29 +80,97 @@ function M:evaluate(hand, impossible_hand_value)
   end
 end
 
+--- Builds the strengths of every private hand on every board of the last
+-- round with tensor operations.
+-- @return a tensor of size [boards x card_count], with the boards in the order
+-- of @{card_tools.get_second_round_boards} and `-1` for impossible hands
+-- @local
+function M:_build_strength_table()
+  local card_count = game_settings.card_count
+  local rank_count = game_settings.rank_count
+  local boards = card_tools:get_second_round_boards():float()
+  local boards_count = boards:size(1)
+  local board_size = boards:size(2)
+  assert(board_size == 1 or board_size == 2, 'Incorrect board size for Leduc' )
+
+  --every board followed by every private card
+  local hands = torch.FloatTensor(boards_count, card_count, board_size + 1)
+  hands[{{}, {}, {1, board_size}}]:copy(boards:view(boards_count, 1, board_size):expand(boards_count, card_count, board_size))
+  hands[{{}, {}, board_size + 1}]:copy(torch.range(1, card_count):float():view(1, card_count):expand(boards_count, card_count))
+  local possible = torch.FloatTensor(boards_count, card_count):fill(1)
+  for i = 1, board_size do
+    possible:cmul(hands[{{}, {}, i}]:ne(hands[{{}, {}, -1}]):float())
+  end
+
+  local ranks = hands:add(-1):div(game_settings.suit_count):floor():add(1):sort(3)
+  local r1 = ranks[{{}, {}, 1}]
+  local r2 = ranks[{{}, {}, 2}]
+  local strengths = nil
+  if board_size == 1 then
+    --high card, replaced by the pair's rank for pairs
+    strengths = r1 * rank_count + r2
+    local pair = r1:eq(r2):float()
+    strengths:add(pair:cmul(r1 - strengths))
+  else
+    local r3 = ranks[{{}, {}, 3}]
+    strengths = (r1 * rank_count + r2) * rank_count + r3
+    local low_pair = r1:eq(r2):float()
+    local high_pair = r2:eq(r3):float():cmul(1 - low_pair)
+    strengths:add(low_pair:cmul(r1 * rank_count + r3 - strengths))
+    strengths:add(high_pair:cmul(r2 * rank_count + r1 - strengths))
+  end
+  --impossible hands get -1
+  return strengths:cmul(possible):add(possible):add(-1)
+end
+
+--- Gives the strengths of every private hand on every board of the last
+-- round.
+--
+-- The table is built on first use, by the native library if
+-- @{arguments.native_hand_evaluation} is set.
+-- @return a tensor of size [boards x card_count], with the boards in the order
+-- of @{card_tools.get_second_round_boards} and `-1` for impossible hands
+function M:get_strength_table()
+  if not self._strength_table then
+    local strengths = nil
+    if arguments.native_hand_evaluation then
+      local native = require 'Native.native'
+      assert(native:available(), 'native_hand_evaluation needs the library built in Source/Native')
+      strengths = torch.FloatTensor(card_tools:get_boards_count(), game_settings.card_count)
+      local boards_count = native.lib.dsEvaluateBoards(game_settings.rank_count, game_settings.suit_count,
+        game_settings.board_card_count, -1, native:float_pointer(strengths))
+      assert(boards_count == strengths:size(1), 'native hand evaluation failed')
+    else
+      strengths = self:_build_strength_table()
+    end
+    self._strength_table = strengths:typeAs(arguments.Tensor())
+  end
+  return self._strength_table
+end
+
 --- Gives strength representations for all private hands on the given board.
+--
+-- Looks the board up in @{get_strength_table}.
 -- @param board a possibly empty vector of board cards
 -- @param impossible_hand_value the value to assign to hands which are invalid 
 -- on the board
 -- @return a vector containing a strength value or `impossible_hand_value` for
 -- every private hand
 function M:batch_eval(board, impossible_hand_value)
-  local hand_values = arguments.Tensor(game_settings.card_count):fill(-1)
+  local hand_values = nil
   if board:dim() == 0 then 
+    hand_values = arguments.Tensor(game_settings.card_count)
     for hand = 1, game_settings.card_count do 
       hand_values[hand] = math.floor((hand -1 ) / game_settings.suit_count ) + 1
     end
   else
-    local board_size = board:size(1)
-    assert(board_size == 1 or board_size == 2, 'Incorrect board size for Leduc' )
-    local whole_hand = arguments.Tensor(board_size + 1)
-    whole_hand[{{1, -2}}]:copy(board)
-    for card = 1, game_settings.card_count do 
-      whole_hand[-1] = card; 
-      hand_values[card] = self:evaluate(whole_hand, impossible_hand_value)
-    end 
+    assert(board:size(1) == game_settings.board_card_count, 'Incorrect board size for Leduc' )
+    hand_values = self:get_strength_table()[card_tools:get_board_index(board)]:clone()
+    if impossible_hand_value and impossible_hand_value ~= -1 then
+      hand_values:maskedFill(hand_values:eq(-1), impossible_hand_value)
+    end
   end
   return hand_values
 end
 
-return M
\ No newline at end of file
+return M
@@ -0,0 +1,32 @@
+local evaluator = require 'Game.Evaluation.evaluator'
+local arguments = require 'Settings.arguments'
+local game_settings = require 'Settings.game_settings'
+local card_tools = require 'Game.card_tools'
+
+--compares the strength table with evaluating every hand on every board
+local boards = card_tools:get_second_round_boards()
+local function count_mismatches(strengths)
+  local mismatches = 0
+  for board = 1, boards:size(1) do
+    local hand = arguments.Tensor(boards:size(2) + 1)
+    hand[{{1, -2}}]:copy(boards[board])
+    for card = 1, game_settings.card_count do
+      hand[-1] = card
+      if strengths[board][card] ~= evaluator:evaluate(hand) then
+        mismatches = mismatches + 1
+      end
+    end
+  end
+  return mismatches
+end
+
+print('hands evaluated differently by the strength table: ' .. count_mismatches(evaluator:get_strength_table()))
+
+local native_loaded, native = pcall(require, 'Native.native')
+if native_loaded and native:available() then
+  arguments.native_hand_evaluation = true
+  evaluator._strength_table = nil
+  print('hands evaluated differently by the native strength table: ' .. count_mismatches(evaluator:get_strength_table()))
+  arguments.native_hand_evaluation = false
+  evaluator._strength_table = nil
+end
@@ -0,0 +1,55 @@
+local arguments = require 'Settings.arguments'
+local constants = require 'Settings.constants'
+local card_tools = require 'Game.card_tools'
+local card_to_string = require 'Game.card_to_string_conversion'
+
+require 'Lookahead.resolving'
+
+--re-solves the same node with the Lua and the native lookahead and compares the results
+local current_node = {}
+
+current_node.board = card_to_string:string_to_board('Ks')
+current_node.street = 2
+current_node.current_player = constants.players.P1
+current_node.bets = arguments.Tensor{100, 100}
+
+local player_range = card_tools:get_random_range(current_node.board, 2)
+local opponent_cfvs = card_tools:get_random_range(current_node.board, 4)
+
+local results = {}
+for _, use_native in ipairs({false, true}) do
+  arguments.native_lookahead = use_native
+  local resolving = Resolving()
+  local timer = torch.Timer()
+  resolving:resolve(current_node, player_range, opponent_cfvs)
+  print((use_native and 'native' or 'lua') .. ' resolve time: ' .. timer:time().real)
+  results[#results + 1] = resolving.resolve_results
+end
+
+print('max strategy difference: ' .. (results[1].strategy - results[2].strategy):abs():max())
+print('max achieved cfv difference: ' .. (results[1].achieved_cfvs - results[2].achieved_cfvs):abs():max())
+print('max children cfv difference: ' .. (results[1].children_cfvs - results[2].children_cfvs):abs():max())
+
+--re-solves a batch of nodes at once and compares the results with re-solving each node
+arguments.native_lookahead = true
+local nodes = {}
+local pot_sizes = {100, 100, 250, 700}
+local player_ranges = arguments.Tensor(#pot_sizes, player_range:size(1))
+local opponent_ranges = player_ranges:clone()
+for i, pot_size in ipairs(pot_sizes) do
+  nodes[i] = {board = current_node.board, street = 2, current_player = constants.players.P1, bets = arguments.Tensor{pot_size, pot_size}}
+  player_ranges[i]:copy(card_tools:get_random_range(current_node.board, i))
+  opponent_ranges[i]:copy(card_tools:get_random_range(current_node.board, 10 + i))
+end
+
+local timer = torch.Timer()
+local batch_cfvs = Resolving():resolve_first_node_batch(nodes, player_ranges, opponent_ranges)
+print('batched resolve time: ' .. timer:time().real)
+
+local max_difference = 0
+for i = 1, #nodes do
+  local resolving = Resolving()
+  resolving:resolve_first_node(nodes[i], player_ranges[i], opponent_ranges[i])
+  max_difference = math.max(max_difference, (resolving:get_root_cfv_both_players() - batch_cfvs[i]):abs():max())
+end
+print('max batched root cfv difference: ' .. max_difference)
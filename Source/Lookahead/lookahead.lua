@@ -8,6 +8,9 @@ local arguments = require 'Settings.arguments'
 local constants = require 'Settings.constants'
 local game_settings = require 'Settings.game_settings'
 local tools = require 'tools'
+local card_tools = require 'Game.card_tools'
+--loaded only when needed, since it requires the LuaJIT FFI
+local native = nil
 
 local Lookahead = torch.class('Lookahead')
 
@@ -25,6 +28,93 @@ function Lookahead:build_lookahead(tree)
 
   self.terminal_equity = TerminalEquity()
   self.terminal_equity:set_board(tree.board)
+
+  if arguments.native_lookahead then
+    self:_build_native()
+  elseif arguments.native_regret_matching then
+    self:_build_native_regret_matching()
+  end
+end
+
+--- Constructs a lookahead which re-solves a batch of situations at once.
+--
+-- The situations share one public tree shape and board, but each has its own
+-- pot sizes and ranges, so a batch is solved with one pass over the layers
+-- and one terminal equity product per layer. Needs `arguments.native_lookahead`,
+-- and can only be used for trees which do not need the neural net.
+-- @param trees a list of public trees, one for each situation
+function Lookahead:build_batched_lookahead(trees)
+  assert(arguments.native_lookahead, 'batched lookaheads need native_lookahead')
+  assert(trees[1].street == 2, 'batched lookaheads cannot use the neural net')
+
+  self.builder:build_from_tree(trees[1])
+  self.builder:construct_batch_data_structures(trees)
+
+  self.terminal_equity = TerminalEquity()
+  self.terminal_equity:set_board(trees[1].board)
+
+  self:_build_native()
+end
+
+--- Gets the pointers used by the native regret matching kernel, used when
+-- `arguments.native_regret_matching` is set.
+-- @local
+function Lookahead:_build_native_regret_matching()
+  native = native or require 'Native.native'
+  assert(native:available(), 'native_regret_matching needs the library built in Source/Native')
+  assert(not arguments.gpu, 'native_regret_matching runs on the CPU only')
+
+  self.native_regret_matching = {}
+  for d=2,self.depth do
+    local actions = self.regrets_data[d]:size(1)
+    self.native_regret_matching[d] = {
+      regrets = native:float_pointer(self.regrets_data[d]),
+      mask = native:float_pointer(self.empty_action_mask[d]),
+      strategy = native:float_pointer(self.current_strategy_data[d]),
+      actions = actions,
+      columns = self.regrets_data[d]:nElement() / actions,
+    }
+  end
+end
+
+--- Creates the native lookahead which runs the CFR iterations on this
+-- lookahead's tensors, used when `arguments.native_lookahead` is set.
+-- @local
+function Lookahead:_build_native()
+  native = native or require 'Native.native'
+  assert(native:available(), 'native_lookahead needs the library built in Source/Native')
+  assert(not arguments.gpu, 'native_lookahead runs on the CPU only')
+  local ffi = require 'ffi'
+  local lib = native.lib
+
+  local la = lib.dsLookaheadNew(self.depth, game_settings.card_count, self.batch_size or 1,
+    native:int_array(self.actions_count, -1, self.depth, 1),
+    native:int_array(self.bets_count, -1, self.depth, 1),
+    native:int_array(self.nonallinbets_count, -1, self.depth, 1),
+    native:int_array(self.terminal_actions_count, -1, self.depth, 1),
+    native:int_array(self.nonterminal_nonallin_nodes_count, -1, self.depth, 1))
+  assert(la ~= nil, 'could not create the native lookahead')
+  self.native = ffi.gc(la, lib.dsLookaheadFree)
+
+  for d=1,self.depth do
+    --the first layer has no strategy
+    local has_strategy = d > 1
+    lib.dsLookaheadSetLayer(self.native, d,
+      native:float_pointer(self.ranges_data[d]),
+      native:float_pointer(self.cfvs_data[d]),
+      native:float_pointer(self.pot_size[d]),
+      has_strategy and native:float_pointer(self.current_strategy_data[d]) or nil,
+      has_strategy and native:float_pointer(self.regrets_data[d]) or nil,
+      has_strategy and native:float_pointer(self.empty_action_mask[d]) or nil)
+  end
+  lib.dsLookaheadSetAverages(self.native,
+    native:float_pointer(self.average_strategies_data[2]),
+    native:float_pointer(self.average_cfvs_data[1]),
+    native:float_pointer(self.average_cfvs_data[2]))
+  lib.dsLookaheadSetTerminalEquity(self.native, self.tree.street,
+    self.first_call_terminal and 1 or 0,
+    native:float_pointer(self.terminal_equity.equity_matrix),
+    native:float_pointer(self.terminal_equity.fold_matrix))
 end
 
 --- Re-solves the lookahead using input ranges.
@@ -43,6 +133,24 @@ function Lookahead:resolve_first_node(player_range, opponent_range)
   self:_compute()
 end
 
+--- Re-solves a batched lookahead using input ranges.
+--
+-- @{build_batched_lookahead} must be called first.
+--
+-- @param player_ranges a BxK tensor of ranges for the re-solving player, one
+-- for each situation of the batch
+-- @param opponent_ranges a BxK tensor of ranges for the opponent
+function Lookahead:resolve_first_node_batch(player_ranges, opponent_ranges)
+  assert(self.batch_size, 'the lookahead was not built with build_batched_lookahead')
+
+  local root_ranges = self.ranges_data[1]:view(self.batch_size, constants.players_count, game_settings.card_count)
+  root_ranges[{{}, 1, {}}]:copy(player_ranges)
+  root_ranges[{{}, 2, {}}]:copy(opponent_ranges)
+
+  self:_compute_native()
+  self:_compute_normalize_average_cfvs()
+end
+
 --- Re-solves the lookahead using an input range for the player and
 -- the @{cfrd_gadget|CFRDGadget} to generate ranges for the opponent.
 -- 
@@ -59,6 +167,14 @@ function Lookahead:resolve(player_range, opponent_cfvs)
   
   self.ranges_data[1][{{}, {}, {}, 1, {}}]:copy(player_range)
   self.reconstruction_opponent_cfvs = opponent_cfvs
+
+  if self.native then
+    local range_mask = card_tools:get_possible_hand_indexes(self.tree.board)
+    assert(native.lib.dsLookaheadSetGadget(self.native,
+      native:float_pointer(opponent_cfvs:contiguous()),
+      native:float_pointer(range_mask:contiguous())) >= 0)
+  end
+
   self:_compute()
 end
 
@@ -66,26 +182,67 @@ end
 -- @local
 function Lookahead:_compute()
   --1.0 main loop
-  for iter=1,arguments.cfr_iters do
-    self:_set_opponent_starting_range(iter)
-    self:_compute_current_strategies()
-    self:_compute_ranges()
-    self:_compute_update_average_strategies(iter)
-    self:_compute_terminal_equities()   
-    self:_compute_cfvs()
-    self:_compute_regrets()
-    self:_compute_cumulate_average_cfvs(iter)
+  if self.native then
+    self:_compute_native()
+  else
+    for iter=1,arguments.cfr_iters do
+      self:_set_opponent_starting_range(iter)
+      self:_compute_current_strategies()
+      self:_compute_ranges()
+      self:_compute_update_average_strategies(iter)
+      self:_compute_terminal_equities()   
+      self:_compute_cfvs()
+      self:_compute_regrets()
+      self:_compute_cumulate_average_cfvs(iter)
+    end
   end
 
   --2.0 at the end normalize average strategy
   self:_compute_normalize_average_strategies()
   --2.1 normalize root's CFVs
   self:_compute_normalize_average_cfvs()
+
+  --3.0 report how far the reused neural net outputs were from the exact ones
+  if arguments.next_round_value_error_stats and self.next_street_boxes then
+    for d, next_street_box in pairs(self.next_street_boxes) do
+      local stats = next_street_box:get_approximation_stats()
+      if stats then
+        print(string.format('next round values at depth %d: %d of %d net inputs evaluated, mean error %s, max error %s',
+          d, stats.evaluated_rows, stats.rows, tostring(stats.mean_error), tostring(stats.max_error)))
+      end
+    end
+  end
+end
+
+--- Runs the CFR iterations of @{_compute} with the native lookahead.
+-- @local
+function Lookahead:_compute_native()
+  local lib = native.lib
+
+  if self.tree.street == 1 then
+    --the neural net gives the values of the transition nodes in the middle of each iteration
+    for iter=1,arguments.cfr_iters do
+      lib.dsLookaheadStartIteration(self.native, iter, arguments.cfr_skip_iters)
+      self:_compute_terminal_equities_next_street_box()
+      lib.dsLookaheadFinishIteration(self.native, iter, arguments.cfr_skip_iters)
+    end
+  else
+    lib.dsLookaheadCompute(self.native, 1, arguments.cfr_iters, arguments.cfr_skip_iters)
+  end
 end
 
 --- Uses regret matching to generate the players' current strategies.
 -- @local
 function Lookahead:_compute_current_strategies()
+  --the native kernel does all of the steps below in one pass
+  if self.native_regret_matching then
+    for d=2,self.depth do
+      local layer = self.native_regret_matching[d]
+      native.lib.dsRegretMatching(layer.regrets, layer.mask, layer.strategy, layer.actions, layer.columns)
+    end
+    return
+  end
+
   for d=2,self.depth do
     self.positive_regrets_data[d]:copy(self.regrets_data[d])
     self.positive_regrets_data[d]:clamp(self.regret_epsilon, tools:max_number())
@@ -446,6 +603,22 @@ function Lookahead:get_results()
   return out
 end
 
+--- Gives the average counterfactual values that each player received at the
+-- root of each situation of a batched lookahead.
+--
+-- The lookahead must first be re-solved with @{resolve_first_node_batch}.
+-- @return a BxPxK tensor of cfvs, where B is the batch size, P the number of
+-- players and K the range size
+function Lookahead:get_batch_root_cfvs_both_players()
+  local root_cfvs = self.average_cfvs_data[1]:view(self.batch_size, constants.players_count, game_settings.card_count)
+
+  --swap cfvs indexing
+  local out = root_cfvs:clone()
+  out[{{}, 1, {}}]:copy(root_cfvs[{{}, 2, {}}])
+  out[{{}, 2, {}}]:copy(root_cfvs[{{}, 1, {}}])
+  return out
+end
+
 --- Generates the opponent's range for the current re-solve iteration using
 -- the @{cfrd_gadget|CFRDGadget}.
 -- @param iteration the current iteration number of re-solving
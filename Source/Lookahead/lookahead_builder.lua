@@ -328,6 +328,55 @@ function LookaheadBuilder:build_from_tree(tree)
 
 end
 
+--- Replaces the tensors used by the native lookahead with tensors which hold
+-- a batch of situations, one for each tree.
+--
+-- Must be called after @{build_from_tree} with the first tree. The trees must
+-- have the same shape and board, so they only differ in their pot sizes. The
+-- batch dimension is inserted before the players dimension (or before the
+-- range dimension for strategies), and the other tensors are left unbatched,
+-- so the batched lookahead can only be re-solved with native code.
+-- @param trees a list of public trees
+function LookaheadBuilder:construct_batch_data_structures(trees)
+  local batch_size = #trees
+  self.lookahead.batch_size = batch_size
+
+  --copies a tensor into each situation of the batch
+  local function batch(tensor)
+    local sizes = tensor:size():totable()
+    local batched_sizes = tensor:size():totable()
+    table.insert(sizes, 4, 1)
+    table.insert(batched_sizes, 4, batch_size)
+    return tensor:view(unpack(sizes)):expand(unpack(batched_sizes)):clone()
+  end
+
+  --the pot sizes are the only data which differ between the trees
+  local pot_size = {}
+  for d=1,self.lookahead.depth do
+    pot_size[d] = batch(self.lookahead.pot_size[d])
+  end
+  for i=2,batch_size do
+    self:set_datastructures_from_tree_dfs(trees[i], 1, 1, 1, 1)
+    for d=1,self.lookahead.depth do
+      pot_size[d]:select(4, i):copy(self.lookahead.pot_size[d])
+    end
+  end
+  self.lookahead.pot_size = pot_size
+
+  for d=1,self.lookahead.depth do
+    self.lookahead.ranges_data[d] = batch(self.lookahead.ranges_data[d])
+    self.lookahead.cfvs_data[d] = batch(self.lookahead.cfvs_data[d])
+    if d > 1 then
+      self.lookahead.current_strategy_data[d] = batch(self.lookahead.current_strategy_data[d])
+      self.lookahead.regrets_data[d] = batch(self.lookahead.regrets_data[d])
+      self.lookahead.empty_action_mask[d] = batch(self.lookahead.empty_action_mask[d])
+    end
+  end
+  self.lookahead.average_strategies_data[2] = batch(self.lookahead.average_strategies_data[2])
+  self.lookahead.average_cfvs_data[1] = batch(self.lookahead.average_cfvs_data[1])
+  self.lookahead.average_cfvs_data[2] = batch(self.lookahead.average_cfvs_data[2])
+end
+
 --- Computes the maximum number of actions at each depth of the tree.
 -- 
 -- Used to find the size for the tensors which store lookahead data. The 
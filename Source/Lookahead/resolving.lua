@@ -49,6 +49,61 @@ function Resolving:resolve_first_node(node, player_range, opponent_range)
   return self.resolve_results 
 end
 
+--- Describes the shape of a public tree, so that trees which can share a
+-- batched lookahead have the same description.
+-- @param node the root of the tree
+-- @param out a list the description is appended to
+-- @return the description
+-- @local
+local function tree_shape(node, out)
+  out = out or {node.bets[1] == node.bets[2] and 'check' or 'bet'}
+  local chance = node.current_player == constants.players.chance
+  table.insert(out, #node.children .. (node.terminal and 't' or '') .. (chance and 'c' or ''))
+  for _, child in ipairs(node.children) do
+    tree_shape(child, out)
+  end
+  return table.concat(out, ' ')
+end
+
+--- Re-solves a batch of depth-limited lookaheads using input ranges, as
+-- @{resolve_first_node} does for each of them.
+--
+-- The nodes must be on the last street and share a board. Nodes whose trees
+-- have the same shape are re-solved together by one batched lookahead, so
+-- `arguments.native_lookahead` must be set.
+--
+-- @param nodes a list of B public nodes at which to re-solve
+-- @param player_ranges a BxK tensor of ranges for the re-solving player
+-- @param opponent_ranges a BxK tensor of ranges for the opponent
+-- @return a BxPxK tensor of the cfvs that each player received at each node,
+-- as given by @{get_root_cfv_both_players}
+function Resolving:resolve_first_node_batch(nodes, player_ranges, opponent_ranges)
+  --group the nodes by the shape of their trees
+  local groups = {}
+  local group_list = {}
+  for i, node in ipairs(nodes) do
+    self:_create_lookahead_tree(node)
+    local shape = tree_shape(self.lookahead_tree)
+    if not groups[shape] then
+      groups[shape] = {trees = {}, indexes = {}}
+      table.insert(group_list, groups[shape])
+    end
+    table.insert(groups[shape].trees, self.lookahead_tree)
+    table.insert(groups[shape].indexes, i)
+  end
+
+  local root_cfvs = arguments.Tensor(#nodes, constants.players_count, player_ranges:size(2))
+  for _, group in ipairs(group_list) do
+    local indexes = torch.LongTensor(group.indexes)
+    local lookahead = Lookahead()
+    lookahead:build_batched_lookahead(group.trees)
+    lookahead:resolve_first_node_batch(player_ranges:index(1, indexes), opponent_ranges:index(1, indexes))
+    root_cfvs:indexCopy(1, indexes, lookahead:get_batch_root_cfvs_both_players())
+  end
+
+  return root_cfvs
+end
+
 --- Re-solves a depth-limited lookahead using an input range for the player and
 -- the @{cfrd_gadget|CFRDGadget} to generate ranges for the opponent.
 -- 
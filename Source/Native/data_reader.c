@@ -0,0 +1,461 @@
+/*
+Streams training data from a memory-mapped chunk file (see
+Training/main_convert_data.lua for the format) in shuffled batches.
+
+A prefetch thread assembles batches into a small ring of buffers while the
+caller trains on earlier ones.  An epoch visits the chunks in a random
+order and shuffles the rows within windows of a few chunks, so only the
+row indices of one window are permuted in memory and the file is read
+nearly sequentially.  The kernel is asked to read each window ahead, and
+pages of windows already used are dropped, so files larger than memory
+stream at disk speed.
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "deepstack_native.h"
+
+#define DS_DATA_MAGIC 0x4b484344
+#define DS_DATA_VERSION 1
+#define DS_DATA_HEADER_INTS 8
+
+struct DSBatchReader {
+  const DSDataFile *file;
+  int batchSize;
+  int chunkRows;
+  int windowChunks;
+  int maskRepeat;
+  int slotCount;
+
+  /* per epoch: the chunk order and the row order of the current window */
+  int chunkCount;
+  int *chunkOrder;
+  int *windowRows;
+  int shuffle;
+  uint64_t random;
+  int batchCount;
+
+  /* ring of assembled batches, filled by the prefetch thread */
+  float **slotInputs;
+  float **slotTargets;
+  float **slotMasks;
+  int readSlot;
+  int filledSlots;
+  int producedBatches;
+  int consumedBatches;
+  int stop;
+  int running;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t slotFilled;
+  pthread_cond_t slotFreed;
+};
+
+
+DSDataFile *dsDataFileOpen( const char *fileName )
+{
+  DSDataFile *file;
+  int fd;
+  struct stat st;
+  const int32_t *header;
+  size_t rowBytes;
+
+  fd = open( fileName, O_RDONLY );
+  if( fd < 0 ) {
+
+    return NULL;
+  }
+  if( fstat( fd, &st ) < 0
+      || st.st_size < DS_DATA_HEADER_INTS * (off_t)sizeof( int32_t ) ) {
+
+    close( fd );
+    return NULL;
+  }
+
+  file = calloc( 1, sizeof( *file ) );
+  if( file == NULL ) {
+
+    close( fd );
+    return NULL;
+  }
+  file->length = st.st_size;
+  file->map = mmap( NULL, file->length, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( file->map == MAP_FAILED ) {
+
+    free( file );
+    return NULL;
+  }
+
+  header = (const int32_t *)file->map;
+  file->inputSize = header[ 2 ];
+  file->targetSize = header[ 3 ];
+  file->maskSize = header[ 4 ];
+  file->rowCount = header[ 5 ];
+  file->rowSize = file->inputSize + file->targetSize + file->maskSize;
+  rowBytes = file->rowSize * sizeof( float );
+  if( header[ 0 ] != DS_DATA_MAGIC || header[ 1 ] != DS_DATA_VERSION
+      || file->inputSize <= 0 || file->targetSize <= 0
+      || file->maskSize <= 0 || file->rowCount < 0
+      || file->length < DS_DATA_HEADER_INTS * sizeof( int32_t )
+      + file->rowCount * rowBytes ) {
+
+    dsDataFileClose( file );
+    return NULL;
+  }
+  file->rows = (const float *)( header + DS_DATA_HEADER_INTS );
+
+  return file;
+}
+
+void dsDataFileClose( DSDataFile *file )
+{
+  if( file == NULL ) {
+    return;
+  }
+
+  munmap( (void *)file->map, file->length );
+  free( file );
+}
+
+
+/* splitmix64, seeded for each epoch by the caller */
+static uint64_t nextRandom( uint64_t *state )
+{
+  uint64_t z;
+
+  *state += 0x9e3779b97f4a7c15ULL;
+  z = *state;
+  z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+  z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+  return z ^ ( z >> 31 );
+}
+
+static void shuffleInts( int *values, const int count, uint64_t *state )
+{
+  int i, j, t;
+
+  for( i = count - 1; i > 0; --i ) {
+
+    j = nextRandom( state ) % ( i + 1 );
+    t = values[ i ];
+    values[ i ] = values[ j ];
+    values[ j ] = t;
+  }
+}
+
+/* rows of chunk c of the epoch, in file order */
+static void chunkRows( const DSBatchReader *reader, const int c,
+		       int *first, int *count )
+{
+  *first = reader->chunkOrder[ c ] * reader->chunkRows;
+  *count = reader->file->rowCount - *first;
+  if( *count > reader->chunkRows ) {
+    *count = reader->chunkRows;
+  }
+}
+
+/* ask the kernel to read the chunks of a window ahead, or to drop them */
+static void adviseWindow( const DSBatchReader *reader, const int window,
+			  const int advice )
+{
+  const size_t pageSize = sysconf( _SC_PAGESIZE );
+  const size_t rowBytes = reader->file->rowSize * sizeof( float );
+  int c, first, count;
+  size_t start, end;
+
+  for( c = window * reader->windowChunks;
+       c < reader->chunkCount && c < ( window + 1 ) * reader->windowChunks;
+       ++c ) {
+
+    chunkRows( reader, c, &first, &count );
+    start = (const char *)( reader->file->rows ) - reader->file->map
+      + first * rowBytes;
+    end = start + count * rowBytes;
+    start -= start % pageSize;
+    madvise( (char *)reader->file->map + start, end - start, advice );
+  }
+}
+
+/* copy row into the given slot position, repeating the mask */
+static void copyRow( DSBatchReader *reader, const int slot, const int position,
+		     const int row )
+{
+  const DSDataFile *file = reader->file;
+  const float *source = file->rows + (size_t)row * file->rowSize;
+  float *mask;
+  int r;
+
+  memcpy( reader->slotInputs[ slot ] + position * file->inputSize,
+	  source, file->inputSize * sizeof( float ) );
+  memcpy( reader->slotTargets[ slot ] + position * file->targetSize,
+	  source + file->inputSize, file->targetSize * sizeof( float ) );
+  mask = reader->slotMasks[ slot ]
+    + position * file->maskSize * reader->maskRepeat;
+  for( r = 0; r < reader->maskRepeat; ++r ) {
+
+    memcpy( mask + r * file->maskSize,
+	    source + file->inputSize + file->targetSize,
+	    file->maskSize * sizeof( float ) );
+  }
+}
+
+static void *prefetchThread( void *arg )
+{
+  DSBatchReader *reader = (DSBatchReader *)arg;
+  const int windowCount = ( reader->chunkCount + reader->windowChunks - 1 )
+    / reader->windowChunks;
+  int window, windowSize, c, first, count, i, position, slot;
+
+  slot = 0;
+  position = 0;
+  for( window = 0; window < windowCount; ++window ) {
+
+    if( window + 1 < windowCount ) {
+      adviseWindow( reader, window + 1, MADV_WILLNEED );
+    }
+
+    windowSize = 0;
+    for( c = window * reader->windowChunks;
+	 c < reader->chunkCount && c < ( window + 1 ) * reader->windowChunks;
+	 ++c ) {
+
+      chunkRows( reader, c, &first, &count );
+      for( i = 0; i < count; ++i ) {
+
+	reader->windowRows[ windowSize++ ] = first + i;
+      }
+    }
+    if( reader->shuffle ) {
+      shuffleInts( reader->windowRows, windowSize, &reader->random );
+    }
+
+    for( i = 0; i < windowSize; ++i ) {
+
+      if( position == 0 ) {
+
+	/* wait for a free slot */
+	pthread_mutex_lock( &reader->lock );
+	while( reader->filledSlots == reader->slotCount && !reader->stop ) {
+	  pthread_cond_wait( &reader->slotFreed, &reader->lock );
+	}
+	if( reader->stop
+	    || reader->producedBatches == reader->batchCount ) {
+
+	  pthread_mutex_unlock( &reader->lock );
+	  return NULL;
+	}
+	slot = ( reader->readSlot + reader->filledSlots ) % reader->slotCount;
+	pthread_mutex_unlock( &reader->lock );
+      }
+
+      copyRow( reader, slot, position, reader->windowRows[ i ] );
+      if( ++position == reader->batchSize ) {
+
+	position = 0;
+	pthread_mutex_lock( &reader->lock );
+	++reader->filledSlots;
+	++reader->producedBatches;
+	pthread_cond_signal( &reader->slotFilled );
+	pthread_mutex_unlock( &reader->lock );
+      }
+    }
+
+    if( reader->shuffle ) {
+      adviseWindow( reader, window, MADV_DONTNEED );
+    }
+  }
+
+  return NULL;
+}
+
+
+DSBatchReader *dsBatchReaderNew( const DSDataFile *file, const int batchSize,
+				 const int chunkRows, const int windowChunks,
+				 const int maskRepeat, const int slotCount )
+{
+  DSBatchReader *reader;
+  int s;
+
+  if( batchSize <= 0 || chunkRows <= 0 || windowChunks <= 0
+      || maskRepeat <= 0 || slotCount <= 0 ) {
+
+    return NULL;
+  }
+
+  reader = calloc( 1, sizeof( *reader ) );
+  if( reader == NULL ) {
+    return NULL;
+  }
+  reader->file = file;
+  reader->batchSize = batchSize;
+  reader->chunkRows = chunkRows;
+  reader->windowChunks = windowChunks;
+  reader->maskRepeat = maskRepeat;
+  reader->slotCount = slotCount;
+  reader->chunkCount = ( file->rowCount + chunkRows - 1 ) / chunkRows;
+  reader->batchCount = file->rowCount / batchSize;
+  pthread_mutex_init( &reader->lock, NULL );
+  pthread_cond_init( &reader->slotFilled, NULL );
+  pthread_cond_init( &reader->slotFreed, NULL );
+
+  reader->chunkOrder = malloc( ( reader->chunkCount + 1 ) * sizeof( int ) );
+  reader->windowRows = malloc( (size_t)chunkRows * windowChunks
+			       * sizeof( int ) );
+  reader->slotInputs = calloc( slotCount, sizeof( float * ) );
+  reader->slotTargets = calloc( slotCount, sizeof( float * ) );
+  reader->slotMasks = calloc( slotCount, sizeof( float * ) );
+  if( reader->chunkOrder == NULL || reader->windowRows == NULL
+      || reader->slotInputs == NULL || reader->slotTargets == NULL
+      || reader->slotMasks == NULL ) {
+
+    dsBatchReaderFree( reader );
+    return NULL;
+  }
+  for( s = 0; s < slotCount; ++s ) {
+
+    reader->slotInputs[ s ] = malloc( (size_t)batchSize * file->inputSize
+				      * sizeof( float ) );
+    reader->slotTargets[ s ] = malloc( (size_t)batchSize * file->targetSize
+				       * sizeof( float ) );
+    reader->slotMasks[ s ] = malloc( (size_t)batchSize * file->maskSize
+				     * maskRepeat * sizeof( float ) );
+    if( reader->slotInputs[ s ] == NULL || reader->slotTargets[ s ] == NULL
+	|| reader->slotMasks[ s ] == NULL ) {
+
+      dsBatchReaderFree( reader );
+      return NULL;
+    }
+  }
+
+  return reader;
+}
+
+/* stop the prefetch thread of the current epoch, if there is one */
+static void stopEpoch( DSBatchReader *reader )
+{
+  if( !reader->running ) {
+    return;
+  }
+
+  pthread_mutex_lock( &reader->lock );
+  reader->stop = 1;
+  pthread_cond_broadcast( &reader->slotFreed );
+  pthread_mutex_unlock( &reader->lock );
+  pthread_join( reader->thread, NULL );
+  reader->running = 0;
+}
+
+void dsBatchReaderFree( DSBatchReader *reader )
+{
+  int s;
+
+  if( reader == NULL ) {
+    return;
+  }
+
+  stopEpoch( reader );
+  for( s = 0; s < reader->slotCount; ++s ) {
+
+    if( reader->slotInputs ) {
+      free( reader->slotInputs[ s ] );
+    }
+    if( reader->slotTargets ) {
+      free( reader->slotTargets[ s ] );
+    }
+    if( reader->slotMasks ) {
+      free( reader->slotMasks[ s ] );
+    }
+  }
+  free( reader->slotInputs );
+  free( reader->slotTargets );
+  free( reader->slotMasks );
+  free( reader->chunkOrder );
+  free( reader->windowRows );
+  pthread_cond_destroy( &reader->slotFilled );
+  pthread_cond_destroy( &reader->slotFreed );
+  pthread_mutex_destroy( &reader->lock );
+  free( reader );
+}
+
+int dsBatchReaderBatchCount( const DSBatchReader *reader )
+{
+  return reader->batchCount;
+}
+
+int dsBatchReaderStartEpoch( DSBatchReader *reader, const int shuffle,
+			     const uint64_t seed )
+{
+  int c;
+
+  stopEpoch( reader );
+
+  reader->shuffle = shuffle;
+  reader->random = seed;
+  for( c = 0; c < reader->chunkCount; ++c ) {
+
+    reader->chunkOrder[ c ] = c;
+  }
+  if( shuffle ) {
+    shuffleInts( reader->chunkOrder, reader->chunkCount, &reader->random );
+  }
+
+  reader->readSlot = 0;
+  reader->filledSlots = 0;
+  reader->producedBatches = 0;
+  reader->consumedBatches = 0;
+  reader->stop = 0;
+  if( reader->chunkCount > 0 ) {
+    adviseWindow( reader, 0, MADV_WILLNEED );
+  }
+  if( pthread_create( &reader->thread, NULL, prefetchThread, reader ) != 0 ) {
+
+    return -1;
+  }
+  reader->running = 1;
+
+  return 0;
+}
+
+int dsBatchReaderNext( DSBatchReader *reader, float *inputs, float *targets,
+		       float *mask )
+{
+  const DSDataFile *file = reader->file;
+  int slot;
+
+  if( !reader->running || reader->consumedBatches == reader->batchCount ) {
+
+    return 0;
+  }
+
+  pthread_mutex_lock( &reader->lock );
+  while( reader->filledSlots == 0 ) {
+    pthread_cond_wait( &reader->slotFilled, &reader->lock );
+  }
+  slot = reader->readSlot;
+  pthread_mutex_unlock( &reader->lock );
+
+  memcpy( inputs, reader->slotInputs[ slot ],
+	  (size_t)reader->batchSize * file->inputSize * sizeof( float ) );
+  memcpy( targets, reader->slotTargets[ slot ],
+	  (size_t)reader->batchSize * file->targetSize * sizeof( float ) );
+  memcpy( mask, reader->slotMasks[ slot ],
+	  (size_t)reader->batchSize * file->maskSize * reader->maskRepeat
+	  * sizeof( float ) );
+
+  pthread_mutex_lock( &reader->lock );
+  reader->readSlot = ( reader->readSlot + 1 ) % reader->slotCount;
+  --reader->filledSlots;
+  ++reader->consumedBatches;
+  pthread_cond_signal( &reader->slotFreed );
+  pthread_mutex_unlock( &reader->lock );
+
+  return reader->batchSize;
+}
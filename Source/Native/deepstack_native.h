@@ -0,0 +1,306 @@
+/*
+Native kernels for DeepStack, loaded from Lua with the LuaJIT FFI
+(see native.lua) or linked directly from C.
+*/
+
+#ifndef _DEEPSTACK_NATIVE_H
+#define _DEEPSTACK_NATIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DS_MAX_DEPTH 32
+#define DS_MAX_NET_LAYERS 16
+
+/* precisions of the value network's weights */
+#define DS_PRECISION_FLOAT 0
+#define DS_PRECISION_BF16 1
+#define DS_PRECISION_INT8 2
+
+
+/* a lookahead re-solved with CFR+ by native code
+
+   the lookahead works directly on the per-layer tensors built by
+   LookaheadBuilder:construct_data_structures, so ranges, cfvs, strategies
+   and regrets are shared with the Lua Lookahead and can be read or
+   written between iterations (for example by the neural net boxes on the
+   first street).  Layer d holds contiguous float tensors of size
+   [ actions x parent_action x grandparent_id x batch x players x range ],
+   or without the players dimension for strategies, regrets and masks.
+   The batch dimension holds situations which share the tree's shape and
+   board but have their own ranges and pot sizes, so one pass over the
+   layers solves all of them.
+
+   everything the iterations need is allocated when the lookahead is
+   created, so re-solving does not allocate memory */
+typedef struct {
+  int depth;
+  int cardCount;
+  int batchSize;
+  int street;
+  int firstCallTerminal;
+
+  /* layer counts as computed by LookaheadBuilder, indexed by layer + 1
+     so that layer -1 is at index 0 */
+  int actionsCount[ DS_MAX_DEPTH + 2 ];
+  int betsCount[ DS_MAX_DEPTH + 2 ];
+  int nonallinBetsCount[ DS_MAX_DEPTH + 2 ];
+  int terminalActionsCount[ DS_MAX_DEPTH + 2 ];
+  int nonterminalNonallinNodesCount[ DS_MAX_DEPTH + 2 ];
+
+  /* tensors owned by the caller, indexed by layer */
+  float *ranges[ DS_MAX_DEPTH + 1 ];
+  float *cfvs[ DS_MAX_DEPTH + 1 ];
+  float *potSize[ DS_MAX_DEPTH + 1 ];
+  float *currentStrategy[ DS_MAX_DEPTH + 1 ];
+  float *regrets[ DS_MAX_DEPTH + 1 ];
+  float *emptyActionMask[ DS_MAX_DEPTH + 1 ];
+  float *averageStrategies;
+  float *averageCfvs[ 3 ];
+  const float *callMatrix;
+  const float *foldMatrix;
+
+  /* sums over the actions of a layer */
+  float *actionSum;
+
+  /* CFR-D gadget state, used when re-solving with opponent cfvs */
+  int useGadget;
+  float *gadgetValues;
+  float *gadgetMask;
+  float *playRegrets;
+  float *terminateRegrets;
+  float *playStrategy;
+  float *terminateStrategy;
+} DSLookahead;
+
+
+/* the value network of Nn/net_builder.lua, for inference on the CPU
+
+   the weights are copied when each layer is added, so the network does not
+   depend on the torch model after it is built */
+typedef struct {
+  int inputSize;
+  int outputSize;
+  int layerCount;
+  int maxWidth;
+  int precision;
+
+  int layerInputs[ DS_MAX_NET_LAYERS ];
+  int layerOutputs[ DS_MAX_NET_LAYERS ];
+  /* 0 for no PReLU, 1 for a shared PReLU weight, else layerOutputs */
+  int preluCount[ DS_MAX_NET_LAYERS ];
+
+  /* the outputs are padded to a whole number of tiles, and the weights of
+     each tile are stored together, transposed to inputs x tile columns */
+  float *weights[ DS_MAX_NET_LAYERS ];
+  float *biases[ DS_MAX_NET_LAYERS ];
+  float *preluWeights[ DS_MAX_NET_LAYERS ];
+
+  /* the weights in the same layout as bf16 or int8 when the precision is
+     not DS_PRECISION_FLOAT, with the int8 scales of each output */
+  void *quantizedWeights[ DS_MAX_NET_LAYERS ];
+  float *scales[ DS_MAX_NET_LAYERS ];
+
+  /* padded inputs and intermediate values, grown as needed */
+  int rowCapacity;
+  float *input;
+  float *buffers[ 2 ];
+} DSValueNet;
+
+
+/* a memory-mapped training data file, written by
+   Training/main_convert_data.lua: a header of 8 int32s (magic, version,
+   input, target and mask sizes, row count, two unused) followed by the
+   rows, each the float inputs, targets and mask of one example */
+typedef struct {
+  int inputSize;
+  int targetSize;
+  int maskSize;
+  int rowCount;
+  int rowSize;
+
+  const char *map;
+  size_t length;
+  const float *rows;
+} DSDataFile;
+
+/* shuffled batches of a DSDataFile, assembled by a prefetch thread */
+typedef struct DSBatchReader DSBatchReader;
+
+
+/* trains a value network on the CPU with several threads, see trainer.c */
+typedef struct DSTrainer DSTrainer;
+
+
+/* regret matching for one lookahead layer, fusing the steps of
+   Lookahead:_compute_current_strategies: the strategy is the positive
+   regrets (clamped to [1e-9, 999999]) times the empty action mask,
+   normalised over the actions.  All three tensors are
+   actions x columns */
+void dsRegretMatching( const float *regrets, const float *mask,
+		       float *strategy, const int actions,
+		       const int columns );
+
+/* create a lookahead for batchSize situations of a tree with the given
+   layer counts.  Each count array holds layers -1 to depth, in that order
+   returns NULL on failure */
+DSLookahead *dsLookaheadNew( const int depth, const int cardCount,
+			     const int batchSize,
+			     const int *actionsCount,
+			     const int *betsCount,
+			     const int *nonallinBetsCount,
+			     const int *terminalActionsCount,
+			     const int *nonterminalNonallinNodesCount );
+
+void dsLookaheadFree( DSLookahead *la );
+
+/* point layer d (1 to depth) at the caller's tensors.  Strategies,
+   regrets and masks are not used on layer 1 and may be NULL there */
+void dsLookaheadSetLayer( DSLookahead *la, const int d,
+			  float *ranges, float *cfvs, float *potSize,
+			  float *currentStrategy, float *regrets,
+			  float *emptyActionMask );
+
+/* set the accumulated average strategy at the root (layer 2) and the
+   average cfvs of layers 1 and 2 */
+void dsLookaheadSetAverages( DSLookahead *la, float *averageStrategies,
+			     float *averageCfvs1, float *averageCfvs2 );
+
+/* set the terminal equity matrices, each cardCount x cardCount */
+void dsLookaheadSetTerminalEquity( DSLookahead *la, const int street,
+				   const int firstCallTerminal,
+				   const float *callMatrix,
+				   const float *foldMatrix );
+
+/* use the CFR-D gadget to generate the opponent's root range from the
+   opponent's cfvs before re-solving, as CFRDGadget does.  Only a batch of
+   one situation can use the gadget
+   returns >= 0 on success, -1 on failure */
+int dsLookaheadSetGadget( DSLookahead *la, const float *opponentCfvs,
+			  const float *rangeMask );
+
+/* the first half of a CFR iteration: the gadget range, current
+   strategies, ranges and average strategy.  After this, the ranges of
+   every layer are up to date */
+void dsLookaheadStartIteration( DSLookahead *la, const int iter,
+				const int skipIters );
+
+/* the second half of a CFR iteration: terminal values, cfvs, regrets and
+   average cfvs.  Any values from the neural net must already be in the
+   cfvs of the transition nodes */
+void dsLookaheadFinishIteration( DSLookahead *la, const int iter,
+				 const int skipIters );
+
+/* run iterations firstIter to lastIter, for lookaheads which do not
+   need the neural net between the two halves of an iteration */
+void dsLookaheadCompute( DSLookahead *la, const int firstIter,
+			 const int lastIter, const int skipIters );
+
+/* create a value network with inputSize inputs and outputSize outputs.
+   The first outputSize inputs are the ranges used by the zero-sum
+   correction
+   returns NULL on failure */
+DSValueNet *dsValueNetNew( const int inputSize, const int outputSize );
+
+void dsValueNetFree( DSValueNet *net );
+
+/* add a linear layer with the weight (outputs x inputs, as in nn.Linear)
+   and bias, followed by a PReLU with preluCount weights if preluCount is
+   not 0
+   returns >= 0 on success, -1 on failure */
+int dsValueNetAddLayer( DSValueNet *net, const int inputs, const int outputs,
+			const float *weight, const float *bias,
+			const int preluCount, const float *preluWeight );
+
+/* keep the weights of every layer added so far with the given
+   DS_PRECISION_ precision.  The float weights are kept as well, so the
+   precision can be changed again, but no more layers can be added unless
+   the precision is DS_PRECISION_FLOAT
+   returns >= 0 on success, -1 on failure */
+int dsValueNetSetPrecision( DSValueNet *net, const int precision );
+
+/* compute the network's rows x outputSize outputs for rows x inputSize
+   inputs, including the zero-sum correction
+   returns >= 0 on success, -1 on failure */
+int dsValueNetForward( DSValueNet *net, const float *inputs,
+		       float *outputs, const int rows );
+
+/* create a trainer for a network with inputSize inputs and outputSize
+   outputs, of which the first outputSize inputs are the ranges used by the
+   zero-sum correction.  Steps use threadCount threads, including the
+   caller's, and Adam with the given parameters
+   returns NULL on failure */
+DSTrainer *dsTrainerNew( const int inputSize, const int outputSize,
+			 const int threadCount, const float learningRate,
+			 const float beta1, const float beta2,
+			 const float epsilon );
+
+void dsTrainerFree( DSTrainer *trainer );
+
+/* add a linear layer, followed by a PReLU with preluCount weights if
+   preluCount is not 0.  The weight (outputs x inputs, as in nn.Linear),
+   bias and PReLU weights are the caller's, which are updated in place and
+   must stay allocated.  Layers must be added before the first step
+   returns >= 0 on success, -1 on failure */
+int dsTrainerAddLayer( DSTrainer *trainer, const int inputs,
+		       const int outputs, float *weight, float *bias,
+		       const int preluCount, float *preluWeight );
+
+/* one Adam step on a batch of rows inputs, targets and masks (the mask
+   as wide as the outputs)
+   returns the batch's masked Huber loss before the step, -1 on failure */
+double dsTrainerStep( DSTrainer *trainer, const float *inputs,
+		      const float *targets, const float *mask,
+		      const int rows );
+
+/* the masked Huber loss of a batch, without training
+   returns -1 on failure */
+double dsTrainerLoss( DSTrainer *trainer, const float *inputs,
+		      const float *targets, const float *mask,
+		      const int rows );
+
+/* map a training data file
+   returns NULL on failure */
+DSDataFile *dsDataFileOpen( const char *fileName );
+
+void dsDataFileClose( DSDataFile *file );
+
+/* create a reader of batchSize examples from file, which must stay open.
+   Epochs take the file's chunks of chunkRows rows in a random order and
+   shuffle the rows within windows of windowChunks chunks.  Each mask is
+   repeated maskRepeat times, and up to slotCount batches are assembled
+   ahead of the caller
+   returns NULL on failure */
+DSBatchReader *dsBatchReaderNew( const DSDataFile *file, const int batchSize,
+				 const int chunkRows, const int windowChunks,
+				 const int maskRepeat, const int slotCount );
+
+void dsBatchReaderFree( DSBatchReader *reader );
+
+/* the number of whole batches in an epoch; the remaining rows are skipped */
+int dsBatchReaderBatchCount( const DSBatchReader *reader );
+
+/* start a new epoch, stopping the current one.  Without shuffle, the rows
+   are read in file order
+   returns >= 0 on success, -1 on failure */
+int dsBatchReaderStartEpoch( DSBatchReader *reader, const int shuffle,
+			     const uint64_t seed );
+
+/* copy the next batch of the epoch into the caller's batchSize x inputSize,
+   batchSize x targetSize and batchSize x maskSize * maskRepeat buffers,
+   waiting for the prefetch thread if needed
+   returns the number of rows copied, 0 at the end of the epoch */
+int dsBatchReaderNext( DSBatchReader *reader, float *inputs, float *targets,
+		       float *mask );
+
+/* fill strengths, boardCount x (rankCount * suitCount), with the strength
+   of every private card on every board of boardCardCount (1 or 2) cards,
+   as computed by Game/Evaluation/evaluator.lua.  Boards are in the order
+   of card_tools:get_second_round_boards, and cards on the board get
+   impossibleValue
+   returns the number of boards, -1 on failure */
+int dsEvaluateBoards( const int rankCount, const int suitCount,
+		      const int boardCardCount, const float impossibleValue,
+		      float *strengths );
+
+#endif
@@ -0,0 +1,109 @@
+/*
+Builds the table of Leduc hand strengths used by
+Game/Evaluation/evaluator.lua: the strength of every private card on every
+board of the last round, with the boards in the order of
+card_tools:get_second_round_boards.
+
+Strengths follow the Lua evaluator, where a lower value is a stronger hand
+and hands contain no more than two cards of a rank.
+*/
+
+#include "deepstack_native.h"
+
+#define DS_MAX_HAND_CARDS 3
+
+/* the strength of a hand of cardCount sorted ranks */
+static float handStrength( const int *ranks, const int cardCount,
+			   const int rankCount )
+{
+  if( cardCount == 2 ) {
+
+    if( ranks[ 0 ] == ranks[ 1 ] ) {
+      /* pair */
+      return ranks[ 0 ];
+    }
+    /* high card */
+    return ranks[ 0 ] * rankCount + ranks[ 1 ];
+  }
+
+  if( ranks[ 0 ] == ranks[ 1 ] ) {
+    /* pair first, then the kicker */
+    return ranks[ 0 ] * rankCount + ranks[ 2 ];
+  }
+  if( ranks[ 1 ] == ranks[ 2 ] ) {
+    return ranks[ 1 ] * rankCount + ranks[ 0 ];
+  }
+  /* high card */
+  return ( ranks[ 0 ] * rankCount + ranks[ 1 ] ) * rankCount + ranks[ 2 ];
+}
+
+/* fill one board's row of strengths */
+static void evaluateBoard( const int *board, const int boardCardCount,
+			   const int cardCount, const int suitCount,
+			   const int rankCount, const float impossibleValue,
+			   float *row )
+{
+  int hand, i, j, card, blocked, rank;
+  int ranks[ DS_MAX_HAND_CARDS ];
+
+  for( hand = 0; hand < cardCount; ++hand ) {
+
+    blocked = 0;
+    for( i = 0; i < boardCardCount; ++i ) {
+      if( board[ i ] == hand ) {
+	blocked = 1;
+      }
+    }
+    if( blocked ) {
+      row[ hand ] = impossibleValue;
+      continue;
+    }
+
+    /* insertion sort of the ranks, counted from 1 as in the Lua code */
+    for( i = 0; i <= boardCardCount; ++i ) {
+      card = i < boardCardCount ? board[ i ] : hand;
+      rank = card / suitCount + 1;
+      for( j = i; j > 0 && ranks[ j - 1 ] > rank; --j ) {
+	ranks[ j ] = ranks[ j - 1 ];
+      }
+      ranks[ j ] = rank;
+    }
+    row[ hand ] = handStrength( ranks, boardCardCount + 1, rankCount );
+  }
+}
+
+int dsEvaluateBoards( const int rankCount, const int suitCount,
+		      const int boardCardCount, const float impossibleValue,
+		      float *strengths )
+{
+  const int cardCount = rankCount * suitCount;
+  int board[ DS_MAX_HAND_CARDS - 1 ];
+  int boardCount = 0;
+
+  if( rankCount <= 0 || suitCount <= 0 ) {
+    return -1;
+  }
+
+  if( boardCardCount == 1 ) {
+
+    for( board[ 0 ] = 0; board[ 0 ] < cardCount; ++board[ 0 ] ) {
+      evaluateBoard( board, 1, cardCount, suitCount, rankCount,
+		     impossibleValue, &strengths[ boardCount * cardCount ] );
+      ++boardCount;
+    }
+  } else if( boardCardCount == 2 ) {
+
+    for( board[ 0 ] = 0; board[ 0 ] < cardCount; ++board[ 0 ] ) {
+      for( board[ 1 ] = board[ 0 ] + 1; board[ 1 ] < cardCount;
+	   ++board[ 1 ] ) {
+	evaluateBoard( board, 2, cardCount, suitCount, rankCount,
+		       impossibleValue, &strengths[ boardCount * cardCount ] );
+	++boardCount;
+      }
+    }
+  } else {
+    return -1;
+  }
+
+  return boardCount;
+}
@@ -0,0 +1,625 @@
+/*
+Native CFR+ iterations for a DeepStack lookahead
+
+Each function here does the work of one of the Lookahead:_compute_* steps
+in Lookahead/lookahead.lua for a whole layer in a single pass, on the same
+tensors.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "deepstack_native.h"
+
+#define NUM_PLAYERS 2
+
+/* same constants as Lookahead and CFRDGadget */
+#define REGRET_EPSILON ( 1.0f / 1000000000 )
+#define GADGET_REGRET_EPSILON ( 1.0f / 100000000 )
+#define MAX_NUMBER 999999.0f
+
+/* columns handled at once by dsRegretMatching */
+#define REGRET_MATCHING_BLOCK 256
+
+/* counts are stored from layer -1 */
+#define COUNT( array, layer ) ( array[ ( layer ) + 1 ] )
+
+
+/* dimensions of the tensors on layer d */
+static int layerActions( const DSLookahead *la, const int d )
+{
+  return COUNT( la->actionsCount, d - 1 );
+}
+
+static int layerParents( const DSLookahead *la, const int d )
+{
+  return COUNT( la->betsCount, d - 2 );
+}
+
+static int layerGrandparents( const DSLookahead *la, const int d )
+{
+  return d == 1 ? 1 : COUNT( la->nonterminalNonallinNodesCount, d - 2 );
+}
+
+/* the player who acts on layer d, as an index into the players dimension */
+static int actingPlayer( const int d )
+{
+  return d % 2 ? 0 : 1;
+}
+
+static float clampf( const float x, const float min, const float max )
+{
+  return x < min ? min : ( x > max ? max : x );
+}
+
+
+DSLookahead *dsLookaheadNew( const int depth, const int cardCount,
+			     const int batchSize,
+			     const int *actionsCount,
+			     const int *betsCount,
+			     const int *nonallinBetsCount,
+			     const int *terminalActionsCount,
+			     const int *nonterminalNonallinNodesCount )
+{
+  int d, size, maxSize;
+  DSLookahead *la;
+
+  if( depth < 2 || depth > DS_MAX_DEPTH || cardCount <= 0
+      || batchSize <= 0 ) {
+
+    return NULL;
+  }
+
+  la = (DSLookahead *)calloc( 1, sizeof( *la ) );
+  if( la == NULL ) {
+
+    return NULL;
+  }
+  la->depth = depth;
+  la->cardCount = cardCount;
+  la->batchSize = batchSize;
+  memcpy( la->actionsCount, actionsCount, ( depth + 2 ) * sizeof( int ) );
+  memcpy( la->betsCount, betsCount, ( depth + 2 ) * sizeof( int ) );
+  memcpy( la->nonallinBetsCount, nonallinBetsCount,
+	  ( depth + 2 ) * sizeof( int ) );
+  memcpy( la->terminalActionsCount, terminalActionsCount,
+	  ( depth + 2 ) * sizeof( int ) );
+  memcpy( la->nonterminalNonallinNodesCount, nonterminalNonallinNodesCount,
+	  ( depth + 2 ) * sizeof( int ) );
+
+  /* each layer's grandparent dimension must split into the parent
+     layer's grandparents and non-allin bets, since that is how ranges
+     are passed down and cfvs passed up */
+  maxSize = 0;
+  for( d = 2; d <= depth; ++d ) {
+
+    if( d > 2 && layerGrandparents( la, d )
+	!= layerGrandparents( la, d - 1 )
+	* COUNT( la->nonallinBetsCount, d - 3 ) ) {
+
+      free( la );
+      return NULL;
+    }
+
+    size = layerParents( la, d ) * layerGrandparents( la, d )
+      * batchSize * NUM_PLAYERS * cardCount;
+    if( size > maxSize ) {
+      maxSize = size;
+    }
+  }
+
+  la->actionSum = (float *)malloc( maxSize * sizeof( float ) );
+  if( la->actionSum == NULL ) {
+
+    free( la );
+    return NULL;
+  }
+
+  return la;
+}
+
+void dsLookaheadFree( DSLookahead *la )
+{
+  if( la == NULL ) {
+    return;
+  }
+
+  free( la->actionSum );
+  free( la->gadgetValues );
+  free( la );
+}
+
+void dsLookaheadSetLayer( DSLookahead *la, const int d,
+			  float *ranges, float *cfvs, float *potSize,
+			  float *currentStrategy, float *regrets,
+			  float *emptyActionMask )
+{
+  la->ranges[ d ] = ranges;
+  la->cfvs[ d ] = cfvs;
+  la->potSize[ d ] = potSize;
+  la->currentStrategy[ d ] = currentStrategy;
+  la->regrets[ d ] = regrets;
+  la->emptyActionMask[ d ] = emptyActionMask;
+}
+
+void dsLookaheadSetAverages( DSLookahead *la, float *averageStrategies,
+			     float *averageCfvs1, float *averageCfvs2 )
+{
+  la->averageStrategies = averageStrategies;
+  la->averageCfvs[ 1 ] = averageCfvs1;
+  la->averageCfvs[ 2 ] = averageCfvs2;
+}
+
+void dsLookaheadSetTerminalEquity( DSLookahead *la, const int street,
+				   const int firstCallTerminal,
+				   const float *callMatrix,
+				   const float *foldMatrix )
+{
+  la->street = street;
+  la->firstCallTerminal = firstCallTerminal;
+  la->callMatrix = callMatrix;
+  la->foldMatrix = foldMatrix;
+}
+
+int dsLookaheadSetGadget( DSLookahead *la, const float *opponentCfvs,
+			  const float *rangeMask )
+{
+  int k;
+  const int K = la->cardCount;
+
+  /* the gadget is only used to re-solve a single situation */
+  if( la->batchSize != 1 ) {
+
+    return -1;
+  }
+
+  if( la->gadgetValues == NULL ) {
+
+    /* all of the gadget vectors share one allocation */
+    la->gadgetValues = (float *)malloc( 6 * K * sizeof( float ) );
+    if( la->gadgetValues == NULL ) {
+
+      return -1;
+    }
+    la->gadgetMask = la->gadgetValues + K;
+    la->playRegrets = la->gadgetValues + 2 * K;
+    la->terminateRegrets = la->gadgetValues + 3 * K;
+    la->playStrategy = la->gadgetValues + 4 * K;
+    la->terminateStrategy = la->gadgetValues + 5 * K;
+  }
+
+  for( k = 0; k < K; ++k ) {
+
+    la->gadgetValues[ k ] = opponentCfvs[ k ];
+    la->gadgetMask[ k ] = rangeMask[ k ];
+    la->playRegrets[ k ] = 0;
+    la->terminateRegrets[ k ] = 0;
+    la->playStrategy[ k ] = 0;
+    la->terminateStrategy[ k ] = 1;
+  }
+  la->useGadget = 1;
+
+  return 0;
+}
+
+
+/* one iteration of the gadget game, giving the opponent's root range
+   from the opponent's root cfvs of the last iteration */
+static void gadgetRange( DSLookahead *la )
+{
+  int k;
+  float total, play, terminate, sum;
+  const int K = la->cardCount;
+  /* cfvs have swapped player indexing, so the opponent is player 1 */
+  const float *playValues = la->cfvs[ 1 ];
+  float *opponentRange = la->ranges[ 1 ] + K;
+
+  for( k = 0; k < K; ++k ) {
+
+    total = playValues[ k ] * la->playStrategy[ k ]
+      + la->gadgetValues[ k ] * la->terminateStrategy[ k ];
+
+    /* CFR+ regrets */
+    play = clampf( la->playRegrets[ k ] + ( playValues[ k ] - total ),
+		   GADGET_REGRET_EPSILON, MAX_NUMBER );
+    terminate = clampf( la->terminateRegrets[ k ]
+			+ ( la->gadgetValues[ k ] - total ),
+			GADGET_REGRET_EPSILON, MAX_NUMBER );
+    la->playRegrets[ k ] = play;
+    la->terminateRegrets[ k ] = terminate;
+
+    /* regret matching, masking out hands that are not possible */
+    sum = play + terminate;
+    la->playStrategy[ k ] = play / sum * la->gadgetMask[ k ];
+    la->terminateStrategy[ k ] = terminate / sum * la->gadgetMask[ k ];
+
+    opponentRange[ k ] = la->playStrategy[ k ];
+  }
+}
+
+void dsRegretMatching( const float *restrict regrets,
+		       const float *restrict mask,
+		       float *restrict strategy,
+		       const int actions, const int columns )
+{
+  int start, end, a, i;
+  float r;
+  float sum[ REGRET_MATCHING_BLOCK ];
+
+  /* work on a block of columns at a time, so the block's regrets, masks
+     and strategies for every action are still in the cache when the
+     strategies are normalised.  The loops over columns have no
+     dependencies, so the compiler turns them into vector instructions */
+  for( start = 0; start < columns; start += REGRET_MATCHING_BLOCK ) {
+
+    end = start + REGRET_MATCHING_BLOCK < columns
+      ? start + REGRET_MATCHING_BLOCK : columns;
+
+    for( i = start; i < end; ++i ) {
+
+      sum[ i - start ] = 0;
+    }
+
+    /* positive regrets of the actions that exist */
+    for( a = 0; a < actions; ++a ) {
+
+      const float *regretRow = regrets + a * columns;
+      const float *maskRow = mask + a * columns;
+      float *strategyRow = strategy + a * columns;
+
+      for( i = start; i < end; ++i ) {
+
+	r = clampf( regretRow[ i ], REGRET_EPSILON, MAX_NUMBER ) * maskRow[ i ];
+	strategyRow[ i ] = r;
+	sum[ i - start ] += r;
+      }
+    }
+
+    for( a = 0; a < actions; ++a ) {
+
+      float *strategyRow = strategy + a * columns;
+
+      for( i = start; i < end; ++i ) {
+
+	strategyRow[ i ] /= sum[ i - start ];
+      }
+    }
+  }
+}
+
+/* regret matching on every layer */
+static void currentStrategies( DSLookahead *la )
+{
+  int d;
+
+  for( d = 2; d <= la->depth; ++d ) {
+
+    dsRegretMatching( la->regrets[ d ], la->emptyActionMask[ d ],
+		      la->currentStrategy[ d ], layerActions( la, d ),
+		      layerParents( la, d ) * layerGrandparents( la, d )
+		      * la->batchSize * la->cardCount );
+  }
+}
+
+/* pass ranges down the layers, multiplying the acting player's range by
+   their current strategy */
+static void computeRanges( DSLookahead *la )
+{
+  int d, a, b, j, g, e, p, k, A, B, N, childB, childN, gpBets, terminal, p0;
+  const int K = la->cardCount;
+  const int E = la->batchSize;
+  const float *parent, *strategy;
+  float *child;
+
+  for( d = 1; d < la->depth; ++d ) {
+
+    N = layerGrandparents( la, d );
+    B = layerParents( la, d );
+    terminal = COUNT( la->terminalActionsCount, d - 1 );
+    gpBets = COUNT( la->nonallinBetsCount, d - 2 );
+    A = layerActions( la, d + 1 );
+    childB = layerParents( la, d + 1 );
+    childN = layerGrandparents( la, d + 1 );
+    p0 = actingPlayer( d );
+
+    for( a = 0; a < A; ++a ) {
+      for( b = 0; b < childB; ++b ) {
+	for( j = 0; j < N; ++j ) {
+	  for( g = 0; g < gpBets; ++g ) {
+
+	    /* the parent is a bet on layer d */
+	    parent = la->ranges[ d ]
+	      + ( ( ( terminal + b ) * B + g ) * N + j ) * E * NUM_PLAYERS * K;
+	    child = la->ranges[ d + 1 ]
+	      + ( ( a * childB + b ) * childN + j * gpBets + g )
+	      * E * NUM_PLAYERS * K;
+	    strategy = la->currentStrategy[ d + 1 ]
+	      + ( ( a * childB + b ) * childN + j * gpBets + g ) * E * K;
+
+	    for( e = 0; e < E; ++e ) {
+	      for( p = 0; p < NUM_PLAYERS; ++p ) {
+
+		const int r = ( e * NUM_PLAYERS + p ) * K;
+
+		if( p == p0 ) {
+
+		  for( k = 0; k < K; ++k ) {
+
+		    child[ r + k ] = parent[ r + k ] * strategy[ e * K + k ];
+		  }
+		} else {
+
+		  for( k = 0; k < K; ++k ) {
+
+		    child[ r + k ] = parent[ r + k ];
+		  }
+		}
+	      }
+	    }
+	  }
+	}
+      }
+    }
+  }
+}
+
+/* rows x cardCount outputs from rows x cardCount inputs times a
+   cardCount x cardCount matrix */
+static void rangesTimesMatrix( const float *ranges, const float *matrix,
+			       float *out, const int rows, const int K )
+{
+  int r, l, k;
+  float v;
+
+  for( r = 0; r < rows; ++r ) {
+
+    for( k = 0; k < K; ++k ) {
+
+      out[ r * K + k ] = 0;
+    }
+    for( l = 0; l < K; ++l ) {
+
+      v = ranges[ r * K + l ];
+      if( v == 0 ) {
+	continue;
+      }
+      for( k = 0; k < K; ++k ) {
+
+	out[ r * K + k ] += v * matrix[ l * K + k ];
+      }
+    }
+  }
+}
+
+/* values of the terminal nodes of every layer, scaled by the pot size.
+   Values of call transitions on the first street come from the neural
+   net and are left alone, apart from the pot size */
+static void terminalEquities( DSLookahead *la )
+{
+  int d, i, j, B, N, size;
+  float foldMultiplier;
+  const int K = la->cardCount;
+  const int rowSize = NUM_PLAYERS * K;
+  /* every situation of the batch is a pair of rows */
+  const int nodeSize = la->batchSize * rowSize;
+  const int nodeRows = la->batchSize * NUM_PLAYERS;
+  float *cfvs;
+
+  for( d = 2; d <= la->depth; ++d ) {
+
+    B = layerParents( la, d );
+    N = layerGrandparents( la, d );
+    cfvs = la->cfvs[ d ];
+
+    /* calls, which are action 2 */
+    if( d > 2 || la->firstCallTerminal ) {
+
+      if( la->street == 1 ) {
+	/* only calling an allin (the last parent bet) ends the game */
+
+	rangesTimesMatrix( la->ranges[ d ] + ( ( B + B - 1 ) * N ) * nodeSize,
+			   la->callMatrix,
+			   cfvs + ( ( B + B - 1 ) * N ) * nodeSize,
+			   N * nodeRows, K );
+      } else {
+
+	rangesTimesMatrix( la->ranges[ d ] + B * N * nodeSize, la->callMatrix,
+			   cfvs + B * N * nodeSize, B * N * nodeRows, K );
+      }
+    }
+
+    /* folds, which are action 1 */
+    rangesTimesMatrix( la->ranges[ d ], la->foldMatrix, cfvs,
+		       B * N * nodeRows, K );
+    foldMultiplier = actingPlayer( d ) == 0 ? -1.0f : 1.0f;
+    for( i = 0; i < B * N * la->batchSize; ++i ) {
+
+      for( j = 0; j < K; ++j ) {
+
+	cfvs[ i * rowSize + j ] *= foldMultiplier;
+	cfvs[ i * rowSize + K + j ] *= -foldMultiplier;
+      }
+    }
+
+    /* scale everything by the pot size */
+    size = layerActions( la, d ) * B * N * nodeSize;
+    for( i = 0; i < size; ++i ) {
+
+      cfvs[ i ] *= la->potSize[ d ][ i ];
+    }
+  }
+}
+
+/* pass cfvs up the layers, weighting the acting player's values by
+   their current strategy */
+static void computeCfvs( DSLookahead *la )
+{
+  int d, a, i, b, j, g, e, p, k, A, B, N, columns, parentN, gpTerminal,
+    ggpBets, p0;
+  const int K = la->cardCount;
+  const int E = la->batchSize;
+  const int nodeSize = E * NUM_PLAYERS * K;
+  const float *mask, *strategy, *sum;
+  float *cfvs, *out;
+
+  for( d = la->depth; d >= 2; --d ) {
+
+    A = layerActions( la, d );
+    B = layerParents( la, d );
+    N = layerGrandparents( la, d );
+    columns = B * N;
+    gpTerminal = COUNT( la->terminalActionsCount, d - 2 );
+    ggpBets = COUNT( la->nonallinBetsCount, d - 3 );
+    parentN = layerGrandparents( la, d - 1 );
+    p0 = actingPlayer( d );
+    cfvs = la->cfvs[ d ];
+    mask = la->emptyActionMask[ d ];
+    strategy = la->currentStrategy[ d ];
+
+    /* mask out empty actions, then sum the actions weighted by the
+       acting player's strategy */
+    for( i = 0; i < columns * nodeSize; ++i ) {
+
+      la->actionSum[ i ] = 0;
+    }
+    for( a = 0; a < A; ++a ) {
+      for( i = 0; i < columns; ++i ) {
+	for( e = 0; e < E; ++e ) {
+	  for( p = 0; p < NUM_PLAYERS; ++p ) {
+	    for( k = 0; k < K; ++k ) {
+
+	      const int s = ( ( a * columns + i ) * E + e ) * K + k;
+	      const int c = ( ( ( a * columns + i ) * E + e ) * NUM_PLAYERS + p )
+		* K + k;
+
+	      cfvs[ c ] *= mask[ s ];
+	      la->actionSum[ ( ( i * E + e ) * NUM_PLAYERS + p ) * K + k ]
+		+= p == p0 ? cfvs[ c ] * strategy[ s ] : cfvs[ c ];
+	    }
+	  }
+	}
+      }
+    }
+
+    /* the sums are the values of the parent bets on layer d - 1 */
+    for( b = 0; b < B; ++b ) {
+      for( j = 0; j < parentN; ++j ) {
+	for( g = 0; g < ggpBets; ++g ) {
+
+	  sum = la->actionSum + ( b * N + j * ggpBets + g ) * nodeSize;
+	  out = la->cfvs[ d - 1 ]
+	    + ( ( ( gpTerminal + b ) * layerParents( la, d - 1 ) + g )
+		* parentN + j ) * nodeSize;
+	  memcpy( out, sum, nodeSize * sizeof( float ) );
+	}
+      }
+    }
+  }
+}
+
+/* CFR+ regret updates for every layer */
+static void computeRegrets( DSLookahead *la )
+{
+  int d, a, b, j, g, e, k, A, B, N, parentN, gpTerminal, ggpBets, p0;
+  const int K = la->cardCount;
+  const int E = la->batchSize;
+  const float *cfvs, *parent;
+  float *regrets;
+
+  for( d = la->depth; d >= 2; --d ) {
+
+    A = layerActions( la, d );
+    B = layerParents( la, d );
+    N = layerGrandparents( la, d );
+    gpTerminal = COUNT( la->terminalActionsCount, d - 2 );
+    ggpBets = COUNT( la->nonallinBetsCount, d - 3 );
+    parentN = layerGrandparents( la, d - 1 );
+    p0 = actingPlayer( d );
+
+    for( a = 0; a < A; ++a ) {
+      for( b = 0; b < B; ++b ) {
+	for( j = 0; j < parentN; ++j ) {
+	  for( g = 0; g < ggpBets; ++g ) {
+
+	    const int column = ( a * B + b ) * N + j * ggpBets + g;
+
+	    const int parentNode = ( ( gpTerminal + b )
+				     * layerParents( la, d - 1 ) + g )
+	      * parentN + j;
+
+	    for( e = 0; e < E; ++e ) {
+
+	      cfvs = la->cfvs[ d ]
+		+ ( ( column * E + e ) * NUM_PLAYERS + p0 ) * K;
+	      regrets = la->regrets[ d ] + ( column * E + e ) * K;
+	      parent = la->cfvs[ d - 1 ]
+		+ ( ( parentNode * E + e ) * NUM_PLAYERS + p0 ) * K;
+
+	      for( k = 0; k < K; ++k ) {
+
+		regrets[ k ] = clampf( regrets[ k ] + ( cfvs[ k ] - parent[ k ] ),
+				       0, MAX_NUMBER );
+	      }
+	    }
+	  }
+	}
+      }
+    }
+  }
+}
+
+static void addTo( float *sum, const float *x, const int size )
+{
+  int i;
+
+  for( i = 0; i < size; ++i ) {
+
+    sum[ i ] += x[ i ];
+  }
+}
+
+void dsLookaheadStartIteration( DSLookahead *la, const int iter,
+				const int skipIters )
+{
+  if( la->useGadget ) {
+
+    gadgetRange( la );
+  }
+  currentStrategies( la );
+  computeRanges( la );
+
+  /* only the root's average strategy is needed */
+  if( iter > skipIters ) {
+
+    addTo( la->averageStrategies, la->currentStrategy[ 2 ],
+	   layerActions( la, 2 ) * la->batchSize * la->cardCount );
+  }
+}
+
+void dsLookaheadFinishIteration( DSLookahead *la, const int iter,
+				 const int skipIters )
+{
+  terminalEquities( la );
+  computeCfvs( la );
+  computeRegrets( la );
+
+  if( iter > skipIters ) {
+
+    addTo( la->averageCfvs[ 1 ], la->cfvs[ 1 ],
+	   la->batchSize * NUM_PLAYERS * la->cardCount );
+    addTo( la->averageCfvs[ 2 ], la->cfvs[ 2 ],
+	   layerActions( la, 2 ) * la->batchSize * NUM_PLAYERS
+	   * la->cardCount );
+  }
+}
+
+void dsLookaheadCompute( DSLookahead *la, const int firstIter,
+			 const int lastIter, const int skipIters )
+{
+  int iter;
+
+  for( iter = firstIter; iter <= lastIter; ++iter ) {
+
+    dsLookaheadStartIteration( la, iter, skipIters );
+    dsLookaheadFinishIteration( la, iter, skipIters );
+  }
+}
@@ -0,0 +1,142 @@
+--- Loads the native DeepStack library built in `Source/Native` (run `make`
+-- there) through the LuaJIT FFI.
+--
+-- The library is optional: @{available} tells whether it could be loaded,
+-- and Lua code falls back to its own implementation when it is not wanted.
+-- @module native
+
+local ffi = require 'ffi'
+local arguments = require 'Settings.arguments'
+
+ffi.cdef[[
+typedef struct DSLookahead DSLookahead;
+typedef struct DSValueNet DSValueNet;
+
+void dsRegretMatching(const float *regrets, const float *mask,
+                      float *strategy, const int actions,
+                      const int columns);
+
+DSLookahead *dsLookaheadNew(const int depth, const int cardCount,
+                            const int batchSize,
+                            const int *actionsCount,
+                            const int *betsCount,
+                            const int *nonallinBetsCount,
+                            const int *terminalActionsCount,
+                            const int *nonterminalNonallinNodesCount);
+void dsLookaheadFree(DSLookahead *la);
+void dsLookaheadSetLayer(DSLookahead *la, const int d,
+                         float *ranges, float *cfvs, float *potSize,
+                         float *currentStrategy, float *regrets,
+                         float *emptyActionMask);
+void dsLookaheadSetAverages(DSLookahead *la, float *averageStrategies,
+                            float *averageCfvs1, float *averageCfvs2);
+void dsLookaheadSetTerminalEquity(DSLookahead *la, const int street,
+                                  const int firstCallTerminal,
+                                  const float *callMatrix,
+                                  const float *foldMatrix);
+int dsLookaheadSetGadget(DSLookahead *la, const float *opponentCfvs,
+                         const float *rangeMask);
+void dsLookaheadStartIteration(DSLookahead *la, const int iter,
+                               const int skipIters);
+void dsLookaheadFinishIteration(DSLookahead *la, const int iter,
+                                const int skipIters);
+void dsLookaheadCompute(DSLookahead *la, const int firstIter,
+                        const int lastIter, const int skipIters);
+
+DSValueNet *dsValueNetNew(const int inputSize, const int outputSize);
+void dsValueNetFree(DSValueNet *net);
+int dsValueNetAddLayer(DSValueNet *net, const int inputs, const int outputs,
+                       const float *weight, const float *bias,
+                       const int preluCount, const float *preluWeight);
+int dsValueNetSetPrecision(DSValueNet *net, const int precision);
+int dsValueNetForward(DSValueNet *net, const float *inputs,
+                      float *outputs, const int rows);
+
+typedef struct {
+  int inputSize;
+  int targetSize;
+  int maskSize;
+  int rowCount;
+  int rowSize;
+  const char *map;
+  size_t length;
+  const float *rows;
+} DSDataFile;
+typedef struct DSBatchReader DSBatchReader;
+typedef struct DSTrainer DSTrainer;
+
+DSDataFile *dsDataFileOpen(const char *fileName);
+void dsDataFileClose(DSDataFile *file);
+DSBatchReader *dsBatchReaderNew(const DSDataFile *file, const int batchSize,
+                                const int chunkRows, const int windowChunks,
+                                const int maskRepeat, const int slotCount);
+void dsBatchReaderFree(DSBatchReader *reader);
+int dsBatchReaderBatchCount(const DSBatchReader *reader);
+int dsBatchReaderStartEpoch(DSBatchReader *reader, const int shuffle,
+                            const uint64_t seed);
+int dsBatchReaderNext(DSBatchReader *reader, float *inputs, float *targets,
+                      float *mask);
+
+DSTrainer *dsTrainerNew(const int inputSize, const int outputSize,
+                        const int threadCount, const float learningRate,
+                        const float beta1, const float beta2,
+                        const float epsilon);
+void dsTrainerFree(DSTrainer *trainer);
+int dsTrainerAddLayer(DSTrainer *trainer, const int inputs,
+                      const int outputs, float *weight, float *bias,
+                      const int preluCount, float *preluWeight);
+double dsTrainerStep(DSTrainer *trainer, const float *inputs,
+                     const float *targets, const float *mask,
+                     const int rows);
+double dsTrainerLoss(DSTrainer *trainer, const float *inputs,
+                     const float *targets, const float *mask,
+                     const int rows);
+
+int dsEvaluateBoards(const int rankCount, const int suitCount,
+                     const int boardCardCount, const float impossibleValue,
+                     float *strengths);
+]]
+
+local M = {}
+
+local loaded, lib = pcall(ffi.load, arguments.native_library)
+--- the loaded library, or `nil` if it could not be loaded
+M.lib = loaded and lib or nil
+
+--- the value net weight precisions, by the names used in
+-- @{arguments.value_net_precision} (the `DS_PRECISION_` values of the header)
+M.precision = {float = 0, bf16 = 1, int8 = 2}
+
+--- Checks whether the native library was loaded.
+-- @return `true` if the library can be used
+function M:available()
+  return self.lib ~= nil
+end
+
+--- Gives a pointer to a tensor's data for passing to the library.
+--
+-- The tensor must stay referenced for as long as the library uses it.
+-- @param tensor a contiguous float tensor on the CPU
+-- @return a `float *` to the tensor's first element
+function M:float_pointer(tensor)
+  assert(torch.type(tensor) == 'torch.FloatTensor', 'native code needs float tensors on the CPU')
+  assert(tensor:isContiguous())
+  return ffi.cast('float *', tensor:data())
+end
+
+--- Converts a Lua table of integers indexed from `first` to `last` to a C
+-- array.
+-- @param values the table
+-- @param first the first index to convert
+-- @param last the last index to convert
+-- @param default the value used for missing entries
+-- @return an `int[]` with the values from `first` to `last`
+function M:int_array(values, first, last, default)
+  local out = ffi.new('int[?]', last - first + 1)
+  for i = first, last do
+    out[i - first] = values[i] or default
+  end
+  return out
+end
+
+return M
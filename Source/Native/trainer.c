@@ -0,0 +1,663 @@
+/*
+Trains the value network of Nn/net_builder.lua on the CPU: a stack of
+linear layers, each optionally followed by a PReLU, and the zero-sum
+correction.
+
+The trainer updates the parameters of the torch model in place, so the
+model can be saved with torch.save as usual.  Each step splits the batch's
+rows between the threads, which run the forward and backward passes and
+the masked Huber loss of Nn/masked_huber_loss.lua on their rows into their
+own gradients.  The threads then sum the gradients and apply Adam (as
+torch's optim.adam) to their share of the parameters.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "deepstack_native.h"
+
+/* the parameters of a layer: weight, bias and PReLU weights */
+#define TRAINER_SEGMENTS 3
+
+/* a barrier whose count can be lowered if some threads fail to start */
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t released;
+  int count;
+  int waiting;
+  int generation;
+} TrainerBarrier;
+
+typedef struct {
+  DSTrainer *trainer;
+  int index;
+  pthread_t thread;
+
+  /* outputs of each layer before and after its PReLU, and the gradients
+     flowing back through the layers */
+  float *pre[ DS_MAX_NET_LAYERS ];
+  float *post[ DS_MAX_NET_LAYERS ];
+  float *gradient[ 2 ];
+  float *parameterGradients[ DS_MAX_NET_LAYERS ][ TRAINER_SEGMENTS ];
+
+  double huberSum;
+  double maskSum;
+} TrainerThread;
+
+struct DSTrainer {
+  int inputSize;
+  int outputSize;
+  int layerCount;
+  int threadCount;
+  int layerInputs[ DS_MAX_NET_LAYERS ];
+  int layerOutputs[ DS_MAX_NET_LAYERS ];
+  int preluCount[ DS_MAX_NET_LAYERS ];
+
+  /* the caller's parameters, with their sizes and Adam state */
+  float *parameters[ DS_MAX_NET_LAYERS ][ TRAINER_SEGMENTS ];
+  int sizes[ DS_MAX_NET_LAYERS ][ TRAINER_SEGMENTS ];
+  float *firstMoments[ DS_MAX_NET_LAYERS ][ TRAINER_SEGMENTS ];
+  float *secondMoments[ DS_MAX_NET_LAYERS ][ TRAINER_SEGMENTS ];
+  /* the weights as inputs x outputs, refreshed before each pass */
+  float *transposed[ DS_MAX_NET_LAYERS ];
+
+  float learningRate;
+  float beta1;
+  float beta2;
+  float epsilon;
+  int stepCount;
+
+  /* the current job, shared by the threads between the barriers */
+  int rowCapacity;
+  int rows;
+  int update;
+  int quit;
+  const float *inputs;
+  const float *targets;
+  const float *mask;
+
+  TrainerThread *threads;
+  TrainerBarrier start;
+  TrainerBarrier computed;
+  TrainerBarrier finished;
+};
+
+
+static void initBarrier( TrainerBarrier *barrier, const int count )
+{
+  pthread_mutex_init( &barrier->lock, NULL );
+  pthread_cond_init( &barrier->released, NULL );
+  barrier->count = count;
+  barrier->waiting = 0;
+  barrier->generation = 0;
+}
+
+static void destroyBarrier( TrainerBarrier *barrier )
+{
+  pthread_cond_destroy( &barrier->released );
+  pthread_mutex_destroy( &barrier->lock );
+}
+
+/* must be called before any thread reaches the barrier for a count of
+   waiting or fewer */
+static void setBarrierCount( TrainerBarrier *barrier, const int count )
+{
+  pthread_mutex_lock( &barrier->lock );
+  barrier->count = count;
+  pthread_mutex_unlock( &barrier->lock );
+}
+
+static void waitBarrier( TrainerBarrier *barrier )
+{
+  int generation;
+
+  pthread_mutex_lock( &barrier->lock );
+  generation = barrier->generation;
+  if( ++barrier->waiting == barrier->count ) {
+
+    barrier->waiting = 0;
+    ++barrier->generation;
+    pthread_cond_broadcast( &barrier->released );
+  } else {
+
+    while( generation == barrier->generation ) {
+      pthread_cond_wait( &barrier->released, &barrier->lock );
+    }
+  }
+  pthread_mutex_unlock( &barrier->lock );
+}
+
+
+/* y += a * x, the inner loop of every layer */
+static void axpy( float *restrict y, const float *restrict x, const float a,
+		  const int count )
+{
+  int i;
+
+  for( i = 0; i < count; ++i ) {
+
+    y[ i ] += a * x[ i ];
+  }
+}
+
+/* forward pass, loss and backward pass of rows first to last - 1 */
+static void computeRows( DSTrainer *trainer, TrainerThread *thread,
+			 const int first, const int last )
+{
+  const int rows = last - first;
+  const int outputSize = trainer->outputSize;
+  const int top = trainer->layerCount - 1;
+  int l, r, i, j, inputs, outputs;
+  const float *in, *ranges, *target, *mask;
+  float *out, *gradientIn, *gradientOut, *row;
+  float dot, sum, difference, scale, maskSum;
+
+  thread->huberSum = 0;
+  thread->maskSum = 0;
+  if( rows <= 0 ) {
+    return;
+  }
+
+  /* forward */
+  in = trainer->inputs + first * trainer->inputSize;
+  for( l = 0; l <= top; ++l ) {
+
+    const float *bias = trainer->parameters[ l ][ 1 ];
+    const float *prelu = trainer->parameters[ l ][ 2 ];
+
+    inputs = trainer->layerInputs[ l ];
+    outputs = trainer->layerOutputs[ l ];
+    for( r = 0; r < rows; ++r ) {
+
+      const float *x = in + r * inputs;
+
+      out = thread->pre[ l ] + r * outputs;
+      memcpy( out, bias, outputs * sizeof( float ) );
+      for( i = 0; i < inputs; ++i ) {
+
+	if( x[ i ] != 0 ) {
+	  axpy( out, trainer->transposed[ l ] + i * outputs, x[ i ], outputs );
+	}
+      }
+
+      row = thread->post[ l ] + r * outputs;
+      for( j = 0; j < outputs; ++j ) {
+
+	row[ j ] = out[ j ];
+	if( trainer->preluCount[ l ] && out[ j ] < 0 ) {
+	  row[ j ] = out[ j ] * prelu[ trainer->preluCount[ l ] == 1 ? 0 : j ];
+	}
+      }
+    }
+    in = thread->post[ l ];
+  }
+
+  /* zero-sum correction and masked Huber loss.  The gradient is the one of
+     MaskedHuberLoss:backward, so each row is scaled by its mask */
+  gradientOut = thread->gradient[ 0 ];
+  for( r = 0; r < rows; ++r ) {
+
+    const float *f = thread->post[ top ] + r * outputSize;
+
+    ranges = trainer->inputs + ( first + r ) * trainer->inputSize;
+    target = trainer->targets + ( first + r ) * outputSize;
+    mask = trainer->mask + ( first + r ) * outputSize;
+
+    dot = 0;
+    maskSum = 0;
+    for( j = 0; j < outputSize; ++j ) {
+
+      dot += f[ j ] * ranges[ j ];
+      maskSum += mask[ j ];
+    }
+    thread->maskSum += maskSum;
+    scale = maskSum < outputSize
+      ? 1.0f / ( trainer->rows * ( outputSize - maskSum ) ) : 0;
+
+    row = gradientOut + r * outputSize;
+    sum = 0;
+    for( j = 0; j < outputSize; ++j ) {
+
+      difference = mask[ j ] * ( f[ j ] - 0.5f * dot - target[ j ] );
+      if( fabsf( difference ) < 1 ) {
+
+	thread->huberSum += 0.5f * difference * difference;
+	row[ j ] = difference * scale;
+      } else {
+
+	thread->huberSum += fabsf( difference ) - 0.5f;
+	row[ j ] = ( difference > 0 ? 1 : -1 ) * scale;
+      }
+      sum += row[ j ];
+    }
+
+    /* back through the correction, which subtracts half the dot product
+       of the values and the ranges from every value */
+    for( j = 0; j < outputSize; ++j ) {
+
+      row[ j ] -= 0.5f * ranges[ j ] * sum;
+    }
+  }
+
+  if( !trainer->update ) {
+    return;
+  }
+
+  /* backward */
+  for( l = top; l >= 0; --l ) {
+
+    float *weightGradient = thread->parameterGradients[ l ][ 0 ];
+    float *biasGradient = thread->parameterGradients[ l ][ 1 ];
+    float *preluGradient = thread->parameterGradients[ l ][ 2 ];
+    const float *weight = trainer->parameters[ l ][ 0 ];
+    const float *prelu = trainer->parameters[ l ][ 2 ];
+
+    inputs = trainer->layerInputs[ l ];
+    outputs = trainer->layerOutputs[ l ];
+    in = l > 0 ? thread->post[ l - 1 ]
+      : trainer->inputs + first * trainer->inputSize;
+    gradientIn = thread->gradient[ ( top - l + 1 ) % 2 ];
+
+    for( r = 0; r < rows; ++r ) {
+
+      const float *pre = thread->pre[ l ] + r * outputs;
+      const float *x = in + r * inputs;
+
+      row = gradientOut + r * outputs;
+      if( trainer->preluCount[ l ] ) {
+
+	for( j = 0; j < outputs; ++j ) {
+
+	  const int p = trainer->preluCount[ l ] == 1 ? 0 : j;
+
+	  if( pre[ j ] <= 0 ) {
+
+	    preluGradient[ p ] += pre[ j ] * row[ j ];
+	    row[ j ] *= prelu[ p ];
+	  }
+	}
+      }
+
+      if( l > 0 ) {
+	memset( gradientIn + r * inputs, 0, inputs * sizeof( float ) );
+      }
+      for( j = 0; j < outputs; ++j ) {
+
+	if( row[ j ] == 0 ) {
+	  continue;
+	}
+	biasGradient[ j ] += row[ j ];
+	axpy( weightGradient + j * inputs, x, row[ j ], inputs );
+	if( l > 0 ) {
+	  axpy( gradientIn + r * inputs, weight + j * inputs, row[ j ], inputs );
+	}
+      }
+    }
+    gradientOut = gradientIn;
+  }
+}
+
+/* sum the threads' gradients of this thread's share of the parameters and
+   apply an Adam step to them */
+static void updateParameters( DSTrainer *trainer, TrainerThread *thread )
+{
+  const float biasCorrection1 = 1 - powf( trainer->beta1, trainer->stepCount );
+  const float biasCorrection2 = 1 - powf( trainer->beta2, trainer->stepCount );
+  const float stepSize = trainer->learningRate * sqrtf( biasCorrection2 )
+    / biasCorrection1;
+  int l, s, t, i, first, last;
+
+  for( l = 0; l < trainer->layerCount; ++l ) {
+
+    for( s = 0; s < TRAINER_SEGMENTS; ++s ) {
+
+      float *parameters = trainer->parameters[ l ][ s ];
+      float *m = trainer->firstMoments[ l ][ s ];
+      float *v = trainer->secondMoments[ l ][ s ];
+      float *gradient = thread->parameterGradients[ l ][ s ];
+
+      first = trainer->sizes[ l ][ s ] * thread->index / trainer->threadCount;
+      last = trainer->sizes[ l ][ s ] * ( thread->index + 1 )
+	/ trainer->threadCount;
+      for( t = 0; t < trainer->threadCount; ++t ) {
+
+	if( t != thread->index ) {
+	  axpy( gradient + first,
+		trainer->threads[ t ].parameterGradients[ l ][ s ] + first,
+		1, last - first );
+	}
+      }
+
+      for( i = first; i < last; ++i ) {
+
+	m[ i ] = trainer->beta1 * m[ i ] + ( 1 - trainer->beta1 ) * gradient[ i ];
+	v[ i ] = trainer->beta2 * v[ i ]
+	  + ( 1 - trainer->beta2 ) * gradient[ i ] * gradient[ i ];
+	parameters[ i ] -= stepSize * m[ i ]
+	  / ( sqrtf( v[ i ] ) + trainer->epsilon );
+      }
+    }
+  }
+}
+
+/* one thread's part of the current job */
+static void runJob( DSTrainer *trainer, TrainerThread *thread )
+{
+  int l, s;
+
+  if( trainer->update ) {
+
+    for( l = 0; l < trainer->layerCount; ++l ) {
+
+      for( s = 0; s < TRAINER_SEGMENTS; ++s ) {
+
+	memset( thread->parameterGradients[ l ][ s ], 0,
+		trainer->sizes[ l ][ s ] * sizeof( float ) );
+      }
+    }
+  }
+
+  computeRows( trainer, thread,
+	       trainer->rows * thread->index / trainer->threadCount,
+	       trainer->rows * ( thread->index + 1 ) / trainer->threadCount );
+
+  /* the gradients must all be complete before they are summed */
+  waitBarrier( &trainer->computed );
+  if( trainer->update ) {
+    updateParameters( trainer, thread );
+  }
+}
+
+static void *trainerThread( void *arg )
+{
+  TrainerThread *thread = (TrainerThread *)arg;
+  DSTrainer *trainer = thread->trainer;
+
+  while( 1 ) {
+
+    waitBarrier( &trainer->start );
+    if( trainer->quit ) {
+      return NULL;
+    }
+    runJob( trainer, thread );
+    waitBarrier( &trainer->finished );
+  }
+}
+
+/* make room for rows rows in every thread's buffers
+   returns >= 0 on success, -1 on failure */
+static int reserveTrainerRows( DSTrainer *trainer, const int rows )
+{
+  int t, l, width;
+
+  if( rows <= trainer->rowCapacity ) {
+    return 0;
+  }
+
+  width = trainer->inputSize;
+  for( l = 0; l < trainer->layerCount; ++l ) {
+
+    if( trainer->layerOutputs[ l ] > width ) {
+      width = trainer->layerOutputs[ l ];
+    }
+  }
+
+  for( t = 0; t < trainer->threadCount; ++t ) {
+
+    TrainerThread *thread = &trainer->threads[ t ];
+
+    for( l = 0; l < trainer->layerCount; ++l ) {
+
+      free( thread->pre[ l ] );
+      free( thread->post[ l ] );
+      thread->pre[ l ] = malloc( (size_t)rows * trainer->layerOutputs[ l ]
+				 * sizeof( float ) );
+      thread->post[ l ] = malloc( (size_t)rows * trainer->layerOutputs[ l ]
+				  * sizeof( float ) );
+      if( thread->pre[ l ] == NULL || thread->post[ l ] == NULL ) {
+	return -1;
+      }
+    }
+    for( l = 0; l < 2; ++l ) {
+
+      free( thread->gradient[ l ] );
+      thread->gradient[ l ] = malloc( (size_t)rows * width * sizeof( float ) );
+      if( thread->gradient[ l ] == NULL ) {
+	return -1;
+      }
+    }
+  }
+  trainer->rowCapacity = rows;
+
+  return 0;
+}
+
+
+DSTrainer *dsTrainerNew( const int inputSize, const int outputSize,
+			 const int threadCount, const float learningRate,
+			 const float beta1, const float beta2,
+			 const float epsilon )
+{
+  DSTrainer *trainer;
+  int t;
+
+  if( inputSize <= 0 || outputSize <= 0 || outputSize > inputSize
+      || threadCount <= 0 ) {
+
+    return NULL;
+  }
+
+  trainer = calloc( 1, sizeof( *trainer ) );
+  if( trainer == NULL ) {
+    return NULL;
+  }
+  trainer->inputSize = inputSize;
+  trainer->outputSize = outputSize;
+  trainer->threadCount = threadCount;
+  trainer->learningRate = learningRate;
+  trainer->beta1 = beta1;
+  trainer->beta2 = beta2;
+  trainer->epsilon = epsilon;
+  trainer->threads = calloc( threadCount, sizeof( TrainerThread ) );
+  if( trainer->threads == NULL ) {
+
+    free( trainer );
+    return NULL;
+  }
+  for( t = 0; t < threadCount; ++t ) {
+
+    trainer->threads[ t ].trainer = trainer;
+    trainer->threads[ t ].index = t;
+  }
+
+  /* the caller's thread is thread 0 */
+  initBarrier( &trainer->start, threadCount );
+  initBarrier( &trainer->computed, threadCount );
+  initBarrier( &trainer->finished, threadCount );
+  for( t = 1; t < threadCount; ++t ) {
+
+    if( pthread_create( &trainer->threads[ t ].thread, NULL, trainerThread,
+			&trainer->threads[ t ] ) != 0 ) {
+
+      /* run with the threads which did start, which can only be waiting
+	 at the start barrier */
+      trainer->threadCount = t;
+      setBarrierCount( &trainer->start, t );
+      setBarrierCount( &trainer->computed, t );
+      setBarrierCount( &trainer->finished, t );
+      break;
+    }
+  }
+
+  return trainer;
+}
+
+void dsTrainerFree( DSTrainer *trainer )
+{
+  int t, l, s;
+
+  if( trainer == NULL ) {
+    return;
+  }
+
+  trainer->quit = 1;
+  waitBarrier( &trainer->start );
+  for( t = 1; t < trainer->threadCount; ++t ) {
+
+    pthread_join( trainer->threads[ t ].thread, NULL );
+  }
+
+  for( t = 0; t < trainer->threadCount; ++t ) {
+
+    TrainerThread *thread = &trainer->threads[ t ];
+
+    for( l = 0; l < trainer->layerCount; ++l ) {
+
+      free( thread->pre[ l ] );
+      free( thread->post[ l ] );
+      for( s = 0; s < TRAINER_SEGMENTS; ++s ) {
+
+	free( thread->parameterGradients[ l ][ s ] );
+      }
+    }
+    free( thread->gradient[ 0 ] );
+    free( thread->gradient[ 1 ] );
+  }
+  for( l = 0; l < trainer->layerCount; ++l ) {
+
+    for( s = 0; s < TRAINER_SEGMENTS; ++s ) {
+
+      free( trainer->firstMoments[ l ][ s ] );
+      free( trainer->secondMoments[ l ][ s ] );
+    }
+    free( trainer->transposed[ l ] );
+  }
+  destroyBarrier( &trainer->start );
+  destroyBarrier( &trainer->computed );
+  destroyBarrier( &trainer->finished );
+  free( trainer->threads );
+  free( trainer );
+}
+
+int dsTrainerAddLayer( DSTrainer *trainer, const int inputs,
+		       const int outputs, float *weight, float *bias,
+		       const int preluCount, float *preluWeight )
+{
+  int l, s, t;
+
+  l = trainer->layerCount;
+  if( l >= DS_MAX_NET_LAYERS || outputs <= 0 || trainer->rowCapacity > 0
+      || inputs != ( l == 0 ? trainer->inputSize
+		     : trainer->layerOutputs[ l - 1 ] )
+      || ( preluCount != 0 && preluCount != 1 && preluCount != outputs ) ) {
+
+    return -1;
+  }
+
+  trainer->layerInputs[ l ] = inputs;
+  trainer->layerOutputs[ l ] = outputs;
+  trainer->preluCount[ l ] = preluCount;
+  trainer->parameters[ l ][ 0 ] = weight;
+  trainer->parameters[ l ][ 1 ] = bias;
+  trainer->parameters[ l ][ 2 ] = preluWeight;
+  trainer->sizes[ l ][ 0 ] = inputs * outputs;
+  trainer->sizes[ l ][ 1 ] = outputs;
+  trainer->sizes[ l ][ 2 ] = preluCount;
+  ++trainer->layerCount;
+
+  trainer->transposed[ l ] = malloc( inputs * outputs * sizeof( float ) );
+  if( trainer->transposed[ l ] == NULL ) {
+    return -1;
+  }
+  for( s = 0; s < TRAINER_SEGMENTS; ++s ) {
+
+    /* one more float so that empty segments are still allocated */
+    trainer->firstMoments[ l ][ s ]
+      = calloc( trainer->sizes[ l ][ s ] + 1, sizeof( float ) );
+    trainer->secondMoments[ l ][ s ]
+      = calloc( trainer->sizes[ l ][ s ] + 1, sizeof( float ) );
+    if( trainer->firstMoments[ l ][ s ] == NULL
+	|| trainer->secondMoments[ l ][ s ] == NULL ) {
+      return -1;
+    }
+    for( t = 0; t < trainer->threadCount; ++t ) {
+
+      trainer->threads[ t ].parameterGradients[ l ][ s ]
+	= calloc( trainer->sizes[ l ][ s ] + 1, sizeof( float ) );
+      if( trainer->threads[ t ].parameterGradients[ l ][ s ] == NULL ) {
+	return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/* run one job on all threads and give its loss, as MaskedHuberLoss:forward */
+static double runTrainerJob( DSTrainer *trainer, const float *inputs,
+			     const float *targets, const float *mask,
+			     const int rows, const int update )
+{
+  int l, i, j, t;
+  double huberSum, maskSum;
+
+  if( trainer->layerCount == 0 || rows <= 0
+      || trainer->layerOutputs[ trainer->layerCount - 1 ]
+      != trainer->outputSize
+      || reserveTrainerRows( trainer, rows ) < 0 ) {
+
+    return -1;
+  }
+
+  for( l = 0; l < trainer->layerCount; ++l ) {
+
+    const int inputs = trainer->layerInputs[ l ];
+    const int outputs = trainer->layerOutputs[ l ];
+
+    for( j = 0; j < outputs; ++j ) {
+
+      for( i = 0; i < inputs; ++i ) {
+
+	trainer->transposed[ l ][ i * outputs + j ]
+	  = trainer->parameters[ l ][ 0 ][ j * inputs + i ];
+      }
+    }
+  }
+
+  trainer->rows = rows;
+  trainer->inputs = inputs;
+  trainer->targets = targets;
+  trainer->mask = mask;
+  trainer->update = update;
+  if( update ) {
+    ++trainer->stepCount;
+  }
+
+  waitBarrier( &trainer->start );
+  runJob( trainer, &trainer->threads[ 0 ] );
+  waitBarrier( &trainer->finished );
+
+  huberSum = 0;
+  maskSum = 0;
+  for( t = 0; t < trainer->threadCount; ++t ) {
+
+    huberSum += trainer->threads[ t ].huberSum;
+    maskSum += trainer->threads[ t ].maskSum;
+  }
+  return huberSum / ( (double)rows * trainer->outputSize - maskSum );
+}
+
+double dsTrainerStep( DSTrainer *trainer, const float *inputs,
+		      const float *targets, const float *mask,
+		      const int rows )
+{
+  return runTrainerJob( trainer, inputs, targets, mask, rows, 1 );
+}
+
+double dsTrainerLoss( DSTrainer *trainer, const float *inputs,
+		      const float *targets, const float *mask,
+		      const int rows )
+{
+  return runTrainerJob( trainer, inputs, targets, mask, rows, 0 );
+}
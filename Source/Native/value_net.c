@@ -0,0 +1,536 @@
+/*
+Native inference for DeepStack's value network
+
+Runs the feedforward part of the network built by Nn/net_builder.lua (a
+sequence of linear layers, each optionally followed by a PReLU) and the
+zero-sum correction of its output.  Each linear layer is computed in
+tiles of VALUE_NET_ROW_BLOCK rows by VALUE_NET_TILE_COLUMNS outputs, which
+the compiler keeps in vector registers (build with ARCH_FLAGS to use AVX2
+and FMA), and every row is run through one tile's weights while they are
+in cache.
+
+The weights can also be kept as bf16 or as int8 with a scale for each
+output (see dsValueNetSetPrecision).  Either way they are converted to
+floats as they are loaded, and the sums are kept in floats.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#if defined( __SSE4_1__ )
+#include <immintrin.h>
+#endif
+#include "deepstack_native.h"
+
+/* rows in a tile, linearLayer is written for exactly this many */
+#define VALUE_NET_ROW_BLOCK 4
+
+/* outputs computed at once, layers are padded to a multiple of this.
+   A tile row is two vectors as wide as the widest vector registers
+   ARCH_FLAGS allows */
+#if defined( __AVX512F__ )
+#define TILE_VECTOR_FLOATS 16
+#elif defined( __AVX__ )
+#define TILE_VECTOR_FLOATS 8
+#else
+#define TILE_VECTOR_FLOATS 4
+#endif
+#define VALUE_NET_TILE_COLUMNS ( 2 * TILE_VECTOR_FLOATS )
+typedef float TileVector
+  __attribute__(( vector_size( TILE_VECTOR_FLOATS * sizeof( float ) ) ));
+typedef uint32_t TileWordVector
+  __attribute__(( vector_size( TILE_VECTOR_FLOATS * sizeof( uint32_t ) ) ));
+typedef int32_t TileIntVector
+  __attribute__(( vector_size( TILE_VECTOR_FLOATS * sizeof( int32_t ) ) ));
+typedef uint16_t TileHalfVector
+  __attribute__(( vector_size( TILE_VECTOR_FLOATS * sizeof( uint16_t ) ) ));
+typedef int8_t TileByteVector
+  __attribute__(( vector_size( TILE_VECTOR_FLOATS * sizeof( int8_t ) ) ));
+
+static TileVector loadTileVector( const float *p )
+{
+  TileVector v;
+
+  memcpy( &v, p, sizeof( v ) );
+  return v;
+}
+
+/* a bf16 is the top half of a float */
+static TileVector loadBf16TileVector( const uint16_t *p )
+{
+  TileHalfVector v;
+
+  memcpy( &v, p, sizeof( v ) );
+  return (TileVector)( __builtin_convertvector( v, TileWordVector ) << 16 );
+}
+
+/* GCC does the int8 conversion one value at a time, so use the sign
+   extending loads where the instruction set has them for the tile's
+   vector width */
+static TileVector loadInt8TileVector( const int8_t *p )
+{
+#if TILE_VECTOR_FLOATS == 16
+  return (TileVector)_mm512_cvtepi32_ps
+    ( _mm512_cvtepi8_epi32( _mm_loadu_si128( (const __m128i *)p ) ) );
+#elif TILE_VECTOR_FLOATS == 8 && defined( __AVX2__ )
+  return (TileVector)_mm256_cvtepi32_ps
+    ( _mm256_cvtepi8_epi32( _mm_loadl_epi64( (const __m128i *)p ) ) );
+#elif TILE_VECTOR_FLOATS == 8
+  /* AVX without AVX2 sign extends four bytes at a time */
+  int32_t low, high;
+
+  memcpy( &low, p, sizeof( low ) );
+  memcpy( &high, p + 4, sizeof( high ) );
+  return (TileVector)_mm256_cvtepi32_ps
+    ( _mm256_set_m128i( _mm_cvtepi8_epi32( _mm_cvtsi32_si128( high ) ),
+			_mm_cvtepi8_epi32( _mm_cvtsi32_si128( low ) ) ) );
+#elif defined( __SSE4_1__ )
+  int32_t bytes;
+
+  memcpy( &bytes, p, sizeof( bytes ) );
+  return (TileVector)_mm_cvtepi32_ps
+    ( _mm_cvtepi8_epi32( _mm_cvtsi32_si128( bytes ) ) );
+#else
+  TileByteVector v;
+
+  memcpy( &v, p, sizeof( v ) );
+  return __builtin_convertvector( __builtin_convertvector( v, TileIntVector ),
+				  TileVector );
+#endif
+}
+
+static void storeTileVector( float *p, const TileVector v )
+{
+  memcpy( p, &v, sizeof( v ) );
+}
+
+/* round a float to the nearest bf16, ties to even */
+static uint16_t floatToBf16( const float x )
+{
+  uint32_t bits;
+
+  memcpy( &bits, &x, sizeof( bits ) );
+  bits += 0x7fff + ( ( bits >> 16 ) & 1 );
+  return (uint16_t)( bits >> 16 );
+}
+
+/* outputs of a layer, rounded up to a whole number of tiles */
+static int paddedWidth( const int outputs )
+{
+  return ( outputs + VALUE_NET_TILE_COLUMNS - 1 )
+    / VALUE_NET_TILE_COLUMNS * VALUE_NET_TILE_COLUMNS;
+}
+
+
+DSValueNet *dsValueNetNew( const int inputSize, const int outputSize )
+{
+  DSValueNet *net;
+
+  /* the zero-sum correction uses the first outputSize inputs */
+  if( inputSize <= 0 || outputSize <= 0 || outputSize > inputSize ) {
+    return NULL;
+  }
+
+  net = (DSValueNet *)calloc( 1, sizeof( *net ) );
+  if( net == NULL ) {
+    return NULL;
+  }
+  net->inputSize = inputSize;
+  net->outputSize = outputSize;
+
+  return net;
+}
+
+void dsValueNetFree( DSValueNet *net )
+{
+  int l;
+
+  if( net == NULL ) {
+    return;
+  }
+
+  for( l = 0; l < net->layerCount; ++l ) {
+
+    free( net->weights[ l ] );
+    free( net->quantizedWeights[ l ] );
+  }
+  free( net->input );
+  free( net->buffers[ 0 ] );
+  free( net );
+}
+
+int dsValueNetAddLayer( DSValueNet *net, const int inputs, const int outputs,
+			const float *weight, const float *bias,
+			const int preluCount, const float *preluWeight )
+{
+  int i, j, l, pitch;
+  float *storage;
+
+  l = net->layerCount;
+  if( net->precision != DS_PRECISION_FLOAT
+      || l >= DS_MAX_NET_LAYERS || outputs <= 0
+      || inputs != ( l == 0 ? net->inputSize : net->layerOutputs[ l - 1 ] )
+      || ( preluCount != 0 && preluCount != 1 && preluCount != outputs ) ) {
+
+    return -1;
+  }
+
+  pitch = paddedWidth( outputs );
+  if( pitch > net->maxWidth ) {
+
+    /* the buffers are sized for the widest layer on the next forward */
+    net->maxWidth = pitch;
+    net->rowCapacity = 0;
+  }
+
+  /* weights, bias and PReLU weights share one allocation, zero in the
+     padding so padded outputs are always 0 */
+  storage = (float *)calloc( inputs * pitch + pitch + preluCount,
+			     sizeof( float ) );
+  if( storage == NULL ) {
+
+    return -1;
+  }
+
+  /* nn.Linear stores outputs x inputs, but a tile is computed one input
+     at a time, so keep each tile's weights together as inputs x tile
+     columns */
+  for( i = 0; i < inputs; ++i ) {
+
+    for( j = 0; j < outputs; ++j ) {
+
+      storage[ ( j - j % VALUE_NET_TILE_COLUMNS ) * inputs
+	       + i * VALUE_NET_TILE_COLUMNS + j % VALUE_NET_TILE_COLUMNS ]
+	= weight[ j * inputs + i ];
+    }
+  }
+  net->weights[ l ] = storage;
+  net->biases[ l ] = storage + inputs * pitch;
+  memcpy( net->biases[ l ], bias, outputs * sizeof( float ) );
+  net->preluWeights[ l ] = net->biases[ l ] + pitch;
+  if( preluCount ) {
+
+    memcpy( net->preluWeights[ l ], preluWeight,
+	    preluCount * sizeof( float ) );
+  }
+
+  net->layerInputs[ l ] = inputs;
+  net->layerOutputs[ l ] = outputs;
+  net->preluCount[ l ] = preluCount;
+  ++net->layerCount;
+
+  return 0;
+}
+
+
+int dsValueNetSetPrecision( DSValueNet *net, const int precision )
+{
+  int l, i, j, pitch, size;
+  float max;
+  const float *weights;
+  void *storage;
+  uint16_t *halves;
+  int8_t *bytes;
+  float *scales;
+
+  if( precision != DS_PRECISION_FLOAT && precision != DS_PRECISION_BF16
+      && precision != DS_PRECISION_INT8 ) {
+
+    return -1;
+  }
+
+  for( l = 0; l < net->layerCount; ++l ) {
+
+    free( net->quantizedWeights[ l ] );
+    net->quantizedWeights[ l ] = NULL;
+    net->scales[ l ] = NULL;
+  }
+  net->precision = DS_PRECISION_FLOAT;
+  if( precision == DS_PRECISION_FLOAT ) {
+    return 0;
+  }
+
+  for( l = 0; l < net->layerCount; ++l ) {
+
+    pitch = paddedWidth( net->layerOutputs[ l ] );
+    size = net->layerInputs[ l ] * pitch;
+    weights = net->weights[ l ];
+
+    if( precision == DS_PRECISION_BF16 ) {
+
+      storage = malloc( size * sizeof( uint16_t ) );
+      if( storage == NULL ) {
+
+	dsValueNetSetPrecision( net, DS_PRECISION_FLOAT );
+	return -1;
+      }
+
+      halves = (uint16_t *)storage;
+      for( i = 0; i < size; ++i ) {
+
+	halves[ i ] = floatToBf16( weights[ i ] );
+      }
+    } else {
+
+      /* the scales follow the weights, and size is a multiple of the
+	 tile width so they stay aligned */
+      storage = malloc( size * sizeof( int8_t ) + pitch * sizeof( float ) );
+      if( storage == NULL ) {
+
+	dsValueNetSetPrecision( net, DS_PRECISION_FLOAT );
+	return -1;
+      }
+
+      /* each output gets the scale which maps its largest weight to 127.
+	 Weights are stored by tile, so output j of a tile has its weight
+	 for input i at i * VALUE_NET_TILE_COLUMNS + j */
+      bytes = (int8_t *)storage;
+      scales = (float *)( bytes + size );
+      for( j = 0; j < pitch; ++j ) {
+
+	const float *tile = weights + ( j - j % VALUE_NET_TILE_COLUMNS )
+	  * net->layerInputs[ l ] + j % VALUE_NET_TILE_COLUMNS;
+	int8_t *tileBytes = bytes + ( j - j % VALUE_NET_TILE_COLUMNS )
+	  * net->layerInputs[ l ] + j % VALUE_NET_TILE_COLUMNS;
+
+	max = 0;
+	for( i = 0; i < net->layerInputs[ l ]; ++i ) {
+
+	  if( fabsf( tile[ i * VALUE_NET_TILE_COLUMNS ] ) > max ) {
+	    max = fabsf( tile[ i * VALUE_NET_TILE_COLUMNS ] );
+	  }
+	}
+	scales[ j ] = max > 0 ? max / 127 : 1;
+
+	for( i = 0; i < net->layerInputs[ l ]; ++i ) {
+
+	  tileBytes[ i * VALUE_NET_TILE_COLUMNS ]
+	    = (int8_t)lrintf( tile[ i * VALUE_NET_TILE_COLUMNS ]
+			      / scales[ j ] );
+	}
+      }
+      net->scales[ l ] = scales;
+    }
+
+    net->quantizedWeights[ l ] = storage;
+  }
+  net->precision = precision;
+
+  return 0;
+}
+
+
+/* make room for the padded inputs and intermediate values of rows rows
+   returns >= 0 on success, -1 on failure */
+static int reserveRows( DSValueNet *net, const int rows )
+{
+  float *input, *buffer;
+
+  if( rows <= net->rowCapacity ) {
+    return 0;
+  }
+
+  input = (float *)realloc( net->input, rows * net->inputSize
+			    * sizeof( float ) );
+  if( input == NULL ) {
+
+    return -1;
+  }
+  net->input = input;
+
+  buffer = (float *)realloc( net->buffers[ 0 ], 2 * rows * net->maxWidth
+			     * sizeof( float ) );
+  if( buffer == NULL ) {
+
+    return -1;
+  }
+  net->buffers[ 0 ] = buffer;
+  net->buffers[ 1 ] = buffer + rows * net->maxWidth;
+  net->rowCapacity = rows;
+
+  return 0;
+}
+
+/* rows rows of a linear layer, from inputs which are inStride floats apart
+   to outputs which are pitch floats apart.  The rows of a tile are written
+   out by hand so that each one is a separate accumulator the compiler can
+   keep in registers.  weights has the given precision, and scales (only
+   for int8) scale the sums of each output */
+static void linearLayer( const float *restrict in, const int inStride,
+			 const int precision, const void *restrict weights,
+			 const float *restrict scales,
+			 const float *restrict bias,
+			 const int inputs, const int pitch,
+			 float *restrict out, const int rows )
+{
+  int start, block, i;
+
+  for( start = 0; start < pitch; start += VALUE_NET_TILE_COLUMNS )
+  for( block = 0; block < rows; block += VALUE_NET_ROW_BLOCK ) {
+
+    const float *blockIn = in + block * inStride;
+    float *blockOut = out + block * pitch;
+    const int offset = start * inputs;
+    TileVector left0 = { 0 }, left1 = { 0 }, left2 = { 0 }, left3 = { 0 };
+    TileVector right0 = { 0 }, right1 = { 0 }, right2 = { 0 },
+      right3 = { 0 };
+    TileVector leftBias, rightBias;
+
+    for( i = 0; i < inputs; ++i ) {
+
+      const int w = offset + i * VALUE_NET_TILE_COLUMNS;
+      const float x0 = blockIn[ i ];
+      const float x1 = blockIn[ inStride + i ];
+      const float x2 = blockIn[ 2 * inStride + i ];
+      const float x3 = blockIn[ 3 * inStride + i ];
+      TileVector weightLeft, weightRight;
+
+      /* the compiler moves this out of the loop */
+      if( precision == DS_PRECISION_INT8 ) {
+
+	weightLeft = loadInt8TileVector( (const int8_t *)weights + w );
+	weightRight = loadInt8TileVector( (const int8_t *)weights + w
+					  + TILE_VECTOR_FLOATS );
+      } else if( precision == DS_PRECISION_BF16 ) {
+
+	weightLeft = loadBf16TileVector( (const uint16_t *)weights + w );
+	weightRight = loadBf16TileVector( (const uint16_t *)weights + w
+					  + TILE_VECTOR_FLOATS );
+      } else {
+
+	weightLeft = loadTileVector( (const float *)weights + w );
+	weightRight = loadTileVector( (const float *)weights + w
+				      + TILE_VECTOR_FLOATS );
+      }
+
+      left0 += x0 * weightLeft;
+      right0 += x0 * weightRight;
+      left1 += x1 * weightLeft;
+      right1 += x1 * weightRight;
+      left2 += x2 * weightLeft;
+      right2 += x2 * weightRight;
+      left3 += x3 * weightLeft;
+      right3 += x3 * weightRight;
+    }
+
+    if( scales != NULL ) {
+
+      const TileVector leftScale = loadTileVector( scales + start );
+      const TileVector rightScale = loadTileVector( scales + start
+						    + TILE_VECTOR_FLOATS );
+
+      left0 *= leftScale;
+      left1 *= leftScale;
+      left2 *= leftScale;
+      left3 *= leftScale;
+      right0 *= rightScale;
+      right1 *= rightScale;
+      right2 *= rightScale;
+      right3 *= rightScale;
+    }
+
+    leftBias = loadTileVector( bias + start );
+    rightBias = loadTileVector( bias + start + TILE_VECTOR_FLOATS );
+    storeTileVector( blockOut + start, left0 + leftBias );
+    storeTileVector( blockOut + start + TILE_VECTOR_FLOATS,
+		     right0 + rightBias );
+    storeTileVector( blockOut + pitch + start, left1 + leftBias );
+    storeTileVector( blockOut + pitch + start + TILE_VECTOR_FLOATS,
+		     right1 + rightBias );
+    storeTileVector( blockOut + 2 * pitch + start, left2 + leftBias );
+    storeTileVector( blockOut + 2 * pitch + start + TILE_VECTOR_FLOATS,
+		     right2 + rightBias );
+    storeTileVector( blockOut + 3 * pitch + start, left3 + leftBias );
+    storeTileVector( blockOut + 3 * pitch + start + TILE_VECTOR_FLOATS,
+		     right3 + rightBias );
+  }
+}
+
+static void prelu( float *values, const int rows, const int pitch,
+		   const int outputs, const int preluCount,
+		   const float *preluWeight )
+{
+  int r, j;
+
+  for( r = 0; r < rows; ++r ) {
+
+    float *row = values + r * pitch;
+
+    for( j = 0; j < outputs; ++j ) {
+
+      const float a = preluWeight[ preluCount == 1 ? 0 : j ];
+
+      row[ j ] = row[ j ] < 0 ? row[ j ] * a : row[ j ];
+    }
+  }
+}
+
+int dsValueNetForward( DSValueNet *net, const float *inputs,
+		       float *outputs, const int rows )
+{
+  int padded, l, r, j, last, inStride;
+  float dot;
+  const float *in, *ranges;
+  float *out;
+
+  last = net->layerCount - 1;
+  if( last < 0 || net->layerOutputs[ last ] != net->outputSize ) {
+
+    return -1;
+  }
+
+  /* the layers always work on whole tiles, so pad the inputs with rows
+     of zeros */
+  padded = ( rows + VALUE_NET_ROW_BLOCK - 1 )
+    / VALUE_NET_ROW_BLOCK * VALUE_NET_ROW_BLOCK;
+  if( reserveRows( net, padded ) < 0 ) {
+
+    return -1;
+  }
+  memcpy( net->input, inputs, rows * net->inputSize * sizeof( float ) );
+  memset( net->input + rows * net->inputSize, 0,
+	  ( padded - rows ) * net->inputSize * sizeof( float ) );
+
+  /* the feedforward part */
+  in = net->input;
+  inStride = net->inputSize;
+  for( l = 0; l <= last; ++l ) {
+
+    const int pitch = paddedWidth( net->layerOutputs[ l ] );
+
+    out = net->buffers[ l % 2 ];
+    linearLayer( in, inStride, net->precision,
+		 net->precision == DS_PRECISION_FLOAT ? net->weights[ l ]
+		 : net->quantizedWeights[ l ], net->scales[ l ],
+		 net->biases[ l ], net->layerInputs[ l ], pitch, out, padded );
+    if( net->preluCount[ l ] ) {
+
+      prelu( out, padded, pitch, net->layerOutputs[ l ],
+	     net->preluCount[ l ], net->preluWeights[ l ] );
+    }
+
+    in = out;
+    inStride = pitch;
+  }
+
+  /* zero-sum correction into the caller's buffer: subtract half of the
+     values' dot product with the input ranges from every value */
+  for( r = 0; r < rows; ++r ) {
+
+    ranges = inputs + r * net->inputSize;
+    dot = 0;
+    for( j = 0; j < net->outputSize; ++j ) {
+
+      dot += in[ r * inStride + j ] * ranges[ j ];
+    }
+
+    out = outputs + r * net->outputSize;
+    for( j = 0; j < net->outputSize; ++j ) {
+
+      out[ j ] = in[ r * inStride + j ] - 0.5f * dot;
+    }
+  }
+
+  return 0;
+}
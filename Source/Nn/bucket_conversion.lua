@@ -14,32 +14,61 @@ local BucketConversion = torch.class('BucketConversion')
 function BucketConversion:__init()
 end
 
+--- Builds the index arrays which map private hands to buckets on a list of
+-- boards, in compressed sparse row form.
+--
+-- A private hand is in at most one bucket on each board, so converting
+-- between hands and buckets only needs to gather and add along these arrays
+-- rather than multiply by a mostly zero hands x buckets matrix.
+-- @param bucketer the @{bucketer} which assigns hands to buckets
+-- @param boards an NxB tensor of N boards
+-- @return a table with the LongTensors (CudaTensors when @{arguments.gpu} is
+-- set) `card_indexes` and `bucket_indexes`, whose i-th entries give a
+-- private hand and its bucket, where the buckets of the n-th board are
+-- numbered from `(n-1)*bucket_count + 1` to `n*bucket_count`; and
+-- `board_offsets`, where the entries of the n-th board are
+-- `board_offsets[n] + 1` to `board_offsets[n+1]`
+function BucketConversion.build_bucket_indexes(bucketer, boards)
+  local bucket_count = bucketer:get_bucket_count()
+  local card_indexes, bucket_indexes = {}, {}
+  local board_offsets = torch.LongTensor(boards:size(1) + 1)
+  board_offsets[1] = 0
+
+  for idx = 1, boards:size(1) do
+    local buckets = bucketer:compute_buckets(boards[idx])
+    for card = 1, game_settings.card_count do
+      --impossible hands have bucket -1
+      if buckets[card] > 0 then
+        card_indexes[#card_indexes + 1] = card
+        bucket_indexes[#bucket_indexes + 1] = (idx - 1) * bucket_count + buckets[card]
+      end
+    end
+    board_offsets[idx + 1] = #card_indexes
+  end
+
+  local out = {
+    card_indexes = torch.LongTensor(card_indexes),
+    bucket_indexes = torch.LongTensor(bucket_indexes),
+    board_offsets = board_offsets,
+  }
+  --the gathers and additions on the GPU need their indexes there too
+  if arguments.gpu then
+    out.card_indexes = out.card_indexes:cuda()
+    out.bucket_indexes = out.bucket_indexes:cuda()
+  end
+  return out
+end
+
 --- Sets the board cards for the bucketer.
 -- @param board a non-empty vector of board cards
 function BucketConversion:set_board(board)
   self.bucketer = Bucketer()
   self.bucket_count = self.bucketer:get_bucket_count()
-  self._range_matrix = arguments.Tensor(game_settings.card_count, self.bucket_count ):zero()
 
-  local buckets = self.bucketer:compute_buckets(board)
-  local class_ids = torch.range(1, self.bucket_count)
-
-  if arguments.gpu then 
-    buckets = buckets:cuda() 
-    class_ids = class_ids:cuda()
-  else
-    class_ids = class_ids:float() 
-  end
-
-  class_ids = class_ids:view(1, self.bucket_count):expand(game_settings.card_count, self.bucket_count)
-  local card_buckets = buckets:view(game_settings.card_count, 1):expand(game_settings.card_count, self.bucket_count)
-
-  --finding all strength classes      
-  --matrix for transformation from card ranges to strength class ranges 
-  self._range_matrix[torch.eq(class_ids, card_buckets)] = 1
-
-  --matrix for transformation form class values to card values
-  self._reverse_value_matrix = self._range_matrix:t():clone()
+  local indexes = BucketConversion.build_bucket_indexes(self.bucketer, board:view(1, -1))
+  self._card_indexes = indexes.card_indexes
+  self._bucket_indexes = indexes.bucket_indexes
+  self._gathered = arguments.Tensor()
 end
 
 --- Converts a range vector over private hands to a range vector over buckets.
@@ -49,7 +78,8 @@ end
 -- @param bucket_range a vector in which to save the resulting probability 
 -- vector over buckets
 function BucketConversion:card_range_to_bucket_range(card_range, bucket_range)
-  bucket_range:mm(card_range, self._range_matrix)
+  self._gathered:index(card_range, 2, self._card_indexes)
+  bucket_range:zero():indexAdd(2, self._bucket_indexes, self._gathered)
 end
 
 --- Converts a value vector over buckets to a value vector over private hands.
@@ -59,7 +89,8 @@ end
 -- @param card_value a vector in which to save the resulting vector of values
 -- over private hands
 function BucketConversion:bucket_value_to_card_value(bucket_value, card_value)
-  card_value:mm(bucket_value, self._reverse_value_matrix)
+  self._gathered:index(bucket_value, 2, self._bucket_indexes)
+  card_value:zero():indexAdd(2, self._card_indexes, self._gathered)
 end
 
 --- Gives a vector of possible buckets on the the board.
@@ -68,8 +99,8 @@ end
 -- @return a mask vector over buckets where each entry is 1 if the bucket is
 -- valid, 0 if not
 function BucketConversion:get_possible_bucket_mask()
-  local mask = arguments.Tensor(1, self.bucket_count)
-  local card_indicator = arguments.Tensor(1, game_settings.card_count):fill(1)
-  mask:mm(card_indicator, self._range_matrix)
+  local mask = arguments.Tensor(1, self.bucket_count):zero()
+  local card_indicator = arguments.Tensor(1, self._card_indexes:size(1)):fill(1)
+  mask:indexAdd(2, self._bucket_indexes, card_indicator)
   return mask
-end
\ No newline at end of file
+end
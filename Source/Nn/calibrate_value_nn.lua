@@ -0,0 +1,52 @@
+--- Script that measures how the native value net's weight precisions affect
+-- its accuracy.
+--
+-- Evaluates the validation data generated with @{data_generation_call} with
+-- torch's nn and with the native library at each @{arguments.value_net_precision},
+-- and reports the Huber loss against the targets, its difference from the
+-- float loss, the largest output difference and the evaluation time.
+-- Run from `Source` with the native library built.
+-- @script calibrate_value_nn
+
+require 'torch'
+require 'Nn.value_nn'
+require 'Nn.masked_huber_loss'
+require 'Training.data_stream'
+local arguments = require 'Settings.arguments'
+
+assert(not arguments.gpu, 'the native value net runs on the CPU only')
+
+local inputs, targets, mask = DataStream.load_data_set(arguments.data_path .. 'valid')
+inputs = inputs:type(arguments.Tensor():type())
+targets = targets:type(arguments.Tensor():type())
+mask = mask:repeatTensor(1, 2):type(arguments.Tensor():type())
+print('validation examples: ' .. inputs:size(1))
+
+local criterion = MaskedHuberLoss()
+
+--the loss masks its arguments in place
+local function get_loss(outputs)
+  return criterion:forward(outputs:clone(), targets:clone(), mask)
+end
+
+local function evaluate(net)
+  local outputs = arguments.Tensor(targets:size())
+  local timer = torch.Timer()
+  net:get_value(inputs, outputs)
+  return outputs, timer:time().real
+end
+
+local precisions = {'float', 'bf16', 'int8'}
+arguments.native_value_net = false
+local reference, reference_time = evaluate(ValueNn())
+local reference_loss = get_loss(reference)
+print(string.format('%-8s loss %.6f time %.4fs', 'nn', reference_loss, reference_time))
+
+arguments.native_value_net = true
+for _, precision in ipairs(precisions) do
+  arguments.value_net_precision = precision
+  local outputs, time = evaluate(ValueNn())
+  local loss = get_loss(outputs)
+  print(string.format('%-8s loss %.6f (%+.6f) max output difference %.6f time %.4fs',
+    precision, loss, loss - reference_loss, (outputs - reference):abs():max(), time))
+end
@@ -0,0 +1,64 @@
+require 'optim'
+require 'Nn.masked_huber_loss'
+local nn_builder = require 'Nn.net_builder'
+local train = require 'Training.train'
+local arguments = require 'Settings.arguments'
+
+assert(not arguments.gpu, 'the native trainer runs on the CPU only')
+
+--trains copies of the same network on the same batches with torch's optim and
+--with the native trainer, and compares the losses and the parameters
+local step_count = 10
+local batch_size = 50
+local network = nn_builder:build_net()
+local input_size = network.modules[1].modules[1].modules[1].weight:size(2)
+local output_size = input_size - 1
+
+local batches = {}
+for i = 1, step_count do
+  local mask = arguments.Tensor(batch_size, output_size / 2):bernoulli(0.8)
+  batches[i] = {
+    inputs = arguments.Tensor(batch_size, input_size):uniform(),
+    targets = arguments.Tensor(batch_size, output_size):uniform(-1, 1),
+    mask = mask:repeatTensor(1, 2),
+  }
+end
+
+--torch's optim, as train.lua's feval does it
+local reference = network:clone()
+local params, grads = reference:getParameters()
+local criterion = MaskedHuberLoss()
+local state = {learningRate = arguments.learning_rate}
+local reference_losses = {}
+for i, batch in ipairs(batches) do
+  local _, loss = optim.adam(function()
+    grads:zero()
+    --the loss masks its arguments in place
+    local outputs = reference:forward(batch.inputs)
+    local targets = batch.targets:clone()
+    local batch_loss = criterion:forward(outputs, targets, batch.mask)
+    reference:backward(batch.inputs, criterion:backward(outputs, targets))
+    return batch_loss, grads
+  end, params, state)
+  reference_losses[i] = loss[1]
+end
+
+for _, thread_count in ipairs({1, 3, 8}) do
+  arguments.train_threads = thread_count
+  local native_network = network:clone()
+  local trainer = train:_build_native_trainer(native_network)
+  local native = require 'Native.native'
+  local max_loss_difference = 0
+  for i, batch in ipairs(batches) do
+    local loss = native.lib.dsTrainerStep(trainer, native:float_pointer(batch.inputs), native:float_pointer(batch.targets),
+      native:float_pointer(batch.mask), batch_size)
+    assert(loss >= 0, 'native training step failed')
+    max_loss_difference = math.max(max_loss_difference, math.abs(loss - reference_losses[i]))
+  end
+  trainer = nil
+  collectgarbage()
+
+  local native_params = native_network:getParameters()
+  print(string.format('%d threads: max loss difference %g, max parameter difference %g',
+    thread_count, max_loss_difference, (native_params - params):abs():max()))
+end
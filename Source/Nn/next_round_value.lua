@@ -4,6 +4,7 @@
 require 'torch'
 require 'math'
 require 'Nn.bucketer'
+require 'Nn.bucket_conversion'
 local card_tools = require 'Game.card_tools'
 local arguments = require 'Settings.arguments'
 local game_settings = require 'Settings.game_settings'
@@ -11,9 +12,12 @@ local constants = require 'Settings.constants'
 
 local NextRoundValue = torch.class('NextRoundValue')
 
+--the bucketing index arrays do not depend on the instance, so build them only once
+local bucketing = nil
+
 --- Constructor.
 -- 
--- Creates a tensor that can translate hand ranges to bucket ranges
+-- Creates the index arrays that translate hand ranges to bucket ranges
 -- on any board.
 -- @param nn the neural network
 function NextRoundValue:__init(nn)
@@ -21,42 +25,32 @@ function NextRoundValue:__init(nn)
   self:_init_bucketing()
 end
 
---- Initializes the tensor that translates hand ranges to bucket ranges.
+--- Initializes the index arrays that translate hand ranges to bucket ranges.
 -- @local
 function NextRoundValue:_init_bucketing()
-  self.bucketer = Bucketer()
-  self.bucket_count = self.bucketer:get_bucket_count()
-  local boards = card_tools:get_second_round_boards()
-  self.board_count = boards:size(1)
-  self._range_matrix = arguments.Tensor(game_settings.card_count, self.board_count * self.bucket_count ):zero()
-  self._range_matrix_board_view = self._range_matrix:view(game_settings.card_count, self.board_count, self.bucket_count)
-
-  for idx = 1, self.board_count do
-    local board = boards[idx]
-    
-    local buckets = self.bucketer:compute_buckets(board)
-    local class_ids = torch.range(1, self.bucket_count)
-
-    if arguments.gpu then 
-      buckets = buckets:cuda() 
-      class_ids = class_ids:cuda()
-    else
-      class_ids = class_ids:float() 
-    end
-
-    class_ids = class_ids:view(1, self.bucket_count):expand(game_settings.card_count, self.bucket_count)
-    local card_buckets = buckets:view(game_settings.card_count, 1):expand(game_settings.card_count, self.bucket_count)
-
-    --finding all strength classes      
-    --matrix for transformation from card ranges to strength class ranges 
-    self._range_matrix_board_view[{{}, idx, {}}][torch.eq(class_ids, card_buckets)] = 1
+  if not bucketing then
+    local bucketer = Bucketer()
+    local boards = card_tools:get_second_round_boards()
+    local indexes = BucketConversion.build_bucket_indexes(bucketer, boards)
+    bucketing = {
+      bucketer = bucketer,
+      bucket_count = bucketer:get_bucket_count(),
+      board_count = boards:size(1),
+      card_indexes = indexes.card_indexes,
+      bucket_indexes = indexes.bucket_indexes,
+      board_offsets = indexes.board_offsets,
+    }
   end
 
-  --matrix for transformation from class values to card values
-  self._reverse_value_matrix = self._range_matrix:t():clone()
-  --we need to div the matrix by the sum of possible boards (from point of view of each hand)
-  local weight_constant = 1/(self.board_count - 2) -- count
-  self._reverse_value_matrix:mul(weight_constant)
+  self.bucketer = bucketing.bucketer
+  self.bucket_count = bucketing.bucket_count
+  self.board_count = bucketing.board_count
+  self._card_indexes = bucketing.card_indexes
+  self._bucket_indexes = bucketing.bucket_indexes
+  self._board_offsets = bucketing.board_offsets
+  --we need to div the values by the sum of possible boards (from point of view of each hand)
+  self._value_weight = 1/(self.board_count - 2)
+  self._gathered = arguments.Tensor()
 end
 
 --- Converts a range vector over private hands to a range vector over buckets.
@@ -65,7 +59,8 @@ end
 --  over buckets
 -- @local
 function NextRoundValue:_card_range_to_bucket_range(card_range, bucket_range)
-  bucket_range:mm(card_range, self._range_matrix)
+  self._gathered:index(card_range, 2, self._card_indexes)
+  bucket_range:zero():indexAdd(2, self._bucket_indexes, self._gathered)
 end
 
 --- Converts a value vector over buckets to a value vector over private hands.
@@ -74,7 +69,9 @@ end
 -- private hands
 -- @local
 function NextRoundValue:_bucket_value_to_card_value(bucket_value, card_value)
-  card_value:mm(bucket_value, self._reverse_value_matrix)
+  self._gathered:index(bucket_value, 2, self._bucket_indexes)
+  card_value:zero():indexAdd(2, self._card_indexes, self._gathered)
+  card_value:mul(self._value_weight)
 end
 
 --- Converts a value vector over buckets to a value vector over private hands
@@ -86,10 +83,12 @@ end
 -- @local
 function NextRoundValue:_bucket_value_to_card_value_on_board(board, bucket_value, card_value)
   local board_idx = card_tools:get_board_index(board)
-  local board_matrix = self._range_matrix_board_view[{{}, board_idx, {}}]:t()
+  local entries = {self._board_offsets[board_idx] + 1, self._board_offsets[board_idx + 1]}
+  local card_indexes = self._card_indexes[{entries}]
+  local bucket_indexes = self._bucket_indexes[{entries}] - (board_idx - 1) * self.bucket_count
   local serialized_card_value = card_value:view(-1, game_settings.card_count)
   local serialized_bucket_value = bucket_value[{{}, {}, board_idx, {}}]:clone():view(-1, self.bucket_count)
-  serialized_card_value:mm(serialized_bucket_value, board_matrix)
+  serialized_card_value:zero():indexCopy(2, card_indexes, serialized_bucket_value:index(2, bucket_indexes))
 end
 
 --- Initializes the value calculator with the pot size of each state that
@@ -101,6 +100,7 @@ end
 -- betting round ends
 function NextRoundValue:start_computation(pot_sizes)
   self.iter = 0
+  self.approximation_stats = nil
   self.pot_sizes = pot_sizes:view(-1, 1):clone()
   self.batch_size = pot_sizes:size(1)
 end
@@ -169,7 +169,11 @@ function NextRoundValue:get_value(ranges, values)
   local serialized_values_view= self.next_round_values:view(self.batch_size * self.board_count, -1)
 
   --computing value in the next round
-  self.nn:get_value(serialized_inputs_view, serialized_values_view)
+  if self:_is_approximate() then
+    self:_get_approximate_value(serialized_inputs_view, serialized_values_view)
+  else
+    self.nn:get_value(serialized_inputs_view, serialized_values_view)
+  end
 
   --normalizing values back according to the orginal range sum
   local normalization_view = self.value_normalization:view(self.batch_size, constants.players_count, self.board_count, 1):transpose(2,3)
@@ -184,6 +188,100 @@ function NextRoundValue:get_value(ranges, values)
   self:_bucket_value_to_card_value(self.transposed_next_round_values:view(self.batch_size * constants.players_count, -1), values:view(self.batch_size * constants.players_count, -1)) 
 end
 
+--- Checks whether the neural net outputs of earlier iterations may be reused,
+-- see @{arguments.next_round_value_tolerance} and
+-- @{arguments.next_round_value_interval}.
+-- @return `true` if the values are approximate
+-- @local
+function NextRoundValue:_is_approximate()
+  return arguments.next_round_value_tolerance > 0 or arguments.next_round_value_interval > 1
+end
+
+--- Computes the neural net outputs, reusing the outputs of earlier iterations
+-- for the inputs that have not changed much.
+--
+-- The net is only evaluated on every @{arguments.next_round_value_interval}-th
+-- iteration, and then only for the inputs whose L1 distance from the inputs
+-- of their last evaluation is above @{arguments.next_round_value_tolerance}.
+-- Other inputs keep their last outputs.
+-- @param inputs an NxI tensor of neural net inputs
+-- @param outputs an NxO tensor in which to store the neural net outputs
+-- @local
+function NextRoundValue:_get_approximate_value(inputs, outputs)
+  local row_count = inputs:size(1)
+  local stats = self.approximation_stats
+
+  if self.iter == 1 then
+    self.cached_inputs = inputs:clone()
+    self.cached_outputs = outputs:clone()
+    self.input_difference = inputs:clone()
+    self.output_difference = outputs:clone()
+    self.input_distance = arguments.Tensor(row_count, 1)
+    self.nn:get_value(self.cached_inputs, self.cached_outputs)
+    stats = {iterations = 1, rows = row_count, evaluated_rows = row_count, error_count = 0, error_sum = 0, max_error = 0}
+    self.approximation_stats = stats
+    outputs:copy(self.cached_outputs)
+    return
+  end
+  stats.iterations = stats.iterations + 1
+  stats.rows = stats.rows + row_count
+
+  if (self.iter - 1) % arguments.next_round_value_interval == 0 then
+    --finding the inputs which moved too far since their last evaluation
+    self.input_difference:add(inputs, -1, self.cached_inputs):abs()
+    self.input_distance:sum(self.input_difference, 2)
+    local stale = self.input_distance:gt(arguments.next_round_value_tolerance)
+    local stale_count = stale:sum()
+
+    if stale_count == row_count then
+      self.cached_inputs:copy(inputs)
+      self.nn:get_value(self.cached_inputs, self.cached_outputs)
+    elseif stale_count > 0 then
+      local stale_rows = stale:view(-1):nonzero():view(-1)
+      local stale_inputs = inputs:index(1, stale_rows)
+      local stale_outputs = arguments.Tensor(stale_count, outputs:size(2))
+      self.nn:get_value(stale_inputs, stale_outputs)
+      self.cached_inputs:indexCopy(1, stale_rows, stale_inputs)
+      self.cached_outputs:indexCopy(1, stale_rows, stale_outputs)
+    end
+    stats.evaluated_rows = stats.evaluated_rows + stale_count
+  end
+
+  --measuring the error against the exact outputs costs a full evaluation
+  if arguments.next_round_value_error_stats then
+    self.nn:get_value(inputs, outputs)
+    self.output_difference:add(outputs, -1, self.cached_outputs):abs()
+    stats.error_sum = stats.error_sum + self.output_difference:mean()
+    stats.error_count = stats.error_count + 1
+    stats.max_error = math.max(stats.max_error, self.output_difference:max())
+  end
+
+  outputs:copy(self.cached_outputs)
+end
+
+--- Gives statistics about the reuse of neural net outputs since the last call
+-- to @{start_computation}.
+--
+-- @return a table with the number of `iterations`, the number of neural net
+-- `rows` requested and the number of `evaluated_rows`, and, if
+-- @{arguments.next_round_value_error_stats} is set, the `mean_error` and
+-- `max_error` of the outputs against the exact ones; or `nil` if the values
+-- are not approximate
+function NextRoundValue:get_approximation_stats()
+  local stats = self.approximation_stats
+  if not stats then
+    return nil
+  end
+
+  return {
+    iterations = stats.iterations,
+    rows = stats.rows,
+    evaluated_rows = stats.evaluated_rows,
+    mean_error = stats.error_count > 0 and stats.error_sum / stats.error_count or nil,
+    max_error = stats.error_count > 0 and stats.max_error or nil,
+  }
+end
+
 --- Gives the average counterfactual values on the given board across previous
 -- calls to @{get_value}.
 -- 
@@ -68,3 +68,15 @@ print(values_3)
 
 
 
+--test of the approximate values: ranges which barely change reuse the last net outputs
+arguments.next_round_value_tolerance = 0.05
+arguments.next_round_value_error_stats = true
+next_round_value:start_computation(bets)
+for iter = 1, 10 do
+  ranges[1][2][1] = 1 + iter * 0.001
+  next_round_value:get_value(ranges, values)
+end
+local stats = next_round_value:get_approximation_stats()
+print('evaluated ' .. stats.evaluated_rows .. ' of ' .. stats.rows .. ' rows, mean error ' .. stats.mean_error .. ', max error ' .. stats.max_error)
+arguments.next_round_value_tolerance = 0
+arguments.next_round_value_error_stats = false
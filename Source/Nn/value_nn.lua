@@ -4,6 +4,8 @@
 require 'torch'
 require 'nn'
 local arguments = require 'Settings.arguments'
+--loaded only when needed, since it requires the LuaJIT FFI
+local native = nil
 
 local ValueNn = torch.class('ValueNn')
 
@@ -35,6 +37,59 @@ function ValueNn:__init()
   self.mlp = torch.load(net_file .. '.model')
   print('NN architecture:')
   print(self.mlp)
+
+  if arguments.native_value_net then
+    self:_build_native()
+  end
+end
+
+--- Copies the neural net's weights to the native library, used when
+-- `arguments.native_value_net` is set.
+--
+-- The net must have the architecture built by @{net_builder}, with a
+-- feedforward part made of `nn.Linear` layers, each optionally followed by
+-- an `nn.PReLU`. The weights are stored with `arguments.value_net_precision`.
+-- @local
+function ValueNn:_build_native()
+  native = native or require 'Native.native'
+  assert(native:available(), 'native_value_net needs the library built in Source/Native')
+  assert(not arguments.gpu, 'native_value_net runs on the CPU only')
+  local ffi = require 'ffi'
+  local lib = native.lib
+
+  --the feedforward part is the first branch of the first ConcatTable
+  local feedforward = self.mlp.modules[1].modules[1]
+  assert(torch.type(feedforward) == 'nn.Sequential' and torch.type(self.mlp.modules[3]) == 'nn.CAddTable',
+    'unexpected neural net architecture')
+  local layers = feedforward.modules
+
+  local input_size = layers[1].weight:size(2)
+  local output_size = layers[#layers].weight:size(1)
+  local net = lib.dsValueNetNew(input_size, output_size)
+  assert(net ~= nil, 'could not create the native value net')
+  self.native = ffi.gc(net, lib.dsValueNetFree)
+
+  local i = 1
+  while i <= #layers do
+    local linear = layers[i]
+    assert(torch.type(linear) == 'nn.Linear', 'unsupported layer ' .. torch.type(linear))
+    local weight = linear.weight:float():contiguous()
+    local bias = linear.bias:float():contiguous()
+    local prelu_count, prelu_weight = 0, nil
+    if layers[i + 1] and torch.type(layers[i + 1]) == 'nn.PReLU' then
+      local prelu = layers[i + 1].weight:float():contiguous()
+      prelu_count, prelu_weight = prelu:nElement(), native:float_pointer(prelu)
+      i = i + 1
+    end
+    assert(lib.dsValueNetAddLayer(self.native, weight:size(2), weight:size(1),
+      native:float_pointer(weight), native:float_pointer(bias), prelu_count, prelu_weight) >= 0,
+      'could not add a layer to the native value net')
+    i = i + 1
+  end
+
+  local precision = native.precision[arguments.value_net_precision]
+  assert(precision, 'unknown value_net_precision ' .. tostring(arguments.value_net_precision))
+  assert(lib.dsValueNetSetPrecision(self.native, precision) >= 0, 'could not set the native value net precision')
 end
 
 --- Gives the neural net output for a batch of inputs.
@@ -43,5 +98,11 @@ end
 -- @param output An NxO tensor in which to store N sets of neural net outputs. 
 -- See @{net_builder} for details of each output.
 function ValueNn:get_value(inputs, output)
+  if self.native then
+    assert(native.lib.dsValueNetForward(self.native, native:float_pointer(inputs),
+      native:float_pointer(output), inputs:size(1)) >= 0)
+    return
+  end
+
   output:copy(self.mlp:forward(inputs))
 end
@@ -0,0 +1,26 @@
+require 'Nn.value_nn'
+local arguments = require 'Settings.arguments'
+
+--evaluates the same inputs with torch's nn and with the native library and compares the outputs
+local nets = {}
+for _, use_native in ipairs({false, true}) do
+  arguments.native_value_net = use_native
+  nets[#nets + 1] = ValueNn()
+end
+
+local input_size = nets[1].mlp.modules[1].modules[1].modules[1].weight:size(2)
+local output_size = input_size - 1
+
+for _, batch_size in ipairs({1, 7, 60}) do
+  local inputs = arguments.Tensor(batch_size, input_size):uniform()
+  local outputs = {}
+  for i, net in ipairs(nets) do
+    outputs[i] = arguments.Tensor(batch_size, output_size)
+    local timer = torch.Timer()
+    for _ = 1, 1000 do
+      net:get_value(inputs, outputs[i])
+    end
+    print((i == 1 and 'nn' or 'native') .. ' time for 1000 batches of ' .. batch_size .. ': ' .. timer:time().real)
+  end
+  print('max output difference: ' .. (outputs[1] - outputs[2]):abs():max())
+end
@@ -11,9 +11,17 @@ local card_tools = require 'Game.card_tools'
 local ContinualResolving = torch.class('ContinualResolving')
 
 --- Constructor. Does a depth-limited solve of the game's first node.
-function ContinualResolving:__init()
+-- @param[opt] warm a ContinualResolving whose first node solve is shared
+-- instead of solving it again, so that many tables can be played by one
+-- process
+function ContinualResolving:__init(warm)
   self.starting_player_range = card_tools:get_uniform_range(arguments.Tensor{})
-  self:resolve_first_node()
+  if warm then
+    self.first_node_resolving = warm.first_node_resolving
+    self.starting_cfvs_p1 = warm.starting_cfvs_p1
+  else
+    self:resolve_first_node()
+  end
 end
 
 --- Solves a depth-limited lookahead from the first node of the game to get 
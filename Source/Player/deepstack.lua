@@ -1,48 +1,94 @@
 --- Performs the main loop for DeepStack.
+--
+-- Run as `th Player/deepstack.lua [port]` to play a single match, or as
+-- `th Player/deepstack.lua pool` to run as a pooled bot for `bm_server`. A
+-- pooled bot re-solves the first node once, then reads `RUN host port position`
+-- commands from file descriptor 3 and plays each match, writing `READY` to file
+-- descriptor 4 whenever it is waiting for a match. It exits on `QUIT` or when
+-- the server closes the pipe.
 -- @script deepstack
 
 local arguments = require 'Settings.arguments'
 require "ACPC.acpc_game"
 require "Player.continual_resolving"
 
--- Check if the port has been provided in the command line
-if arg[1] then
-    -- Convert the port argument to a number and assign it to arguments.acpc_server_port
-    arguments.acpc_server_port = tonumber(arg[1])
-else
-    print("No port provided. Using default port: ", arguments.acpc_server_port)
-end
+--- Plays a match until the dealer closes the connection.
+-- @param acpc_game an @{acpc_game|ACPCGame} connected to the dealer
+-- @param continual_resolving the @{continual_resolving|ContinualResolving}
+-- used to choose actions
+local function play_match(acpc_game, continual_resolving)
+  local last_state = nil
+  local last_node = nil
+
+  --2.0 main loop that waits for a situation where we act and then chooses an action
+  while true do
+    local state
+    local node
+
+    --2.1 blocks until it's our situation/turn
+    state, node = acpc_game:get_next_situation()
+    if not state then
+      break
+    end
 
---1.0 create the ACPC game and connect to the server
-local acpc_game = ACPCGame()
-acpc_game:connect(arguments.acpc_server, arguments.acpc_server_port)
+    --did a new hand start?
+    if not last_state or last_state.hand_number ~= state.hand_number or node.street < last_node.street then
+      continual_resolving:start_new_hand(state)
+    end
 
-local continual_resolving = ContinualResolving()
+    --2.2 use continual resolving to find a strategy and make an action in the current node
+    local adviced_action = continual_resolving:compute_action(node, state)
 
-local last_state = nil
-local last_node = nil
+    --2.3 send the action to the dealer
+    acpc_game:play_action(adviced_action)
 
---2.0 main loop that waits for a situation where we act and then chooses an action
-while true do
-  local state
-  local node
+    last_state = state
+    last_node = node
 
-  --2.1 blocks until it's our situation/turn
-  state, node = acpc_game:get_next_situation()
-  
-  --did a new hand start?
-  if not last_state or last_state.hand_number ~= state.hand_number or node.street < last_node.street then
-    continual_resolving:start_new_hand(state)
+    collectgarbage()
   end
 
-  --2.2 use continual resolving to find a strategy and make an action in the current node
-  local adviced_action = continual_resolving:compute_action(node, state)
+  acpc_game:close()
+end
+
+if arg[1] == 'pool' then
+  --1.0 solve the first node before saying we're ready, so matches start immediately
+  local continual_resolving = ContinualResolving()
+  local commands = assert(io.open('/dev/fd/3', 'r'))
+  local replies = assert(io.open('/dev/fd/4', 'w'))
 
-  --2.3 send the action to the dealer
-  acpc_game:play_action(adviced_action)
+  while true do
+    replies:write('READY\n')
+    replies:flush()
 
-  last_state = state
-  last_node = node
+    local line = commands:read('*l')
+    if not line or line:find('^QUIT') then
+      break
+    end
 
-  collectgarbage()
-end
\ No newline at end of file
+    local server, port = line:match('^RUN (%S+) (%d+)')
+    if server then
+      local acpc_game = ACPCGame()
+      acpc_game:connect(server, tonumber(port))
+      play_match(acpc_game, continual_resolving)
+    else
+      print("Bad pool command: ", line)
+    end
+  end
+else
+  -- Check if the port has been provided in the command line
+  if arg[1] then
+      -- Convert the port argument to a number and assign it to arguments.acpc_server_port
+      arguments.acpc_server_port = tonumber(arg[1])
+  else
+      print("No port provided. Using default port: ", arguments.acpc_server_port)
+  end
+
+  --1.0 create the ACPC game and connect to the server
+  local acpc_game = ACPCGame()
+  acpc_game:connect(arguments.acpc_server, arguments.acpc_server_port)
+
+  local continual_resolving = ContinualResolving()
+
+  play_match(acpc_game, continual_resolving)
+end
@@ -0,0 +1,160 @@
+--- Runs DeepStack as a long-lived solver which plays many tables at once.
+--
+-- Run as `th Player/solver_daemon.lua [socket_path]`. The daemon loads the
+-- neural net and solves the first node once, then listens on a Unix-domain
+-- socket (`arguments.solver_socket` by default). Each connection is one seat
+-- at one table: the client sends every line it receives from the dealer, and
+-- the daemon answers each line with the message to send back to the dealer,
+-- or with an empty line when DeepStack does not act. `ACPCServer/deepstack_adapter`
+-- is such a client.
+--
+-- Each table keeps its own continual re-solving invariants. On the CPU, every
+-- table is served by its own forked process, which shares the loaded net and
+-- the first node's solution copy-on-write, so a long re-solve on one table
+-- does not hold up the others; each process uses one torch thread. On the GPU
+-- (which does not survive a fork) tables are served one message at a time in
+-- the order the messages arrive, so the dealer's response timeout has to
+-- allow for a re-solve on every other table.
+-- @script solver_daemon
+
+local arguments = require 'Settings.arguments'
+local socket = require 'socket'
+local unix = require 'socket.unix'
+require "ACPC.acpc_game"
+require "Player.continual_resolving"
+
+local socket_path = arg[1] or arguments.solver_socket
+
+local ffi = require 'ffi'
+ffi.cdef[[
+int fork(void);
+int waitpid(int pid, int *status, int options);
+]]
+local WNOHANG = 1
+local fork_tables = not arguments.gpu
+
+--1.0 load the neural net and solve the first node, shared by every table
+local warm_resolving = ContinualResolving()
+
+--2.0 listen for tables
+os.remove(socket_path)
+local server = assert((unix.stream or unix)())
+assert(server:bind(socket_path))
+assert(server:listen(64))
+print("Solver listening on " .. socket_path)
+
+local connections = {server}
+local tables = {}
+
+--- Answers one dealer message for a table.
+-- @param game_table the table the message is for
+-- @param msg the message from the dealer
+-- @return the message to send back to the dealer, or an empty string
+local function answer_message(game_table, msg)
+  local state, node = game_table.acpc_game:parse_message(msg)
+  if not state then
+    return ''
+  end
+
+  --did a new hand start?
+  local last_state = game_table.last_state
+  if not last_state or last_state.hand_number ~= state.hand_number or node.street < game_table.last_node.street then
+    game_table.continual_resolving:start_new_hand(state)
+  end
+
+  local adviced_action = game_table.continual_resolving:compute_action(node, state)
+
+  game_table.last_state = state
+  game_table.last_node = node
+
+  return game_table.acpc_game:action_to_message(adviced_action)
+end
+
+--- Stops serving a table.
+-- @param connection the table's connection
+local function close_table(connection)
+  for i = 2, #connections do
+    if connections[i] == connection then
+      table.remove(connections, i)
+      break
+    end
+  end
+  tables[connection] = nil
+  connection:close()
+end
+
+--- Creates the state of a new table.
+-- @return the table
+local function new_table()
+  return {acpc_game = ACPCGame(), continual_resolving = ContinualResolving(warm_resolving)}
+end
+
+--- Serves one table in a forked process until its connection closes.
+-- @param connection the table's connection
+local function serve_forked_table(connection)
+  server:close()
+  --OpenMP's threads do not survive the fork, and the tables run in parallel
+  --as processes anyway
+  torch.setnumthreads(1)
+  local game_table = new_table()
+  while true do
+    local msg = connection:receive('*l')
+    if not msg then
+      break
+    end
+    local ok, reply = pcall(answer_message, game_table, msg)
+    if not ok then
+      print("Dropping table after error: ", reply)
+      break
+    end
+    connection:send(reply .. '\n')
+  end
+  connection:close()
+  os.exit(0)
+end
+
+--3.0 serve tables until killed
+while true do
+  local readable = socket.select(connections, nil, 1)
+
+  --nothing to do, so clean up while we wait
+  if #readable == 0 then
+    collectgarbage()
+  end
+
+  --reap the processes of closed tables
+  while fork_tables and ffi.C.waitpid(-1, nil, WNOHANG) > 0 do
+  end
+
+  for _, connection in ipairs(readable) do
+    if connection == server then
+      local client = server:accept()
+      if client and fork_tables then
+        local pid = ffi.C.fork()
+        if pid == 0 then
+          serve_forked_table(client)
+        elseif pid < 0 then
+          print("Could not fork a process for a table")
+        end
+        client:close()
+      elseif client then
+        table.insert(connections, client)
+        tables[client] = new_table()
+      end
+    else
+      local msg = connection:receive('*l')
+      if not msg then
+        close_table(connection)
+      else
+        --a failure on one table should not take down the others
+        local ok, reply = pcall(answer_message, tables[connection], msg)
+        if ok then
+          connection:send(reply .. '\n')
+        else
+          print("Dropping table after error: ", reply)
+          close_table(connection)
+        end
+      end
+    end
+  end
+end
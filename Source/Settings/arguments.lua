@@ -16,6 +16,8 @@ params.bet_sizing = {1}
 params.acpc_server = "localhost"
 --- server port running the ACPC dealer
 params.acpc_server_port = 20000
+--- Unix-domain socket the solver daemon listens on
+params.solver_socket = "/tmp/deepstack_solver.sock"
 --- the number of betting rounds in the game
 params.streets_count = 2
 --- the tensor datatype used for storing DeepStack's internal data
@@ -30,10 +32,50 @@ params.stack = 1200
 params.cfr_iters = 1000
 --- the number of preliminary CFR iterations which DeepStack doesn't factor into the average strategy (included in cfr_iters)
 params.cfr_skip_iters = 500
+--- the L1 distance between a neural net input of the next round's values and its input at the last evaluation below which the last output is reused (0 always evaluates the net)
+params.next_round_value_tolerance = 0
+--- the next round's values evaluate the neural net only every this many CFR iterations, reusing the last outputs in between (1 evaluates it on every iteration)
+params.next_round_value_interval = 1
+--- whether to measure the error of reused neural net outputs against the exact ones, which costs an extra evaluation per iteration, and print it after re-solving
+params.next_round_value_error_stats = false
+--- whether to run the lookahead's CFR iterations in the native library (build it with `make` in `Source/Native`)
+params.native_lookahead = false
+--- whether the Lua lookahead uses the native library's fused regret matching kernel (implied by `native_lookahead`)
+params.native_regret_matching = false
+--- whether to evaluate the value network with the native library instead of torch's nn
+params.native_value_net = false
+--- the weight precision of the native value network: 'float', 'bf16' (bfloat16 weights) or 'int8' (weights with per-output scales); accumulation is always in float. See `Nn/calibrate_value_nn.lua` for the effect on the validation loss
+params.value_net_precision = 'float'
+--- whether the table of hand strengths on every board is built by the native library instead of with torch
+params.native_hand_evaluation = false
+--- path to the native library
+params.native_library = './Native/libdeepstack_native.so'
+--- the directory in which the terminal equity matrices of every board are saved and loaded (with a trailing slash, e.g. '../Data/TerminalEquity/'), or false to build them in each process
+params.terminal_equity_cache_directory = false
+--- whether terminal equities are computed from the hands sorted by strength with prefix sums, in O(K) per range rather than with a KxK matrix product (the native lookahead keeps using the matrices)
+params.structured_terminal_equity = false
 --- how many poker situations are solved simultaneously during data generation
 params.gen_batch_size = 10
+--- how many worker processes generate data in shards (0 generates single files in one process)
+params.gen_workers = 0
+--- how many poker situations are saved in each data shard (a multiple of gen_batch_size)
+params.gen_shard_size = 100
+--- the random seed of the first data shard, each shard has its own seed
+params.gen_seed = 0
 --- how many poker situations are used in each neural net training batch
 params.train_batch_size = 100
+--- whether training streams batches from the memory-mapped `.chunks` files written by `Training/main_convert_data.lua` instead of loading the data into memory (needs the native library)
+params.train_data_streaming = false
+--- how many examples are in each chunk of a streamed data file; epochs visit the chunks in a random order
+params.train_chunk_rows = 1024
+--- how many chunks of a streamed data file are shuffled together
+params.train_shuffle_window = 16
+--- how many streamed batches are assembled ahead of training
+params.train_prefetch_batches = 4
+--- whether the neural net is trained by the native library's multithreaded trainer instead of torch's optim (CPU only)
+params.native_training = false
+--- how many threads the native trainer splits each batch between
+params.train_threads = 4
 --- path to the solved poker situation data used to train the neural net
 params.data_path = '../Data/TrainSamples/PotBet/'
 --- path to the neural net model
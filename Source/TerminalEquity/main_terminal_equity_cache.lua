@@ -0,0 +1,10 @@
+--- Script that builds the terminal equity matrices of every board and saves
+-- them to @{arguments.terminal_equity_cache_directory}, so that later
+-- processes load them instead of building them.
+-- @script main_terminal_equity_cache
+
+local arguments = require 'Settings.arguments'
+assert(arguments.terminal_equity_cache_directory, 'arguments.terminal_equity_cache_directory must be set')
+require 'TerminalEquity.terminal_equity'
+
+TerminalEquity():build_cache()
@@ -9,6 +9,10 @@ local card_tools = require 'Game.card_tools'
 
 local TerminalEquity = torch.class('TerminalEquity')
 
+--the call and fold matrices of each board, shared by all instances so that
+--they are built at most once per process, see @{_get_board_matrices}
+local matrix_cache = nil
+
 --- Constructor
 function TerminalEquity:__init()
 end
@@ -50,22 +54,24 @@ function TerminalEquity:_handle_blocking_cards(equity_matrix, board)
   equity_matrix:cmul(possible_hand_matrix);
 end
 
---- Sets the evaluator's fold matrix, which gives the equity for terminal
+--- Computes the fold matrix, which gives the equity for terminal
 -- nodes where one player has folded.
 -- 
 -- Creates the matrix `B` such that for player ranges `x` and `y`, `x'By` is the equity
 -- for the player who doesn't fold
 -- @param board a possibly empty vector of board cards
+-- @return the fold matrix
 -- @local
-function TerminalEquity:_set_fold_matrix(board)
-  self.fold_matrix = arguments.Tensor(game_settings.card_count, game_settings.card_count);
-  self.fold_matrix:fill(1);
+function TerminalEquity:_compute_fold_matrix(board)
+  local fold_matrix = arguments.Tensor(game_settings.card_count, game_settings.card_count);
+  fold_matrix:fill(1);
   --setting cards that block each other to zero - exactly elements on diagonal in leduc variants
-  self.fold_matrix:csub(torch.eye(game_settings.card_count):typeAs(self.fold_matrix))
-  self:_handle_blocking_cards(self.fold_matrix, board);
+  fold_matrix:csub(torch.eye(game_settings.card_count):typeAs(fold_matrix))
+  self:_handle_blocking_cards(fold_matrix, board);
+  return fold_matrix
 end;
 
---- Sets the evaluator's call matrix, which gives the equity for terminal
+--- Computes the call matrix, which gives the equity for terminal
 -- nodes where no player has folded.
 -- 
 -- For nodes in the last betting round, creates the matrix `A` such that for player ranges
@@ -73,37 +79,258 @@ end;
 -- in the first betting round, gives the weighted average of all such possible matrices.
 --
 -- @param board a possibly empty vector of board cards
+-- @return the call matrix
 -- @local
-function TerminalEquity:_set_call_matrix(board)
+function TerminalEquity:_compute_call_matrix(board)
   local street = card_tools:board_to_street(board);
-  self.equity_matrix = arguments.Tensor(game_settings.card_count, game_settings.card_count):zero();
+  local equity_matrix = arguments.Tensor(game_settings.card_count, game_settings.card_count):zero();
   
   if street == 1 then
-    --iterate through all possible next round streets
+    --iterate through all possible next round streets, whose matrices are cached as well
     local next_round_boards = card_tools:get_second_round_boards();
     local boards_count = next_round_boards:size(1);
-    local next_round_equity_matrix = arguments.Tensor(game_settings.card_count, game_settings.card_count);
     for board = 1, boards_count do
-      self:get_last_round_call_matrix(next_round_boards[board], next_round_equity_matrix);
-      self.equity_matrix:add(next_round_equity_matrix);
+      equity_matrix:add(self:_get_board_matrices(next_round_boards[board]).equity_matrix);
     end;
     --averaging the values in the call matrix
     local weight_constant = game_settings.board_card_count == 1 and 1/(game_settings.card_count -2) or 2/((game_settings.card_count -2) * (game_settings.card_count -3 ))
-    self.equity_matrix:mul(weight_constant);
+    equity_matrix:mul(weight_constant);
   elseif  street == 2  then
     --for last round we just return the matrix
-    self:get_last_round_call_matrix(board, self.equity_matrix);
+    self:get_last_round_call_matrix(board, equity_matrix);
   else
     --impossible street
     assert(false, 'impossible street');
   end
+  return equity_matrix
+end
+
+--- Gives the file which the matrix cache is saved to.
+-- @return the file name, which depends on the game variant, or `nil` if
+-- @{arguments.terminal_equity_cache_directory} is not set
+-- @local
+function TerminalEquity:_get_cache_file()
+  local directory = arguments.terminal_equity_cache_directory
+  if not directory then
+    return nil
+  end
+  return string.format('%sterminal_equity_%d_cards_%d_board.t7', directory, game_settings.card_count, game_settings.board_card_count)
+end
+
+--- Loads the matrix cache from @{_get_cache_file} if it is there and was
+-- saved for the same game variant.
+--
+-- A cache which can not be read or misses boards is ignored, so that it is
+-- built again.
+-- @return `true` if the cache was loaded
+-- @local
+function TerminalEquity:_load_cache()
+  local file_name = self:_get_cache_file()
+  local file = file_name and io.open(file_name, 'r')
+  if not file then
+    return false
+  end
+  file:close()
+
+  local loaded, saved = pcall(torch.load, file_name)
+  if not loaded or type(saved) ~= 'table' or type(saved.matrices) ~= 'table' then
+    print('ignoring unreadable terminal equity cache ' .. file_name)
+    return false
+  end
+  if saved.card_count ~= game_settings.card_count or saved.board_card_count ~= game_settings.board_card_count then
+    return false
+  end
+  for board_index = 0, card_tools:get_boards_count() do
+    if not saved.matrices[board_index] then
+      print('ignoring incomplete terminal equity cache ' .. file_name)
+      return false
+    end
+  end
+  local tensor_type = arguments.Tensor():type()
+  for _, matrices in pairs(saved.matrices) do
+    matrices.equity_matrix = matrices.equity_matrix:type(tensor_type)
+    matrices.fold_matrix = matrices.fold_matrix:type(tensor_type)
+  end
+  matrix_cache = saved.matrices
+  return true
+end
+
+--- Builds the call and fold matrices of every board and saves them to
+-- @{_get_cache_file} if @{arguments.terminal_equity_cache_directory} is set.
+--
+-- The cache is otherwise filled one board at a time as boards are used.
+function TerminalEquity:build_cache()
+  matrix_cache = matrix_cache or {}
+  self:_get_board_matrices(torch.Tensor())
+  local boards = card_tools:get_second_round_boards()
+  for board = 1, boards:size(1) do
+    self:_get_board_matrices(boards[board])
+  end
+
+  local file_name = self:_get_cache_file()
+  if file_name then
+    --several processes can build the cache at once, so each writes its own
+    --temporary file and moves it into place once complete
+    local temp_name = os.tmpname()
+    os.remove(temp_name)
+    local partial_name = file_name .. '.' .. temp_name:match('[^/]+$') .. '.partial'
+    --only the matrices are saved, the showdown orders are rebuilt as needed
+    --with the loading process's tensor type
+    local matrices = {}
+    for board_index, board_matrices in pairs(matrix_cache) do
+      matrices[board_index] = {equity_matrix = board_matrices.equity_matrix, fold_matrix = board_matrices.fold_matrix}
+    end
+    torch.save(partial_name, {
+      card_count = game_settings.card_count,
+      board_card_count = game_settings.board_card_count,
+      matrices = matrices,
+    })
+    assert(os.rename(partial_name, file_name))
+  end
+end
+
+--- Gives the cached call and fold matrices of a board, building them if
+-- needed.
+--
+-- The first call loads the cache from disk if @{arguments.terminal_equity_cache_directory}
+-- is set, or builds and saves it if it is not there yet.
+-- @param board a possibly empty vector of board cards
+-- @return a table with the `equity_matrix` and the `fold_matrix` of the board,
+-- which are shared and must not be modified
+-- @local
+function TerminalEquity:_get_board_matrices(board)
+  if not matrix_cache then
+    if not self:_load_cache() and self:_get_cache_file() then
+      self:build_cache()
+    end
+    matrix_cache = matrix_cache or {}
+  end
+
+  --the first round's empty board has index 0
+  local board_index = card_tools:board_to_street(board) == 1 and 0 or card_tools:get_board_index(board)
+  local matrices = matrix_cache[board_index]
+  if not matrices then
+    matrices = {equity_matrix = self:_compute_call_matrix(board), fold_matrix = self:_compute_fold_matrix(board)}
+    matrix_cache[board_index] = matrices
+  end
+  if arguments.structured_terminal_equity and not matrices.possible_hands then
+    self:_set_showdown_orders(board, matrices)
+  end
+  return matrices
+end
+
+--- Computes the hands of a last round board sorted by strength, which
+-- @{_showdown_value} uses instead of the call matrix.
+-- @param board a non-empty vector of board cards
+-- @return a table with the LongTensors `hands`, the hands which are possible
+-- on the board; `sorted_hands`, the same hands from weakest to strongest;
+-- and `weaker_ends` and `stronger_starts`, which for each of `hands` give
+-- one plus the number of hands in `sorted_hands` which are weaker, and which
+-- are not stronger
+-- @local
+function TerminalEquity:_compute_showdown_order(board)
+  local strength = evaluator:batch_eval(board):float()
+  local possible_hands = card_tools:get_possible_hand_indexes(board)
+  local hands, hand_strengths = {}, {}
+  for hand = 1, game_settings.card_count do
+    if possible_hands[hand] > 0 then
+      hands[#hands + 1] = hand
+      hand_strengths[#hand_strengths + 1] = strength[hand]
+    end
+  end
+  local hand_count = #hands
+  local sorted_strengths, order = torch.FloatTensor(hand_strengths):sort()
+  local weaker_ends = torch.LongTensor(hand_count)
+  local stronger_starts = torch.LongTensor(hand_count)
+
+  --hands of equal strength tie, so they share their counts
+  local first = 1
+  while first <= hand_count do
+    local last = first
+    while last < hand_count and sorted_strengths[last + 1] == sorted_strengths[first] do
+      last = last + 1
+    end
+    for position = first, last do
+      weaker_ends[order[position]] = first
+      stronger_starts[order[position]] = last + 1
+    end
+    first = last + 1
+  end
+
+  hands = torch.LongTensor(hands)
+  return {
+    hands = hands,
+    sorted_hands = hands:index(1, order),
+    weaker_ends = weaker_ends,
+    stronger_starts = stronger_starts,
+  }
+end
+
+--- Adds the data used by the structured evaluation of @{call_value} and
+-- @{fold_value} to a board's cached matrices.
+-- @param board a possibly empty vector of board cards
+-- @param matrices the board's entry in the matrix cache
+-- @local
+function TerminalEquity:_set_showdown_orders(board, matrices)
+  matrices.possible_hands = card_tools:get_possible_hand_indexes(board):view(1, -1)
+  matrices.showdown_orders = {}
+  if card_tools:board_to_street(board) == 1 then
+    --the first round's showdowns average the showdowns on every next round board
+    local next_round_boards = card_tools:get_second_round_boards()
+    for next_board = 1, next_round_boards:size(1) do
+      matrices.showdown_orders[next_board] = self:_compute_showdown_order(next_round_boards[next_board])
+    end
+    matrices.showdown_weight = game_settings.board_card_count == 1 and 1/(game_settings.card_count -2) or 2/((game_settings.card_count -2) * (game_settings.card_count -3 ))
+  else
+    matrices.showdown_orders[1] = self:_compute_showdown_order(board)
+    matrices.showdown_weight = 1
+  end
 end
 
 --- Sets the board cards for the evaluator and creates its internal data structures.
+--
+-- The matrices of each board are built once per process and shared by all
+-- evaluators.
 -- @param board a possibly empty vector of board cards
 function TerminalEquity:set_board(board)
-    self:_set_call_matrix(board);
-    self:_set_fold_matrix(board);
+    local matrices = self:_get_board_matrices(board);
+    self.equity_matrix = matrices.equity_matrix;
+    self.fold_matrix = matrices.fold_matrix;
+    local structured = arguments.structured_terminal_equity;
+    self.possible_hands = structured and matrices.possible_hands or nil;
+    self.showdown_orders = structured and matrices.showdown_orders or nil;
+    self.showdown_weight = structured and matrices.showdown_weight or nil;
+end
+
+--- Adds the showdown values against a batch of ranges on one last round
+-- board to `result`.
+--
+-- Each hand wins the range's probability mass of the weaker hands and loses
+-- that of the stronger ones, which is read off the prefix sums of the range
+-- in order of strength, so that this takes O(K) rather than O(K^2) per range.
+-- @param order the board's hand order from @{_compute_showdown_order}
+-- @param ranges an NxK tensor of opponent ranges
+-- @param result an NxK tensor to which the cfvs are added
+-- @local
+function TerminalEquity:_showdown_value(order, ranges, result)
+  local batch_size = ranges:size(1)
+  local hand_count = order.hands:size(1)
+  self._sorted_ranges = self._sorted_ranges or arguments.Tensor()
+  self._prefix_sums = self._prefix_sums or arguments.Tensor()
+  self._weaker_mass = self._weaker_mass or arguments.Tensor()
+  self._stronger_mass = self._stronger_mass or arguments.Tensor()
+
+  --the prefix sums start with an empty sum, so that the sum of the first k hands is at k + 1
+  self._sorted_ranges:index(ranges, 2, order.sorted_hands)
+  self._prefix_sums:resize(batch_size, hand_count + 1)
+  self._prefix_sums[{{}, 1}]:zero()
+  self._prefix_sums[{{}, {2, hand_count + 1}}]:copy(self._sorted_ranges:cumsum(2))
+
+  self._weaker_mass:index(self._prefix_sums, 2, order.weaker_ends)
+  self._stronger_mass:index(self._prefix_sums, 2, order.stronger_starts)
+  self._stronger_mass:mul(-1):add(self._prefix_sums[{{}, {hand_count + 1}}]:expandAs(self._stronger_mass))
+  self._stronger_mass:csub(self._weaker_mass)
+  result:indexAdd(2, order.hands, self._stronger_mass)
 end
 
 --- Computes (a batch of) counterfactual values that a player achieves at a terminal node
@@ -115,6 +342,15 @@ end
 -- and K is the range size
 -- @param result a NxK tensor in which to save the cfvs
 function TerminalEquity:call_value( ranges, result )
+  if self.showdown_orders then
+    result:zero()
+    for _, order in ipairs(self.showdown_orders) do
+      self:_showdown_value(order, ranges, result)
+    end
+    result:mul(self.showdown_weight)
+    return
+  end
+
   result:mm(ranges, self.equity_matrix);
 end
 
@@ -128,6 +364,17 @@ end
 -- @param result A NxK tensor in which to save the cfvs. Positive cfvs are returned, and
 -- must be negated if the player in question folded.
 function TerminalEquity:fold_value( ranges, result )
+  if self.possible_hands then
+    --each possible hand gets the opponent's mass on the other possible hands
+    --(in leduc variants only the same card blocks a hand)
+    local possible_hands = self.possible_hands:expandAs(ranges)
+    result:cmul(ranges, possible_hands)
+    self._range_mass = self._range_mass or arguments.Tensor()
+    self._range_mass:sum(result, 2)
+    result:mul(-1):add(self._range_mass:expandAs(result)):cmul(possible_hands)
+    return
+  end
+
   result:mm(ranges, self.fold_matrix);
 end
 
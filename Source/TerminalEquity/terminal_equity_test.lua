@@ -0,0 +1,32 @@
+require 'TerminalEquity.terminal_equity'
+local arguments = require 'Settings.arguments'
+local game_settings = require 'Settings.game_settings'
+local card_tools = require 'Game.card_tools'
+
+--compares the structured terminal equity with the matrix products on every board
+local boards = {torch.Tensor()}
+local next_round_boards = card_tools:get_second_round_boards()
+for board = 1, next_round_boards:size(1) do
+  boards[#boards + 1] = next_round_boards[board]
+end
+
+local ranges = arguments.Tensor(10, game_settings.card_count):uniform()
+local matrix_result = ranges:clone()
+local structured_result = ranges:clone()
+local max_difference = 0
+for _, board in ipairs(boards) do
+  arguments.structured_terminal_equity = false
+  local matrix_equity = TerminalEquity()
+  matrix_equity:set_board(board)
+  arguments.structured_terminal_equity = true
+  local structured_equity = TerminalEquity()
+  structured_equity:set_board(board)
+
+  for _, value_function in ipairs({'call_value', 'fold_value'}) do
+    matrix_equity[value_function](matrix_equity, ranges, matrix_result)
+    structured_equity[value_function](structured_equity, ranges, structured_result)
+    max_difference = math.max(max_difference, (matrix_result - structured_result):abs():max())
+  end
+end
+arguments.structured_terminal_equity = false
+print('max difference between the matrix and structured terminal equity: ' .. max_difference)
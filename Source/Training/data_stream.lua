@@ -4,28 +4,61 @@
 require 'torch'
 local arguments = require 'Settings.arguments'
 local DataStream = torch.class('DataStream')
+--loaded only when streaming, since it requires the LuaJIT FFI
+local native = nil
+
+--- Loads one data set, either from single files or from the shards listed
+-- in the set's manifest.
+-- @param prefix the prefix of the data set's files
+-- @return the inputs of the data set
+-- @return the targets of the data set
+-- @return the masks of the data set
+function DataStream.load_data_set(prefix)
+  local manifest = io.open(prefix .. '.manifest', 'r')
+  if not manifest then
+    return torch.load(prefix .. '.inputs'), torch.load(prefix .. '.targets'), torch.load(prefix .. '.mask')
+  end
+
+  --shard names are relative to the manifest
+  local directory = prefix:match('^(.*/)') or ''
+  local inputs, targets, mask = {}, {}, {}
+  for line in manifest:lines() do
+    local shard_name = line:match('^(%S+)')
+    if shard_name then
+      table.insert(inputs, torch.load(directory .. shard_name .. '.inputs'))
+      table.insert(targets, torch.load(directory .. shard_name .. '.targets'))
+      table.insert(mask, torch.load(directory .. shard_name .. '.mask'))
+    end
+  end
+  manifest:close()
+  assert(#inputs > 0, 'empty manifest ' .. prefix .. '.manifest')
+
+  return torch.cat(inputs, 1), torch.cat(targets, 1), torch.cat(mask, 1)
+end
 
 --- Constructor.
 -- 
 -- Reads the data from training and validation files generated with
--- @{data_generation_call.generate_data}.
+-- @{data_generation_call.generate_data}, or from the shard sets generated
+-- with @{data_generation.generate_data_parallel}.
 function DataStream:__init()
+  if arguments.train_data_streaming then
+    self:_init_streaming()
+    return
+  end
+
   --loadind valid data
   self.data = {}
   local valid_prefix = arguments.data_path .. 'valid'
-  self.data.valid_mask= torch.load(valid_prefix .. '.mask')
+  self.data.valid_inputs, self.data.valid_targets, self.data.valid_mask = DataStream.load_data_set(valid_prefix)
   self.data.valid_mask= self.data.valid_mask:repeatTensor(1,2)
-  self.data.valid_targets = torch.load(valid_prefix .. '.targets')
-  self.data.valid_inputs = torch.load(valid_prefix .. '.inputs')
   self.valid_data_count = self.data.valid_inputs:size(1)
   assert(self.valid_data_count >= arguments.train_batch_size, 'Validation data count has to be greater than a train batch size!')
   self.valid_batch_count = self.valid_data_count / arguments.train_batch_size
   --loading train data
   local train_prefix = arguments.data_path .. 'train'
-  self.data.train_mask = torch.load(train_prefix .. '.mask')
+  self.data.train_inputs, self.data.train_targets, self.data.train_mask = DataStream.load_data_set(train_prefix)
   self.data.train_mask = self.data.train_mask:repeatTensor(1,2)
-  self.data.train_inputs = torch.load(train_prefix .. '.inputs')
-  self.data.train_targets = torch.load(train_prefix .. '.targets')
   self.train_data_count = self.data.train_inputs:size(1)
   assert(self.train_data_count >= arguments.train_batch_size, 'Training data count has to be greater than a train batch size!')
   self.train_batch_count = self.train_data_count / arguments.train_batch_size
@@ -36,6 +69,106 @@ function DataStream:__init()
       self.data[key] = value:cuda()
     end
   end
+
+  self:_init_batch_buffers(self.data.train_inputs:size(2), self.data.train_targets:size(2), self.data.train_mask:size(2))
+end
+
+--- Creates the two sets of buffers that training batches are assembled in.
+--
+-- Consecutive batches alternate between the buffers, so a batch stays valid
+-- while the next one is assembled.
+-- @param input_size the size of each input
+-- @param target_size the size of each target
+-- @param mask_size the size of each (repeated) mask
+-- @local
+function DataStream:_init_batch_buffers(input_size, target_size, mask_size)
+  local batch_size = arguments.train_batch_size
+  self.batch_buffers = {}
+  for i = 1, 2 do
+    local buffers = {
+      inputs = arguments.Tensor(batch_size, input_size),
+      targets = arguments.Tensor(batch_size, target_size),
+      mask = arguments.Tensor(batch_size, mask_size),
+    }
+    if arguments.gpu then
+      for key, value in pairs(buffers) do
+        buffers[key] = value:cuda()
+      end
+    end
+    self.batch_buffers[i] = buffers
+  end
+end
+
+--- Opens the training and validation `.chunks` files for streaming, used
+-- when @{arguments.train_data_streaming} is set.
+--
+-- Batches are assembled from the memory-mapped files by the native library's
+-- prefetch thread, so the data sets are never loaded into memory.
+-- @local
+function DataStream:_init_streaming()
+  native = native or require 'Native.native'
+  assert(native:available(), 'train_data_streaming needs the library built in Source/Native')
+  local ffi = require 'ffi'
+  local lib = native.lib
+
+  self.streams = {}
+  for _, name in ipairs({'train', 'valid'}) do
+    local file_name = arguments.data_path .. name .. '.chunks'
+    local file = lib.dsDataFileOpen(file_name)
+    assert(file ~= nil, 'could not open ' .. file_name)
+    local reader = lib.dsBatchReaderNew(file, arguments.train_batch_size, arguments.train_chunk_rows,
+      arguments.train_shuffle_window, 2, arguments.train_prefetch_batches)
+    if reader == nil then
+      lib.dsDataFileClose(file)
+      error('could not create a reader for ' .. file_name)
+    end
+    --the reader's thread uses the file, so they are freed together
+    reader = ffi.gc(reader, function(r)
+      lib.dsBatchReaderFree(r)
+      lib.dsDataFileClose(file)
+    end)
+
+    local batch_size = arguments.train_batch_size
+    self.streams[name] = {
+      reader = reader,
+      data_count = file.rowCount,
+      batch_count = lib.dsBatchReaderBatchCount(reader),
+      inputs = torch.FloatTensor(batch_size, file.inputSize),
+      targets = torch.FloatTensor(batch_size, file.targetSize),
+      mask = torch.FloatTensor(batch_size, file.maskSize * 2),
+    }
+  end
+
+  self.valid_data_count = self.streams.valid.data_count
+  assert(self.valid_data_count >= arguments.train_batch_size, 'Validation data count has to be greater than a train batch size!')
+  self.valid_batch_count = self.streams.valid.batch_count
+  self.train_data_count = self.streams.train.data_count
+  assert(self.train_data_count >= arguments.train_batch_size, 'Training data count has to be greater than a train batch size!')
+  self.train_batch_count = self.streams.train.batch_count
+
+  local stream = self.streams.train
+  self:_init_batch_buffers(stream.inputs:size(2), stream.targets:size(2), stream.mask:size(2))
+end
+
+--- Returns the next batch of a streamed data set.
+-- @param stream the data set's entry in `self.streams`
+-- @param buffers the batch buffers to return the batch in
+-- @return the inputs set for the batch
+-- @return the targets set for the batch
+-- @return the masks set for the batch
+-- @local
+function DataStream:_next_streamed_batch(stream, buffers)
+  --on the CPU the reader copies straight into the batch buffers
+  local host = arguments.gpu and stream or buffers
+  assert(native.lib.dsBatchReaderNext(stream.reader, native:float_pointer(host.inputs),
+    native:float_pointer(host.targets), native:float_pointer(host.mask)) > 0, 'streamed data set ended early')
+
+  if arguments.gpu then
+    buffers.inputs:copy(stream.inputs)
+    buffers.targets:copy(stream.targets)
+    buffers.mask:copy(stream.mask)
+  end
+  return buffers.inputs, buffers.targets, buffers.mask
 end
 
 --- Gives the number of batches of validation data.
@@ -57,13 +190,19 @@ end
 --- Randomizes the order of training data.
 -- 
 -- Done so that the data is encountered in a different order for each epoch.
+-- Streamed data sets start prefetching the epoch's training batches right
+-- away, so this can be called before validating the previous epoch to
+-- overlap the two.
 function  DataStream:start_epoch()
-  --data are shuffled each epoch 
-  local shuffle = torch.randperm(self.train_data_count):long()
+  if self.streams then
+    --the reader shuffles the chunks and the rows within windows of chunks
+    assert(native.lib.dsBatchReaderStartEpoch(self.streams.train.reader, 1, torch.random()) >= 0)
+    return
+  end
 
-  self.data.train_inputs = self.data.train_inputs:index(1, shuffle)
-  self.data.train_targets = self.data.train_targets:index(1, shuffle)
-  self.data.train_mask = self.data.train_mask:index(1, shuffle)
+  --data are shuffled each epoch by permuting the indexes only, each batch
+  --gathers its own rows
+  self.train_order = torch.randperm(self.train_data_count):long()
 end
 
 --- Returns a batch of data from a specified data set.
@@ -87,19 +226,41 @@ function  DataStream:get_batch(inputs, targets, mask, batch_index)
 end
 
 --- Returns a batch of data from the training set.
+--
+-- The batch is assembled in one of two sets of buffers, so it is valid until
+-- the batch after the next one is requested. Streamed batches are read in
+-- order.
 -- @param batch_index the index of the batch to return
 -- @return the inputs set for the batch
 -- @return the targets set for the batch
 -- @return the masks set for the batch
 function  DataStream:get_train_batch(batch_index)    
-    return self:get_batch(self.data.train_inputs, self.data.train_targets, self.data.train_mask, batch_index)
+    local buffers = self.batch_buffers[batch_index % 2 + 1]
+    if self.streams then
+      return self:_next_streamed_batch(self.streams.train, buffers)
+    end
+
+    local rows = self.train_order[{{(batch_index - 1) * arguments.train_batch_size + 1, batch_index * arguments.train_batch_size}}]
+    buffers.inputs:index(self.data.train_inputs, 1, rows)
+    buffers.targets:index(self.data.train_targets, 1, rows)
+    buffers.mask:index(self.data.train_mask, 1, rows)
+    return buffers.inputs, buffers.targets, buffers.mask
 end
 
 --- Returns a batch of data from the validation set.
+--
+-- Streamed batches are read in order, from the start of the set again
+-- whenever the first batch is requested.
 -- @param batch_index the index of the batch to return
 -- @return the inputs set for the batch
 -- @return the targets set for the batch
 -- @return the masks set for the batch
 function  DataStream:get_valid_batch(batch_index)
+  if self.streams then
+    if batch_index == 1 then
+      assert(native.lib.dsBatchReaderStartEpoch(self.streams.valid.reader, 0, 0) >= 0)
+    end
+    return self:_next_streamed_batch(self.streams.valid, self.batch_buffers[batch_index % 2 + 1])
+  end
   return self:get_batch(self.data.valid_inputs, self.data.valid_targets, self.data.valid_mask, batch_index)
 end
\ No newline at end of file
@@ -0,0 +1,69 @@
+--- Script that converts the training and validation data to the `.chunks`
+-- files streamed during training when @{arguments.train_data_streaming} is set.
+--
+-- Each file starts with a header of 8 int32s: a magic number, the format
+-- version, the input, target and mask sizes, the number of examples and two
+-- unused values. The examples follow as float rows holding the inputs, the
+-- targets and the mask of each one. Sharded data sets are converted one shard
+-- at a time, so they never need to fit in memory.
+-- @script main_convert_data
+
+require 'torch'
+local arguments = require 'Settings.arguments'
+
+local magic = 0x4b484344
+local version = 1
+
+--- Gives the file prefixes of a data set, one for each shard if it has a manifest.
+-- @param prefix the prefix of the data set's files
+-- @return a table of prefixes
+local function get_shard_prefixes(prefix)
+  local manifest = io.open(prefix .. '.manifest', 'r')
+  if not manifest then
+    return {prefix}
+  end
+
+  local directory = prefix:match('^(.*/)') or ''
+  local prefixes = {}
+  for line in manifest:lines() do
+    local shard_name = line:match('^(%S+)')
+    if shard_name then
+      table.insert(prefixes, directory .. shard_name)
+    end
+  end
+  manifest:close()
+  return prefixes
+end
+
+--- Writes the header of a chunk file at its start.
+local function write_header(file, input_size, target_size, mask_size, row_count)
+  file:seek(1)
+  file:writeInt(torch.IntStorage({magic, version, input_size, target_size, mask_size, row_count, 0, 0}))
+end
+
+for _, name in ipairs({'train', 'valid'}) do
+  local prefix = arguments.data_path .. name
+  local file_name = prefix .. '.chunks'
+  local partial_name = file_name .. '.partial'
+  local file = torch.DiskFile(partial_name, 'w'):binary()
+  write_header(file, 0, 0, 0, 0)
+
+  local row_count, sizes = 0, nil
+  for _, shard_prefix in ipairs(get_shard_prefixes(prefix)) do
+    local inputs = torch.load(shard_prefix .. '.inputs'):float()
+    local targets = torch.load(shard_prefix .. '.targets'):float()
+    local mask = torch.load(shard_prefix .. '.mask'):float()
+    sizes = sizes or {inputs:size(2), targets:size(2), mask:size(2)}
+    assert(inputs:size(2) == sizes[1] and targets:size(2) == sizes[2] and mask:size(2) == sizes[3], 'shards of different sizes in ' .. prefix)
+
+    file:seekEnd()
+    file:writeFloat(torch.cat({inputs, targets, mask}, 2):storage())
+    row_count = row_count + inputs:size(1)
+  end
+  assert(sizes, 'no data for ' .. prefix)
+
+  write_header(file, sizes[1], sizes[2], sizes[3], row_count)
+  file:close()
+  os.rename(partial_name, file_name)
+  print(string.format('%s: %d examples', file_name, row_count))
+end
@@ -6,6 +6,8 @@
 require 'optim'
 local arguments = require 'Settings.arguments'
 require 'Nn.masked_huber_loss'
+--loaded only when needed, since it requires the LuaJIT FFI
+local native = nil
 
 local M = {}
 
@@ -59,7 +61,54 @@ local function feval(params_new, inputs, targets, mask)
   return loss, M.grads
 end
 
+--- Creates the native library's trainer for the network, used when
+-- `arguments.native_training` is set.
+--
+-- The trainer updates the network's parameters in place, so the network is
+-- saved as usual. The network must have the architecture built by
+-- @{net_builder}, with a feedforward part made of `nn.Linear` layers, each
+-- optionally followed by an `nn.PReLU`.
+-- @param network the neural network
+-- @return the trainer
+-- @local
+function M:_build_native_trainer(network)
+  native = native or require 'Native.native'
+  assert(native:available(), 'native_training needs the library built in Source/Native')
+  assert(not arguments.gpu, 'native_training runs on the CPU only')
+  local ffi = require 'ffi'
+  local lib = native.lib
+
+  --the feedforward part is the first branch of the first ConcatTable
+  local layers = network.modules[1].modules[1].modules
+  local input_size = layers[1].weight:size(2)
+  local output_size = layers[#layers].weight:size(1)
+  local trainer = lib.dsTrainerNew(input_size, output_size, arguments.train_threads, arguments.learning_rate, 0.9, 0.999, 1e-8)
+  assert(trainer ~= nil, 'could not create the native trainer')
+  trainer = ffi.gc(trainer, lib.dsTrainerFree)
+
+  local i = 1
+  while i <= #layers do
+    local linear = layers[i]
+    assert(torch.type(linear) == 'nn.Linear', 'unsupported layer ' .. torch.type(linear))
+    local prelu_count, prelu_weight = 0, nil
+    if layers[i + 1] and torch.type(layers[i + 1]) == 'nn.PReLU' then
+      local prelu = layers[i + 1].weight
+      prelu_count, prelu_weight = prelu:nElement(), native:float_pointer(prelu)
+      i = i + 1
+    end
+    assert(lib.dsTrainerAddLayer(trainer, linear.weight:size(2), linear.weight:size(1),
+      native:float_pointer(linear.weight), native:float_pointer(linear.bias), prelu_count, prelu_weight) >= 0,
+      'could not add a layer to the native trainer')
+    i = i + 1
+  end
+
+  return trainer
+end
+
 --- Trains the neural network.
+--
+-- With `arguments.native_training`, the batches are trained by the native
+-- library with `arguments.train_threads` threads instead of torch's optim.
 -- @param network the neural network (see @{net_builder})
 -- @param data_stream a @{data_stream|DataStream} object which provides the
 -- training data
@@ -79,31 +128,59 @@ function M:train(network, data_stream, epoch_count)
   local lossSum = 0
   local optim_func = optim.adam
 
+  --one adam step on a batch, and the loss of a batch without training
+  local train_batch, get_loss
+  if arguments.native_training then
+    local trainer = self:_build_native_trainer(network)
+    local lib = native.lib
+    train_batch = function(inputs, targets, mask)
+      local loss = lib.dsTrainerStep(trainer, native:float_pointer(inputs), native:float_pointer(targets), native:float_pointer(mask), inputs:size(1))
+      assert(loss >= 0, 'native training step failed')
+      return loss
+    end
+    get_loss = function(inputs, targets, mask)
+      local loss = lib.dsTrainerLoss(trainer, native:float_pointer(inputs), native:float_pointer(targets), native:float_pointer(mask), inputs:size(1))
+      assert(loss >= 0, 'native loss evaluation failed')
+      return loss
+    end
+  else
+    train_batch = function(inputs, targets, mask)
+      local _, loss = optim_func(function (x) return feval(x, inputs, targets, mask) end, M.params, state)
+      return loss[1]
+    end
+    get_loss = function(inputs, targets, mask)
+      local outputs = M.network:forward(inputs)
+      return M.criterion:forward(outputs, targets, mask)
+    end
+  end
+
   -- optimization loop
   local timer = torch.Timer()
+  data_stream:start_epoch(1)
   for epoch = 1, epoch_count do
     timer:reset()
-    data_stream:start_epoch(epoch)
     lossSum = 0
 
     for i=1, data_stream:get_train_batch_count() do
       local inputs, targets, mask = data_stream:get_train_batch(i)
       assert(mask)
-      local _, loss = optim_func(function (x) return feval(x, inputs, targets, mask) end, M.params, state)
-      lossSum = lossSum + loss[1]
+      lossSum = lossSum + train_batch(inputs, targets, mask)
     end
 
     print(string.format("Training loss: %f", lossSum / data_stream.train_batch_count))
 
+    --the next epoch's batches are prepared while validating
+    if epoch < epoch_count then
+      data_stream:start_epoch(epoch + 1)
+    end
+
     --check validation loss
     local valid_loss_sum = 0
     for i=1, data_stream:get_valid_batch_count() do
 
       local inputs, targets, mask = data_stream:get_valid_batch(i)
       assert(mask)
-      local outputs = M.network:forward(inputs)
-      local loss = M.criterion:forward(outputs, targets, mask)
-      valid_loss_sum = valid_loss_sum + loss 
+      valid_loss_sum = valid_loss_sum + get_loss(inputs, targets, mask)
     end
 
     local valid_loss = valid_loss_sum / data_stream.valid_batch_count